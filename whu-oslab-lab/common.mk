@@ -6,12 +6,22 @@ LD = ${TOOLPREFIX}ld
 OBJCOPY = ${TOOLPREFIX}objcopy
 OBJDUMP = ${TOOLPREFIX}objdump
 
+# 磁盘block大小 (512 ~ 4096, 内核和mkfs共用, 修改后需要clean并重新生成fs.img)
+BLOCK_SIZE ?= 4096
+
+# 1: 内核的memset/memmove/memcmp使用V扩展的向量指令 (需要工具链和qemu支持RVV 1.0)
+RVV ?= 0
+
 # 编译相关配置
 CFLAGS = -Wall -Werror -O -fno-omit-frame-pointer -ggdb -gdwarf-2
 CFLAGS += -MD
 CFLAGS += -mcmodel=medany
 CFLAGS += -ffreestanding -fno-common -nostdlib -mno-relax
 CFLAGS += -I.
+CFLAGS += -DBLOCK_SIZE=$(BLOCK_SIZE)
+ifeq ($(RVV),1)
+CFLAGS += -DSTR_RVV
+endif
 CFLAGS += $(shell $(CC) -fno-stack-protector -E -x c /dev/null >/dev/null 2>&1 && echo -fno-stack-protector)
 
 # Disable PIE when possible (for Ubuntu 16.10 toolchain)
@@ -28,8 +28,13 @@ typedef enum {false = 0, true = 1} bool;
 // 内核保留的物理页数量（防止用户程序耗尽内存）
 #define KERNEL_PAGES 1024
 
-//磁盘的block大小
-#define BLOCK_SIZE 1024
+//磁盘的block大小 (由common.mk的BLOCK_SIZE统一传给内核和mkfs, 默认4KB)
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 4096
+#endif
+#if BLOCK_SIZE < 512 || BLOCK_SIZE > PGSIZE || (PGSIZE % BLOCK_SIZE) != 0
+#error "BLOCK_SIZE must be a power of 2 in [512, PGSIZE]"
+#endif
 
 // 对齐宏
 #define ALIGN_DOWN(x, align) ((x) & ~((align) - 1))
@@ -5,8 +5,19 @@
 
 typedef struct buf buf_t;
 
+// 不经过buf_cache的磁盘请求 (页缓存使用)
+// [block_num, block_num + len / BLOCK_SIZE) <-> [data, data + len)
+typedef struct vio_req {
+    uint32 block_num;    // 起始block
+    uint32 len;          // 字节数, BLOCK_SIZE的整数倍
+    void* data;          // 内核地址 (直接映射)
+    volatile bool disk;  // 设备处理中
+} vio_req_t;
+
 void virtio_disk_init();
 void virtio_disk_intr();
 void virtio_disk_rw(buf_t *b, bool write);
+void virtio_disk_rw_batch(buf_t **bufs, uint32 n, bool write);
+void virtio_disk_rw_reqs(vio_req_t *reqs, uint32 n, bool write);
 
 #endif
@@ -48,7 +48,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 struct VRingDesc
 {
@@ -70,6 +70,16 @@ struct VRingUsedElem
 #define VIRTIO_BLK_T_IN 0  // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
+// the format of the first descriptor in a disk request.
+// to be followed by two more descriptors containing
+// the block, and a one-byte status.
+struct virtio_blk_outhdr
+{
+    uint32 type;
+    uint32 reserved;
+    uint64 sector;
+};
+
 struct UsedArea
 {
     uint16 flags;
@@ -3,10 +3,16 @@
 
 #include "common.h"
 
-uint32 bitmap_alloc_block();
+void   bitmap_init();
+uint32 bitmap_alloc_block(uint32 goal);
+uint32 bitmap_alloc_blocks(uint32 goal, uint32 want, uint32* got, bool reserved);
 uint16 bitmap_alloc_inode();
 void   bitmap_free_block(uint32 block_num);
 void   bitmap_free_inode(uint16 inode_num);
+uint32 bitmap_free_blocks();
+bool   bitmap_reserve_blocks(uint32 n);
+void   bitmap_unreserve_blocks(uint32 n);
 void   bitmap_print(uint32 bitmap_block_num);
+void   bitmap_stat_print();
 
 #endif
\ No newline at end of file
@@ -3,6 +3,9 @@
 
 #include "lib/lock.h"
 
+// 单次预读最多的block数
+#define N_BUF_PREFETCH 16
+
 typedef struct buf {
     /* 
         睡眠锁: 保护 data[BLOCK_SIZE] + disk
@@ -20,8 +23,13 @@ typedef struct buf {
 
 void   buf_init();
 buf_t* buf_read(uint32 block_num);
+void   buf_prefetch(uint32* block_nums, uint32 n);
 void   buf_write(buf_t* buf);
 void   buf_release(buf_t* buf);
+void   buf_pin(buf_t* buf);
+void   buf_unpin(buf_t* buf);
 void   buf_print();
+void   buf_stat_reset();
+void   buf_stat_print();
 
 #endif
\ No newline at end of file
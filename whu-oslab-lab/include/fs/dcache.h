@@ -0,0 +1,26 @@
+#ifndef __DCACHE_H__
+#define __DCACHE_H__
+
+#include "common.h"
+
+/*
+    目录项缓存: (父目录inode_num, 名字) -> inode_num
+    命中时路径解析不需要读目录block, 也不需要锁父目录
+    名字不存在也会被缓存 (负项), inode_num记为INODE_NUM_UNUSED
+    只有目录才会作为父目录出现在缓存里
+    命中时在lk_dcache内取得目标inode的引用, 与unlink后的释放不会交错
+*/
+
+#define N_DCACHE       128 // 缓存的目录项数
+#define N_DCACHE_HASH  64  // hash桶数
+
+typedef struct inode inode_t;
+
+void   dcache_init();
+bool   dcache_lookup(uint16 pinum, char* name, inode_t** ipp);
+void   dcache_insert(uint16 pinum, char* name, uint16 inum);
+void   dcache_invalidate(uint16 pinum, char* name);
+void   dcache_purge(uint16 pinum);
+void   dcache_stat_print();
+
+#endif
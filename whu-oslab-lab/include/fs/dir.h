@@ -11,8 +11,30 @@ typedef struct dirent {
     char name[DIR_NAME_LEN];
 } dirent_t;
 
+#define DIRENT_PER_BLOCK (BLOCK_SIZE / sizeof(dirent_t))
+
+// 索引目录(htree)的索引节点, 占据一个完整的block
+// 目录超过一个block后 block 0 是根节点
+#define DX_MAGIC           0x44584854 // 区分索引节点和叶子 (叶子开头是inode_num, 不会是这个值)
+#define DX_MAX_DEPTH       1          // 根 -> 中间节点 -> 叶子
+#define DX_ENTRY_PER_BLOCK ((BLOCK_SIZE - 8) / sizeof(dx_entry_t))
+#define DX_SPLIT_BLOCKS    3          // 一次分裂最多追加的block数 (根满时的中间节点 + 中间节点分裂 + 新叶子)
+
+typedef struct dx_entry {
+    uint32 hash;    // 子树负责的最小hash
+    uint32 block;   // 子树在目录文件里的block序号
+} dx_entry_t;
+
+typedef struct dx_node {
+    uint32 magic;   // DX_MAGIC
+    uint16 depth;   // 仅根节点有效: 根下面还有几层中间节点
+    uint16 count;   // 有效entry数
+    dx_entry_t entries[DX_ENTRY_PER_BLOCK];
+} dx_node_t;
+
 typedef struct inode inode_t;
 
+uint32 dir_hash(char* name);
 uint16 dir_search_entry(inode_t* pip, char* name);
 uint32 dir_add_entry(inode_t* pip, uint16 inode_num, char* name);
 uint16 dir_delete_entry(inode_t* pip, char* name);
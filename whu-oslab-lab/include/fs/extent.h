@@ -0,0 +1,35 @@
+#ifndef __EXTENT_H__
+#define __EXTENT_H__
+
+#include "common.h"
+
+/*
+    extent格式的inode (flags & INODE_F_EXTENT)
+    addrs区域存放 extent_header_t + EXT_IN_INODE 个 extent_t
+    depth = 0: 这些extent直接描述数据 (文件内连续的一段 -> 磁盘上连续的一段)
+    depth = 1: 这些extent是索引, pblock指向叶子block, 叶子block里是数据extent
+    所有extent按lblock升序排列
+*/
+
+typedef struct extent_header {
+    uint16 count;   // 有效extent数
+    uint16 depth;   // 只在inode里有效: 0 直接是数据, 1 指向叶子
+} extent_header_t;
+
+typedef struct extent {
+    uint32 lblock;  // 文件内的起始block序号
+    uint32 pblock;  // 磁盘上的起始block_num (索引项里是叶子block)
+    uint32 len;     // 连续的block数 (索引项不使用)
+} extent_t;
+
+#define EXT_IN_INODE  ((N_ADDRS * sizeof(uint32) - sizeof(extent_header_t)) / sizeof(extent_t))
+#define EXT_PER_BLOCK ((BLOCK_SIZE - sizeof(extent_header_t)) / sizeof(extent_t))
+
+typedef struct inode inode_t;
+
+uint32 extent_locate_block(inode_t* ip, uint32 bn);
+uint32 extent_map(inode_t* ip, uint32 bn, uint32* len);
+void   extent_free(inode_t* ip);
+void   extent_print(inode_t* ip);
+
+#endif
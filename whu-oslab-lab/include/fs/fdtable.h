@@ -0,0 +1,34 @@
+#ifndef __FDTABLE_H__
+#define __FDTABLE_H__
+
+#include "common.h"
+
+/*
+    进程的文件描述符表
+    开始时使用进程里内嵌的FD_INLINE项, 用满后换成一个内核页 (FD_MAX项) 并把已有的项搬过去
+    used位图记录已占用的fd, 分配时逐字找第一个不全为1的字, 取其中最低的0位
+    表只被所属进程自己访问 (没有共享fd表的线程, fork也不继承fd), 不需要加锁
+*/
+
+#define FD_INLINE   16                          // 内嵌的fd数
+#define FD_MAX      512                         // 扩展后的fd数 (一页file_t*)
+#define FD_WORDS    (FD_MAX / 64)
+
+typedef struct file file_t;
+
+typedef struct fdtable {
+    file_t** files;                  // 当前的表 (指向inline或扩展页)
+    uint32 size;                     // 当前容量 (FD_INLINE 或 FD_MAX)
+    uint32 nopen;                    // 已占用的fd数
+    uint64 used[FD_WORDS];           // 已占用的fd位图
+    file_t* inline_files[FD_INLINE]; // 内嵌的表
+} fdtable_t;
+
+void    fdtable_init(fdtable_t* fdt);
+int     fdtable_alloc(fdtable_t* fdt, file_t* file);
+int     fdtable_install(fdtable_t* fdt, int fd, file_t* file);
+file_t* fdtable_get(fdtable_t* fdt, int fd);
+file_t* fdtable_remove(fdtable_t* fdt, int fd);
+void    fdtable_close_all(fdtable_t* fdt);
+
+#endif
@@ -2,6 +2,8 @@
 #define __FILE_H__
 
 #include "common.h"
+#include "fs/inode.h"
+#include "fs/pipe.h"
 
 // file->type 选项
 
@@ -27,8 +29,18 @@ typedef struct file {
     uint16 major;     // 主设备号 (for device)
     uint32 offset;    // 偏移量   (for file)
     inode_t* ip;      // 对应的inode (for dir file device)
+    pipe_t* pipe;     // 对应的管道 (for pipe)
+    readahead_t ra;   // 顺序读检测和预读窗口 (for file)
 } file_t;
 
+// readv / writev 的一段缓冲区 (与用户态保持一致)
+typedef struct iovec {
+    uint64 base;      // 用户地址
+    uint32 len;       // 长度
+} iovec_t;
+
+#define IOV_MAX 16    // 单次readv / writev最多的段数
+
 typedef struct file_state {
     uint16 type;
     uint16 inode_num;
@@ -58,5 +70,12 @@ uint32  file_write(file_t* file, uint32 len, uint64 src, bool user);
 uint32  file_lseek(file_t* file, uint32 offset, int flags);
 file_t* file_dup(file_t* file);
 int     file_stat(file_t* file, uint64 addr);
+int     file_fallocate(file_t* file, uint32 offset, uint32 len);
+int     file_fsync(file_t* file, bool wait);
+uint32  file_readv(file_t* file, iovec_t* iov, uint32 cnt, uint32* offset);
+uint32  file_writev(file_t* file, iovec_t* iov, uint32 cnt, uint32* offset);
+int     file_splice(file_t* in, file_t* out, uint32 len);
+int     file_tee(file_t* in, file_t* out, uint32 len);
+int     file_sendfile(file_t* out, file_t* in, uint32 len);
 
 #endif
\ No newline at end of file
@@ -18,8 +18,17 @@ typedef struct super_block
     unsigned int data_blocks;
     unsigned int total_blocks;
 
+    unsigned int log_start;     // 日志区 (日志头 + 日志block)
+    unsigned int log_blocks;
+
+    unsigned int features;      // FS_FEAT_xxx
+
 } super_block_t;
 
+// features 选项
+#define FS_FEAT_EXTENT 0x1 // 新建的文件和目录使用extent格式
+#define FS_FEAT_INLINE 0x2 // 新建的普通文件先以内联方式存放
+
 void fs_init();
 
 #endif
\ No newline at end of file
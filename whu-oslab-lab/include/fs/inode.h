@@ -2,23 +2,27 @@
 #define __INODE_H__
 
 #include "lib/lock.h"
+#include "fs/pcache.h"
 
 #define INODE_ROOT       0                              // 根节点的inode_num
 #define INODE_DISK_SIZE  64                             // 磁盘里inode的大小
 #define INODE_PER_BLOCK  (BLOCK_SIZE / INODE_DISK_SIZE) // 每个block里的inode数量
 
 // addrs相关字段
-#define N_ADDRS_1   10  // 管理 10 * BLOCK_SIZE = 10KB
-#define N_ADDRS_2   2   // 管理 2 * (BLOCK_SIZE / 4) * BLOCK_SIZE = 512KB
-#define N_ADDRS_3   1   // 管理 (BLOCK_SIZE / 4) * (BLOCK_SIZE / 4) * BLOCK_SIZE = 64MB
+#define N_ADDRS_1   10  // 管理 10 * BLOCK_SIZE = 40KB (1KB block时为10KB)
+#define N_ADDRS_2   2   // 管理 2 * (BLOCK_SIZE / 4) * BLOCK_SIZE = 8MB (1KB block时为512KB)
+#define N_ADDRS_3   1   // 管理 (BLOCK_SIZE / 4) * (BLOCK_SIZE / 4) * BLOCK_SIZE = 4GB (1KB block时为64MB)
 #define N_ADDRS     (N_ADDRS_1 + N_ADDRS_2 + N_ADDRS_3)
 
 // 每个block里面有多少个存储下一级block_num的entry
 #define ENTRY_PER_BLOCK (BLOCK_SIZE / sizeof(uint32))
 
-// addrs字段可以容纳的最大空间（单个inode可以管理的最大空间）
+// addrs字段可以容纳的最大空间
+#define INODE_ADDRS_MAXSIZE ((N_ADDRS_1 + N_ADDRS_2 * ENTRY_PER_BLOCK + N_ADDRS_3 * ENTRY_PER_BLOCK * ENTRY_PER_BLOCK) * BLOCK_SIZE)
+
+// 单个inode可以管理的最大空间: 同时受addrs和页缓存基数树限制 (4KB block时addrs可达4GB)
 // 由于磁盘大小限制, 事实上达不到这个大小
-#define INODE_MAXSIZE ((N_ADDRS_1 + N_ADDRS_2 * ENTRY_PER_BLOCK + N_ADDRS_3 * ENTRY_PER_BLOCK * ENTRY_PER_BLOCK) * BLOCK_SIZE)
+#define INODE_MAXSIZE (INODE_ADDRS_MAXSIZE < PCACHE_MAXSIZE ? INODE_ADDRS_MAXSIZE : PCACHE_MAXSIZE)
 
 // type 选项
 #define FT_UNUSED 0
@@ -26,12 +30,25 @@
 #define FT_FILE   2
 #define FT_DEVICE 3
 
+// flags 选项
+#define INODE_F_EXTENT 0x1 // addrs里存放的是extent (见extent.h)
+#define INODE_F_INLINE 0x2 // addrs里直接存放文件内容 (普通文件, 不超过INODE_INLINE_MAX字节)
+
+// 内联文件的最大字节数 (整个addrs区域)
+#define INODE_INLINE_MAX (N_ADDRS * sizeof(uint32))
+
+// icache
+#define N_ICACHE_HASH    64                           // hash桶数
+#define N_ICACHE_PAGE    16                           // icache最多占用的物理页数
+#define ICACHE_PER_PAGE  (PGSIZE / sizeof(inode_t))   // 每页切分出的inode数
+
 // inode_num 无效的inode号
 #define INODE_NUM_UNUSED 0xFFFF
 
 typedef struct inode {
     // 磁盘里的inode信息 (由slk保护)
-    uint16 type;                // inode 管理的文件类型
+    uint8  type;                // inode 管理的文件类型
+    uint8  flags;               // INODE_F_xxx
     uint16 major;               // 设备文件使用: 主设备号
     uint16 minor;               // 设备文件使用: 次设备号
     uint16 nlink;               // 链接数量 (nlink个文件名链接到这个inode)
@@ -40,12 +57,33 @@ typedef struct inode {
 
     // 内存里的inode信息
     uint16 inode_num;           // inode序号
-    uint32 ref;                 // 引用数 (由lk_icache保护)
+    uint32 ref;                 // 引用数 (由hash桶锁保护)
     bool valid;                 // 上述磁盘里inode字段的有效性 (由slk保护)
+    bool dirty;                 // 内存里的size比磁盘新, snap是待写回的内容 (由hash桶锁保护)
+    uint8 snap[INODE_DISK_SIZE];
     sleeplock_t slk;            // 睡眠锁
+    pcache_node_t* pages;       // 页缓存基数树的根 (由lk_pcache保护)
+    uint32 pa_start;            // 预分配窗口 [pa_start, pa_start + pa_len) (由slk保护)
+    uint32 pa_len;
+    uint32 pa_want;             // 还需要分配的数据block数
+    uint32 rsv;                 // 本次分配还可以使用的预留block数 (数据 + 元数据, 由slk保护)
+    struct inode* hnext;        // hash桶链表 / free_list
+    struct inode* next;         // LRU链表 (ref == 0 且有效的inode)
+    struct inode* prev;
 
 } inode_t;
 
+// 顺序读检测 + 预读窗口 (每个打开的文件一份, 存放在file_t里)
+// 普通文件以页为单位, 目录以block为单位
+#define RA_MIN_WINDOW 4   // 确认顺序读后的初始窗口
+#define RA_MAX_WINDOW 16  // 窗口上限, 不超过N_BUF_PREFETCH
+
+typedef struct readahead {
+    uint32 next_bn;   // 顺序读时下一次读取应当从哪个block开始
+    uint32 ahead_bn;  // 已经预读到哪个block (不含)
+    uint32 window;    // 当前预读窗口大小, 0表示随机访问
+} readahead_t;
+
 // inode 元数据
 
 void     inode_init();                        // 初始化
@@ -53,6 +91,9 @@ void     inode_rw(inode_t* ip, bool write);   // 读写inode元数据
 inode_t* inode_alloc(uint16 inode_num);       // 在内存申请或查询inode(ref++)
 inode_t* inode_create(uint16 type, uint16 major, uint16 minor); // 在磁盘里创建新的inode并在内存申请对应副本
 void     inode_free(inode_t* ip);             // 释放inode(ref--) 适时销毁
+void     inode_mark_dirty(inode_t* ip);       // 标记为脏, 延迟写回
+void     inode_sync(inode_t* ip);             // 脏inode写回
+inode_t* inode_get_cached(uint16 inode_num);  // 只在icache里查询inode(ref++), 不在返回NULL
 inode_t* inode_dup(inode_t* ip);              // ref++
 void     inode_lock(inode_t* ip);             // 上锁 (valid = false 则从磁盘读入inode)
 void     inode_unlock(inode_t* ip);           // 解锁
@@ -60,12 +101,23 @@ void     inode_unlock_free(inode_t* ip);      // 解锁 + 释放
 
 // inode 管理的数据
 
+bool     inode_reserve(inode_t* ip, uint32 n);
+void     inode_prealloc(inode_t* ip, uint32 n);
+void     inode_prealloc_end(inode_t* ip);
+uint32   inode_alloc_block(inode_t* ip, uint32 goal);
+uint32   inode_alloc_data(inode_t* ip, uint32 goal);
+uint32   inode_locate_block(inode_t* ip, uint32 bn);
+uint32   inode_map_run(inode_t* ip, uint32 bn, uint32* len);
 uint32   inode_read_data(inode_t* ip, uint32 offset, uint32 len, void* dst, bool user);
+void     inode_readahead(inode_t* ip, readahead_t* ra, uint32 offset, uint32 len);
 uint32   inode_write_data(inode_t* ip, uint32 offset, uint32 len, void* src, bool user);
 void     inode_free_data(inode_t* ip);
+int      inode_fallocate(inode_t* ip, uint32 offset, uint32 len);
+int      inode_inline_expand(inode_t* ip);
 
 // for debug
 
 void     inode_print(inode_t* ip);
+void     inode_stat_print();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include "common.h"
+
+/*
+    元数据日志 (write-ahead log, 重做日志)
+    磁盘上的日志区: [ 日志头 | block 1 | block 2 | ... | block LOG_SIZE ]
+    日志头记录本次提交包含的block数量和每个block的原位置
+
+    每个修改元数据的文件系统操作都夹在 log_begin_op / log_end_op 之间
+    操作内用 log_write 代替 buf_write, 修改只留在buf_cache里
+    最后一个进行中的操作结束时, 把这段时间内所有操作的修改一起提交 (group commit)
+    普通文件的数据经过页缓存直接写盘, 不进入日志
+*/
+
+#define LOG_OP_BLOCKS  12  // 单个文件系统操作最多修改的block数 (创建目录且父目录索引分裂时最多)
+#define LOG_MAX_OPS    8   // 一次提交最多容纳的并发操作数 (按最坏情况预留)
+#define LOG_SIZE       (LOG_MAX_OPS * LOG_OP_BLOCKS) // 一次提交最多包含的block数 (提交前它们一直占用buf_cache)
+#define LOG_BLOCKS     (LOG_SIZE + 1) // 日志区大小 (加上日志头)
+
+// 单次file_write写入的最大字节数, 保证一次操作修改的block不超过LOG_OP_BLOCKS
+// (inode + bitmap + 跨越边界时的间接block)
+#define LOG_WRITE_MAX  (((LOG_OP_BLOCKS - 1 - 1 - 2) / 2) * BLOCK_SIZE)
+
+// 单次fallocate预分配的最大字节数, 与刷盘时一次分配的延迟block数(DALLOC_MAX_PAGES)相同
+// (inode + bitmap + 最多跨越一次边界的间接block)
+#define LOG_FALLOC_MAX (32 * PGSIZE)
+
+typedef struct buf buf_t;
+
+void log_init(uint32 start, uint32 size);
+void log_begin_op();
+void log_end_op();
+void log_write(buf_t* buf);
+void log_revoke(uint32 block_num);
+void log_sync();
+void log_print();
+
+#endif
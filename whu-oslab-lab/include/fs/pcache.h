@@ -0,0 +1,79 @@
+#ifndef __PCACHE_H__
+#define __PCACHE_H__
+
+#include "common.h"
+
+/*
+    页缓存: 普通文件的数据以4KB页为单位缓存在内存里
+    每个inode挂一棵按文件页号(offset / PGSIZE)索引的基数树
+    buf_cache只负责元数据(超级块 bitmap inode 间接块 目录)
+
+    延迟分配: 写入新block时只预留空间(连同最坏情况下的元数据), blocks[i]记为BLOCK_DELAYED
+    刷盘时(pcache_flush / 写者被限流)按页号顺序一次性分配, 文件在磁盘上连续
+    含有延迟block的页不会被淘汰, 它们的总数不超过DALLOC_MAX_PAGES
+
+    page_writeback_one写回别的inode的页时不持有它的slk, 只靠引用防止页被淘汰:
+    写回期间blocks[]和页内数据不能改变, inode_write_data修改前先等待写回结束
+    (之后写者持有引用, 不会再开始新的写回); 只有MAP_SHARED映射的用户写入无法等待,
+    这样写入的页在msync/munmap时还会再写回一次
+
+    截断/删除文件时, 仍被引用的页(管道里splice的页, 用户映射的页)只从inode上摘下,
+    由最后一个pcache_put归还, 丢弃页缓存不需要等待这些引用
+*/
+
+#define N_PCACHE_PAGE   256  // 页缓存最多占用的物理页数 (来自内核区域)
+#define N_PCACHE_NODE   (N_PCACHE_PAGE * PCACHE_HEIGHT) // 基数树节点数 (每页最多独占一条路径, 不会耗尽)
+#define PCACHE_BATCH    4    // 单次批量I/O最多的页数
+#define PCACHE_MAP_MAX  (N_PCACHE_PAGE / 2) // 被引用的页达到这个数后, 缺页不再直接映射页缓存的页
+
+#define PCACHE_SHIFT    5
+#define PCACHE_SLOTS    (1 << PCACHE_SHIFT) // 每个基数树节点的槽数
+#define PCACHE_HEIGHT   3                   // 32^3页 = 128MB
+#define PCACHE_MAXSIZE  ((uint64)PGSIZE << (PCACHE_SHIFT * PCACHE_HEIGHT)) // 基数树能覆盖的文件大小
+
+#define BLOCK_PER_PAGE  (PGSIZE / BLOCK_SIZE)
+
+#define BLOCK_DELAYED    0xFFFFFFFF            // 已预留空间, 还没有分配磁盘位置
+#define DALLOC_MAX_PAGES 32  // 含有延迟block的页数上限 (一次分配新增的元数据要装进一个日志操作)
+#define DALLOC_META_PER_BLOCK 2 // 每个数据block最坏情况下新增的元数据block (两级间接block / extent叶子分裂 + 长高)
+#define DALLOC_RESERVE(n) ((n) * (1 + DALLOC_META_PER_BLOCK)) // n个数据block需要预留的block数
+
+typedef struct inode inode_t;
+
+typedef struct page {
+    /* 以下字段由lk_pcache保护 */
+    inode_t* ip;            // 所属inode (NULL表示空闲, 或者已被丢弃但仍被引用)
+    uint32 index;           // 文件内的页号
+    uint32 ref;             // 引用数
+    bool dirty;             // 需要写回磁盘
+    bool delayed;           // 有BLOCK_DELAYED的block (修改时同时持有ip->slk)
+    bool writeback;         // 正在被page_writeback_one写回 (不持有ip->slk, 写者需先等待结束)
+    struct page* next;      // LRU链表 (ref == 0 的页)
+    struct page* prev;
+
+    /* 以下字段由ip->slk保护 */
+    uint64 pa;              // 物理页 (内核直接映射)
+    uint32 blocks[BLOCK_PER_PAGE]; // 每个block对应的磁盘block_num, 0表示没有
+} page_t;
+
+// 基数树节点: 中间层指向下一层节点, 最后一层指向page_t
+typedef struct pcache_node {
+    void* slots[PCACHE_SLOTS];
+} pcache_node_t;
+
+void    pcache_init();
+page_t* pcache_get(inode_t* ip, uint32 index, bool fill);
+void    pcache_put(page_t* pg, bool dirty);
+page_t* pcache_find(uint64 pa);
+void    pcache_dup(page_t* pg);
+void    pcache_prefetch(inode_t* ip, uint32 index, uint32 n);
+void    pcache_set_delayed(page_t* pg);
+void    pcache_wait_writeback(page_t* pg);
+uint32  pcache_delayed_pages();
+uint32  pcache_referenced();
+void    pcache_alloc_delayed(inode_t* ip);
+void    pcache_flush(inode_t* ip);
+void    pcache_drop(inode_t* ip);
+void    pcache_print();
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __PIPE_H__
+#define __PIPE_H__
+
+#include "common.h"
+#include "lib/lock.h"
+
+/*
+    管道: PIPE_PAGES个缓冲槽组成的环, 每个槽指向某一页里的一段数据
+    普通写入把数据拷贝进管道自己的页 (第i个槽使用pages[i]), 追加到最后一个槽直到写满一页
+    splice从文件读入时直接把页缓存的页放进槽里 (持有页的引用), 不拷贝数据
+
+    环里是累计序号[tail, head)的槽, 读者消费tail处的槽, 写者在head处放入新槽
+    读者只访问槽里的有效数据, 写者只访问有效数据之后的空闲部分
+    所以拷贝数据时不持有自旋锁 (拷贝用户数据可能缺页睡眠), 只在检查和更新槽时加锁
+    同一端的多个读者(写者)由睡眠锁串行化
+    只有 管道空->非空 / 环满->不满 时才唤醒对方
+*/
+
+#define N_PIPE      16                      // 管道总数
+#define PIPE_PAGES  4                       // 每个管道的缓冲槽数 (也是管道自己的页数)
+#define PIPE_SIZE   (PIPE_PAGES * PGSIZE)   // 普通写入最多缓冲的字节数
+
+typedef struct file file_t;
+typedef struct page page_t;
+
+typedef struct pipe_buf {
+    uint64 pa;       // 数据所在的物理页
+    uint32 off;      // 有效数据在页内的起点
+    uint32 len;      // 有效数据的长度
+    page_t* pg;      // 页缓存的页 (持有引用), NULL表示管道自己的页
+} pipe_buf_t;
+
+typedef struct pipe {
+    spinlock_t lk;                  // 保护下面的槽和状态
+    bool used;                      // 是否被使用 (由lk_pipes保护)
+    bool readopen;                  // 读端未关闭
+    bool writeopen;                 // 写端未关闭
+    uint32 head;                    // 累计放入的槽数
+    uint32 tail;                    // 累计释放的槽数
+    uint32 size;                    // 管道里的字节数
+    pipe_buf_t bufs[PIPE_PAGES];    // 缓冲槽 (序号i对应bufs[i % PIPE_PAGES])
+    uint64 pages[PIPE_PAGES];       // 管道自己的页
+    sleeplock_t rslk;               // 串行化读者
+    sleeplock_t wslk;               // 串行化写者
+} pipe_t;
+
+// 消费管道数据的回调: 处理内核地址kaddr处的n字节, 返回处理掉的字节数
+typedef uint32 (*pipe_actor_t)(void* ctx, uint64 kaddr, uint32 n);
+
+void   pipe_init();
+int    pipe_alloc(file_t** rf, file_t** wf);
+void   pipe_close(pipe_t* pi, bool writable);
+uint32 pipe_read(pipe_t* pi, uint32 len, uint64 dst, bool user);
+uint32 pipe_write(pipe_t* pi, uint32 len, uint64 src, bool user);
+uint32 pipe_drain(pipe_t* pi, uint32 len, pipe_actor_t actor, void* ctx);
+uint32 pipe_splice_in(pipe_t* pi, file_t* in, uint32 len);
+uint32 pipe_tee(pipe_t* in, pipe_t* out, uint32 len);
+
+#endif
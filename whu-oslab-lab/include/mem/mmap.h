@@ -9,9 +9,35 @@ typedef struct mmap_region {
     struct mmap_region* next; // 链表指针
 } mmap_region_t;
 
+// mmap的prot参数 (与用户态保持一致)
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+// mmap的flags参数 (与用户态保持一致)
+#define MAP_SHARED  0x1  // 直接映射页缓存, 修改会写回文件
+#define MAP_PRIVATE 0x2  // 缺页时拷贝一份私有副本, 修改不写回文件
+
+typedef struct file file_t;
+
+// 文件映射区域
+// 建立映射时不分配物理页, 第一次访问触发缺页时才从页缓存取数据
+typedef struct mmap_file {
+    uint64 begin;             // 起始地址
+    uint32 npages;            // 管理的页面数量
+    uint32 offset;            // begin对应的文件偏移 (页对齐)
+    uint32 filelen;           // 从begin开始来自文件的字节数, 之后是清零的页 (只有MAP_PRIVATE可以小于映射长度, 如ELF的bss)
+    int perm;                 // 页面权限 PTE_R PTE_W PTE_X
+    int flags;                // MAP_SHARED 或 MAP_PRIVATE
+    file_t* file;             // 映射的文件 (持有一个引用)
+    struct mmap_file* next;   // 链表指针
+} mmap_file_t;
+
 void           mmap_init();
 mmap_region_t* mmap_region_alloc();
 void           mmap_region_free(mmap_region_t* mmap);
+mmap_file_t*   mmap_file_alloc();
+void           mmap_file_free(mmap_file_t* mf);
 void           mmap_show_mmaplist();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "common.h"
+#include "lib/lock.h"
+
+/*
+    固定大小对象的分配器
+    每个slab是一个内核物理页: 开头是slab_t, 后面切成等大的对象
+    对象所在的slab由地址按页对齐得到, 释放时不需要查找
+    cache只记录还有空闲对象的slab, 全部空闲的slab除了保留一个之外都还给pmem
+*/
+
+typedef struct slab {
+    struct slab* next;       // cache->partial 链表
+    struct slab* prev;
+    void* free;              // 空闲对象链表 (对象的前8字节存next)
+    uint32 inuse;            // 已分配的对象数
+} slab_t;
+
+typedef struct slab_cache {
+    spinlock_t lk;           // 保护partial链表和其中slab的空闲链表
+    char* name;
+    uint32 objsize;          // 对象大小 (8字节对齐)
+    uint32 perslab;          // 每个slab的对象数
+    slab_t* partial;         // 还有空闲对象的slab
+    uint32 nslab;            // 当前持有的slab数
+} slab_cache_t;
+
+void  slab_cache_init(slab_cache_t* cache, char* name, uint32 objsize);
+void* slab_alloc(slab_cache_t* cache);
+void  slab_free(slab_cache_t* cache, void* obj);
+
+#endif
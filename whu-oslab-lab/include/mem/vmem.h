@@ -59,6 +59,7 @@ typedef uint64* pgtbl_t;
 #define PTE_G (1L << 5) // global - 全局映射
 #define PTE_A (1L << 6) // accessed - 已访问
 #define PTE_D (1L << 7) // dirty - 已修改
+#define PTE_SHARED (1L << 8) // RSW - 页缓存里的页 (MAP_SHARED), 不属于进程, 不能释放
 
 // 检查一个PTE是否是页表（而非叶子页）：R/W/X全为0表示这是指向下级页表的指针
 #define PTE_CHECK(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) == 0)
@@ -85,13 +86,20 @@ void   kvm_inithart();
 
 
 /*------------------------ in uvm.c -----------------------*/
+typedef struct proc proc_t;
+
 void   uvm_show_mmaplist(mmap_region_t* mmap);
 
 void   uvm_destroy_pgtbl(pgtbl_t pgtbl);
-void   uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pages, mmap_region_t* mmap);
+void   uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pages, mmap_region_t* mmap, mmap_file_t* mfile);
 
 void   uvm_mmap(uint64 begin, uint32 npages, int perm);
+void   uvm_mmap_file(proc_t* p, uint64 begin, uint32 npages, int perm, int flags, file_t* file, uint32 offset, uint32 filelen);
 void   uvm_munmap(uint64 begin, uint32 npages);
+void   uvm_munmap_files(proc_t* p);
+void   uvm_msync(uint64 begin, uint32 npages);
+int    uvm_fault(uint64 va, bool write);
+void   uvm_walk_reset(proc_t* p);
 
 uint64 uvm_heap_grow(pgtbl_t pgtbl, uint64 heap_top, uint32 len);
 uint64 uvm_heap_ungrow(pgtbl_t pgtbl, uint64 heap_top, uint32 len);
@@ -0,0 +1,51 @@
+#ifndef __ELF_H__
+#define __ELF_H__
+
+#include "common.h"
+
+// ELF64可执行文件格式 (只用到exec需要的部分)
+
+#define ELF_MAGIC          0x464C457FU  // "\x7FELF" (小端)
+#define ELF_CLASS_64       2            // ident[4]
+#define ELF_MACHINE_RISCV  243
+
+// 文件头
+typedef struct elf_header {
+    uint32 magic;
+    uint8  ident[12];
+    uint16 type;
+    uint16 machine;
+    uint32 version;
+    uint64 entry;       // 入口地址
+    uint64 phoff;       // 程序头表的文件偏移
+    uint64 shoff;
+    uint32 flags;
+    uint16 ehsize;
+    uint16 phentsize;   // 程序头大小
+    uint16 phnum;       // 程序头个数
+    uint16 shentsize;
+    uint16 shnum;
+    uint16 shstrndx;
+} elf_header_t;
+
+// 程序头
+typedef struct prog_header {
+    uint32 type;
+    uint32 flags;
+    uint64 off;         // 段在文件里的偏移
+    uint64 vaddr;       // 段的虚拟地址
+    uint64 paddr;
+    uint64 filesz;      // 段在文件里的大小
+    uint64 memsz;       // 段在内存里的大小 (多出的部分清零, 即bss)
+    uint64 align;
+} prog_header_t;
+
+// prog_header.type
+#define ELF_PROG_LOAD       1
+
+// prog_header.flags
+#define ELF_PROG_FLAG_EXEC  1
+#define ELF_PROG_FLAG_WRITE 2
+#define ELF_PROG_FLAG_READ  4
+
+#endif
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "mem/mmap.h"
 #include "lib/lock.h"
+#include "fs/fdtable.h"
 
 // 最大进程数
 #define NPROC 64
@@ -13,6 +14,7 @@ typedef uint64* pgtbl_t;
 
 // mmap_region定义
 typedef struct mmap_region mmap_region_t;
+typedef struct mmap_file mmap_file_t;
 
 // context 定义，需要切换进程的时候把当前寄存器保存到一个进程的ctx,然后从另一个进程的ctx恢复寄存器
 typedef struct context {
@@ -79,6 +81,7 @@ typedef struct trapframe {
     进程状态集合
     可能的进程状态变换：
     UNSED -> RUNNABLE 进程初始化
+    UNUSED -> USED -> RUNNABLE spawn创建的进程在载入ELF期间
     RUNNABLE -> RUNNIGN 进程获得CPU使用权
     RUNNING -> RUNNABLE 进程失去CPU使用权
     RUNNING -> SLEEPING 进程睡眠
@@ -89,14 +92,25 @@ typedef struct trapframe {
 */
 enum proc_state {
     UNUSED,       // 未被使用
+    USED,         // 已分配, 尚未就绪
     RUNNABLE,     // 准备就绪
     RUNNING,      // 运行中
     SLEEPING,     // 睡眠等待
     ZOMBIE,       // 濒临死亡
 };
 
-// 每个进程的最大打开文件数
-#define FILE_PER_PROC 16
+// exec的最大参数个数
+#define EXEC_MAXARG 16
+
+// 用户地址翻译缓存的项数 (按页号直接映射)
+#define N_WALK_CACHE 4
+
+// 一项用户地址翻译: 用户页va -> 物理页pa
+typedef struct walk_cache {
+    uint64 va;              // 用户页 (0表示无效, 第0页永远不可访问)
+    uint64 pa;              // 物理页
+    bool writable;          // 内核可以直接写入 (共享映射的页已取得写权限)
+} walk_cache_t;
 
 // 前向声明
 typedef struct file file_t;
@@ -116,17 +130,20 @@ typedef struct proc {
     void* sleep_space;       // 睡眠是为在等待什么
 
     pgtbl_t pgtbl;           // 用户态页表，进程独有的内存空间
+    uint64 heap_base;        // 用户堆底 (代码和数据段之后, 堆不能收缩到它下面)
     uint64 heap_top;         // 用户堆顶(以字节为单位)
     uint64 ustack_pages;     // 用户栈占用的页面数量
     mmap_region_t* mmap;     // 用户可映射区域的起始节点
+    mmap_file_t* mmap_file;  // 文件映射链表
     trapframe_t* tf;         // 用户态内核态切换时的运行环境暂存空间，记录用户程序运行到哪里了
+    walk_cache_t walk[N_WALK_CACHE]; // uvm_walk的翻译缓存 (每次系统调用开始和映射被撤销时清空)
 
     uint64 kstack;           // 内核栈的虚拟地址，记录内核态代码运行到哪里了
     context_t ctx;           // 内核态进程上下文，内核处理这个进程时用的栈
 
     // 文件系统相关
-    file_t* filelist[FILE_PER_PROC];  // 文件描述符表
-    inode_t* cwd;                      // 当前工作目录
+    fdtable_t fdt;           // 文件描述符表
+    inode_t* cwd;            // 当前工作目录
 } proc_t;
 
 
@@ -143,5 +160,7 @@ void     proc_sleep(void* sleep_space, spinlock_t* lk);// 进程睡眠
 void     proc_wakeup(void* sleep_space);               // 进程唤醒
 void     proc_sched();                                 // 进程切换到调度器
 void     proc_scheduler();  
+int      proc_exec(char* path, char** argv);           // 执行ELF文件 (in exec.c)
+int      proc_spawn(char* path, char** argv, int* fds, file_t** files, int n); // 从ELF文件创建子进程 (in exec.c)
 
 #endif
\ No newline at end of file
@@ -14,6 +14,7 @@ static inline uint64 r_mhartid()
 #define MSTATUS_MPP_S (1L << 11)
 #define MSTATUS_MPP_U (0L << 11)
 #define MSTATUS_MIE (1L << 3)    // machine-mode interrupt enable.
+#define MSTATUS_VS_INITIAL (1L << 9) // vector extension state: initial.
 
 static inline uint64 r_mstatus()
 {
@@ -0,0 +1,51 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "common.h"
+
+/*
+    批量系统调用环 (与用户态的定义保持一致)
+    ring_t放在用户内存里 (一页以内), 用户填好提交项后调用一次sys_ring_enter
+    内核依次执行[sq_head, sq_tail)里的提交项, 结果写进完成队列[cq_head, cq_tail)
+    用户只修改sq_tail和cq_head, 内核只修改sq_head和cq_tail
+    序号自然增长, 第i项在数组里的下标是 i % RING_ENTRIES
+*/
+
+#define RING_ENTRIES   64          // 提交/完成队列的长度 (2的幂)
+#define RING_NO_OFFSET 0xFFFFFFFF  // 读写使用文件偏移 (否则是pread/pwrite的偏移)
+
+// 操作码
+#define RING_OP_NOP    0
+#define RING_OP_READ   1  // fd addr len offset
+#define RING_OP_WRITE  2  // fd addr len offset
+#define RING_OP_OPEN   3  // addr = path, len = open_mode, 结果是fd
+#define RING_OP_CLOSE  4  // fd
+#define RING_OP_FSYNC  5  // fd
+
+// 提交项
+typedef struct ring_sqe {
+    uint32 op;          // 操作码
+    int    fd;          // 文件描述符
+    uint64 addr;        // 用户缓冲区或路径
+    uint32 len;         // 长度或打开方式
+    uint32 offset;      // 读写偏移
+    uint64 user_data;   // 原样放进完成项
+} ring_sqe_t;
+
+// 完成项
+typedef struct ring_cqe {
+    uint64 user_data;   // 来自提交项
+    int    res;         // 结果 (对应系统调用的返回值, 失败是-1)
+    uint32 pad;
+} ring_cqe_t;
+
+typedef struct ring {
+    uint32 sq_head;     // 内核下一个要执行的提交项
+    uint32 sq_tail;     // 用户下一个要填写的提交项
+    uint32 cq_head;     // 用户下一个要读取的完成项
+    uint32 cq_tail;     // 内核下一个要写入的完成项
+    ring_sqe_t sqes[RING_ENTRIES];
+    ring_cqe_t cqes[RING_ENTRIES];
+} ring_t;
+
+#endif
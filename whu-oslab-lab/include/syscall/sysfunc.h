@@ -6,9 +6,11 @@
 // 文件系统无关的系统调用
 
 uint64 sys_exec();
+uint64 sys_spawn();
 uint64 sys_brk();
 uint64 sys_mmap();
 uint64 sys_munmap();
+uint64 sys_msync();
 uint64 sys_fork();
 uint64 sys_wait();
 uint64 sys_exit();
@@ -28,5 +30,16 @@ uint64 sys_mkdir();
 uint64 sys_chdir();
 uint64 sys_link();
 uint64 sys_unlink();
+uint64 sys_fallocate();
+uint64 sys_fsync();
+uint64 sys_pipe();
+uint64 sys_splice();
+uint64 sys_tee();
+uint64 sys_sendfile();
+uint64 sys_readv();
+uint64 sys_writev();
+uint64 sys_pread();
+uint64 sys_pwrite();
+uint64 sys_ring_enter();
 
 #endif
\ No newline at end of file
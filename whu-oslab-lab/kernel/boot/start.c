@@ -17,6 +17,11 @@ void start(void)
     unsigned long x = r_mstatus();
     x &= ~MSTATUS_MPP_MASK;
     x |= MSTATUS_MPP_S;
+#ifdef STR_RVV
+    // 打开V扩展 (VS != Off), 否则向量指令会触发非法指令异常
+    // 内核只在关中断时用向量寄存器 (见lib/str.c), 不需要保存它们
+    x |= MSTATUS_VS_INITIAL;
+#endif
     w_mstatus(x);
     
     // 2. 设置 mepc = main
@@ -4,10 +4,13 @@
     这个文件最终提供三个重要函数:
     virtio_init() // 初始化函数
     virtio_rw()   // 以block为单位的磁盘读写函数
+    virtio_rw_batch() // 批量提交多个block请求后统一等待
+    virtio_rw_reqs()  // 不经过buf的批量请求(页缓存使用)
     virtio_intr() // 磁盘激活的中断处理函数
 */
 
 #include "dev/virtio.h"
+#include "dev/vio.h"
 #include "fs/buf.h"
 #include "lib/lock.h"
 #include "lib/print.h"
@@ -40,10 +43,14 @@ static struct disk
     // indexed by first descriptor index of chain.
     struct
     {
-        buf_t* b;
+        volatile bool *done; // 请求完成时置为false (buf->disk 或 req->disk)
         char status;
     } info[NUM];
 
+    // disk command headers.
+    // one-for-one with descriptors, for convenience.
+    struct virtio_blk_outhdr ops[NUM];
+
     struct spinlock vdisk_lock;
 
 } __attribute__((aligned(PGSIZE))) disk;
@@ -172,13 +179,13 @@ alloc3_desc(int *idx)
     return 0;
 }
 
-extern pgtbl_t kernel_pagetable;
-
-void virtio_disk_rw(buf_t *b, bool write)
+// 填写并提交一个请求 (不等待完成)
+// [block_num, block_num + len / BLOCK_SIZE) <-> [data, data + len)
+// 描述符不足时自旋等待中断回收
+// 调用者需持有vdisk_lock
+static void virtio_disk_submit(uint32 block_num, void *data, uint32 len, volatile bool *done, bool write)
 {
-    uint64 sector = b->block_num * (BLOCK_SIZE / 512);
-
-    spinlock_acquire(&disk.vdisk_lock);
+    uint64 sector = (uint64)block_num * (BLOCK_SIZE / 512);
 
     // the spec says that legacy block operations use three
     // descriptors: one for type/reserved/sector, one for
@@ -199,38 +206,27 @@ void virtio_disk_rw(buf_t *b, bool write)
 
     // format the three descriptors.
     // qemu's virtio-blk.c reads them.
-
-    struct virtio_blk_outhdr
-    {
-        uint32 type;
-        uint32 reserved;
-        uint64 sector;
-    } buf0;
+    // 请求头放在全局的disk.ops里(内核数据直接映射), 批量提交时互不覆盖
+    struct virtio_blk_outhdr *buf0 = &disk.ops[idx[0]];
 
     if (write)
-        buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+        buf0->type = VIRTIO_BLK_T_OUT; // write the disk
     else
-        buf0.type = VIRTIO_BLK_T_IN; // read the disk
-    buf0.reserved = 0;
-    buf0.sector = sector;
-
-    // buf0 is on a kernel stack, which is not direct mapped,
-    // thus the call to kvmpa().
-    uint64 addr = ALIGN_DOWN((uint64)&buf0, PGSIZE);
-    uint64 off  = ((uint64)&buf0) % PGSIZE;
-
-    pte_t* pte = vm_getpte(kernel_pagetable, addr, false);
-    disk.desc[idx[0]].addr = (uint64)PTE_TO_PA(*pte) + off;
-    disk.desc[idx[0]].len = sizeof(buf0);
+        buf0->type = VIRTIO_BLK_T_IN; // read the disk
+    buf0->reserved = 0;
+    buf0->sector = sector;
+
+    disk.desc[idx[0]].addr = (uint64)buf0;
+    disk.desc[idx[0]].len = sizeof(struct virtio_blk_outhdr);
     disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
     disk.desc[idx[0]].next = idx[1];
 
-    disk.desc[idx[1]].addr = (uint64)b->data;
-    disk.desc[idx[1]].len = BLOCK_SIZE;
+    disk.desc[idx[1]].addr = (uint64)data;
+    disk.desc[idx[1]].len = len;
     if (write)
-        disk.desc[idx[1]].flags = 0; // device reads b->data
+        disk.desc[idx[1]].flags = 0; // device reads data
     else
-        disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+        disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes data
     disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
     disk.desc[idx[1]].next = idx[2];
 
@@ -241,8 +237,8 @@ void virtio_disk_rw(buf_t *b, bool write)
     disk.desc[idx[2]].next = 0;
 
     // record   for virtio_disk_intr().
-    b->disk = true;
-    disk.info[idx[0]].b = b;
+    *done = true;
+    disk.info[idx[0]].done = done;
 
     // avail[0] is flags
     // avail[1] tells the device how far to look in avail[2...].
@@ -253,18 +249,50 @@ void virtio_disk_rw(buf_t *b, bool write)
     disk.avail[1] = disk.avail[1] + 1;
 
     *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
+// 等待一个已提交的请求完成
+// 调用者需持有vdisk_lock
+static void virtio_disk_wait(volatile bool *done)
+{
     // Wait for virtio_disk_intr() to say request has finished.
-    while (b->disk == true)
+    while (*done == true)
     {
         // 无进程时自旋等待
         spinlock_release(&disk.vdisk_lock);
         spinlock_acquire(&disk.vdisk_lock);
     }
+}
+
+void virtio_disk_rw(buf_t *b, bool write)
+{
+    spinlock_acquire(&disk.vdisk_lock);
+    virtio_disk_submit(b->block_num, b->data, BLOCK_SIZE, &b->disk, write);
+    virtio_disk_wait(&b->disk);
+    spinlock_release(&disk.vdisk_lock);
+}
 
-    disk.info[idx[0]].b = 0;
-    free_chain(idx[0]);
+// 批量读写: 先把n个请求全部交给设备, 再统一等待
+// 设备可以流水处理这些请求, 总耗时接近带宽而不是 n * 单次延迟
+void virtio_disk_rw_batch(buf_t **bufs, uint32 n, bool write)
+{
+    spinlock_acquire(&disk.vdisk_lock);
+    for (uint32 i = 0; i < n; i++)
+        virtio_disk_submit(bufs[i]->block_num, bufs[i]->data, BLOCK_SIZE, &bufs[i]->disk, write);
+    for (uint32 i = 0; i < n; i++)
+        virtio_disk_wait(&bufs[i]->disk);
+    spinlock_release(&disk.vdisk_lock);
+}
 
+// 不经过buf_cache的批量读写 (页缓存使用)
+// 每个请求可以覆盖多个磁盘上连续的block
+void virtio_disk_rw_reqs(vio_req_t *reqs, uint32 n, bool write)
+{
+    spinlock_acquire(&disk.vdisk_lock);
+    for (uint32 i = 0; i < n; i++)
+        virtio_disk_submit(reqs[i].block_num, reqs[i].data, reqs[i].len, &reqs[i].disk, write);
+    for (uint32 i = 0; i < n; i++)
+        virtio_disk_wait(&reqs[i].disk);
     spinlock_release(&disk.vdisk_lock);
 }
 
@@ -279,8 +307,12 @@ void virtio_disk_intr()
         if (disk.info[id].status != 0)
             panic("virtio_disk_intr status");
 
-        disk.info[id].b->disk = false; // disk is done with buf
-        proc_wakeup(disk.info[id].b);
+        *disk.info[id].done = false; // disk is done with buf
+        proc_wakeup((void *)disk.info[id].done);
+
+        // 批量提交时等待者不一定按顺序回收, 统一在这里释放描述符
+        disk.info[id].done = 0;
+        free_chain(id);
 
         disk.used_idx = (disk.used_idx + 1) % NUM;
     }
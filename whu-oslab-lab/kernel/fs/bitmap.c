@@ -1,68 +1,311 @@
 #include "fs/buf.h"
 #include "fs/fs.h"
 #include "fs/bitmap.h"
+#include "fs/log.h"
+#include "fs/inode.h"
+#include "lib/lock.h"
 #include "lib/print.h"
 
 extern super_block_t sb;
 
-// search and set bit
-static uint32 bitmap_search_and_set(uint32 bitmap_block)
+/*
+    inode bitmap 和 data bitmap 都可以占用多个block
+    block数由超级块推出: data_start - data_bitmap_start, inode_start - inode_bitmap_start
+    内存里为每个bitmap维护:
+      nfree       空闲bit总数
+      block_free  每个bitmap block里的空闲bit数 (摘要, 搜索时跳过已满的block)
+      cursor      下一次没有目标位置时从哪里开始搜索
+      reserved    预留的block数 (已承诺给延迟分配的数据和它们最坏情况下的元数据, 刷盘时才真正分配)
+    始终保持 nfree >= reserved: 不使用预留的申请只能拿走 nfree - reserved 之内的bit
+    bitmap block内按64位字扫描, 用ctz找到字里第一个空闲bit
+    bitmap block本身由buf的睡眠锁保护, 以上内存字段由lk_bitmap保护
+*/
+
+#define BITS_PER_BLOCK    (BLOCK_SIZE * 8)
+#define WORDS_PER_BLOCK   (BLOCK_SIZE / sizeof(uint64))
+#define BITMAP_MAX_BLOCKS 16  // 每个bitmap最多的block数 (data最多 16 * BLOCK_SIZE * 8 个block)
+
+typedef struct bitmap {
+    char* name;
+    uint32 start;       // 第一个bitmap block
+    uint32 blocks;      // bitmap block数
+    uint32 bits;        // 有效bit数
+    uint32 cursor;      // 上一次分配的下一个bit
+    uint32 nfree;       // 空闲bit总数
+    uint32 reserved;    // 预留的bit数 (只用于data bitmap)
+    uint16 block_free[BITMAP_MAX_BLOCKS]; // 每个bitmap block的空闲bit数
+} bitmap_t;
+
+static bitmap_t data_bm, inode_bm;
+static spinlock_t lk_bitmap;
+
+// 末尾0的个数 (x != 0)
+static uint32 ctz64(uint64 x)
 {
-    uint32 byte, shift;
-    uint8 bit_cmp;
+    uint32 n = 0;
+    if((x & 0xFFFFFFFF) == 0) { n += 32; x >>= 32; }
+    if((x & 0xFFFF) == 0)     { n += 16; x >>= 16; }
+    if((x & 0xFF) == 0)       { n += 8;  x >>= 8;  }
+    if((x & 0xF) == 0)        { n += 4;  x >>= 4;  }
+    if((x & 0x3) == 0)        { n += 2;  x >>= 2;  }
+    if((x & 0x1) == 0)        { n += 1; }
+    return n;
+}
 
-    buf_t* buf = buf_read(bitmap_block);
-    for(byte = 0; byte < BLOCK_SIZE; byte++) {
-        bit_cmp = 1;
-        for(shift = 0; shift <= 7; shift++) {
-            if((bit_cmp & buf->data[byte]) == 0) {
-                buf->data[byte] |= bit_cmp;
-                buf_write(buf);
-                buf_release(buf);
-                return byte * 8 + shift;
-            }
-            bit_cmp = bit_cmp << 1;
+// 1的个数
+static uint32 popcount64(uint64 x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555UL);
+    x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FUL;
+    return (x * 0x0101010101010101UL) >> 56;
+}
+
+// 第b个bitmap block里的有效bit数
+static uint32 block_bits(bitmap_t* bm, uint32 b)
+{
+    if(b * BITS_PER_BLOCK >= bm->bits)
+        return 0;
+    uint32 left = bm->bits - b * BITS_PER_BLOCK;
+    return left < BITS_PER_BLOCK ? left : BITS_PER_BLOCK;
+}
+
+// 读入bitmap, 统计空闲bit
+static void bitmap_load(bitmap_t* bm, char* name, uint32 start, uint32 blocks, uint32 bits)
+{
+    assert(blocks <= BITMAP_MAX_BLOCKS && blocks * BITS_PER_BLOCK >= bits, "bitmap_load: size");
+
+    bm->name = name;
+    bm->start = start;
+    bm->blocks = blocks;
+    bm->bits = bits;
+    bm->cursor = 0;
+    bm->nfree = 0;
+    bm->reserved = 0;
+
+    for(uint32 b = 0; b < blocks; b++) {
+        uint32 nbits = block_bits(bm, b);
+        uint32 used = 0;
+        buf_t* buf = buf_read(start + b);
+        uint64* words = (uint64*)buf->data;
+        for(uint32 w = 0; w * 64 < nbits; w++) {
+            uint64 word = words[w];
+            if(nbits - w * 64 < 64)
+                word &= ((uint64)1 << (nbits - w * 64)) - 1;
+            used += popcount64(word);
         }
+        buf_release(buf);
+        bm->block_free[b] = nbits - used;
+        bm->nfree += nbits - used;
     }
+}
+
+// 在一个bitmap block的[from, end)里查找第一个为0的bit
+// 从它开始最多连续want个为0的bit全部置1, 个数放入got
+// 成功返回第一个bit在block内的序号, 失败返回-1
+static int block_search_and_set(uint32 block_num, uint32 from, uint32 end, uint32 want, uint32* got)
+{
+    buf_t* buf = buf_read(block_num);
+    uint64* words = (uint64*)buf->data;
+
+    for(uint32 w = from / 64; w * 64 < end; w++) {
+        uint64 free = ~words[w];
+        if(w == from / 64)
+            free &= ~(uint64)0 << (from % 64);
+        if(free == 0)
+            continue;
+
+        uint32 bit = w * 64 + ctz64(free);
+        if(bit >= end)
+            break;
+
+        // 向后延伸
+        uint32 n = 0;
+        for(uint32 b = bit; n < want && b < end; b++, n++) {
+            uint64 mask = (uint64)1 << (b % 64);
+            if(words[b / 64] & mask)
+                break;
+            words[b / 64] |= mask;
+        }
+        log_write(buf);
+        buf_release(buf);
+        *got = n;
+        return bit;
+    }
+
     buf_release(buf);
-    panic("bitmap_search_and_set: no bit left");
+    return -1;
+}
+
+// 从goal开始向后搜索 (到末尾后回到开头) 第一个空闲bit
+// 从它开始最多申请want个连续bit, 个数放入got
+// goal无效时从cursor开始
+// reserved = true 从预留里申请 (调用者之前已经预留), 否则只能使用没有被预留的bit
+// 搜索前先在计数里扣除want个, 搜索期间放锁也不会被并发的申请超额拿走
+static uint32 bitmap_alloc(bitmap_t* bm, uint32 goal, uint32 want, uint32* got, bool reserved)
+{
+    spinlock_acquire(&lk_bitmap);
+    if(reserved) {
+        assert(bm->reserved > 0, "bitmap_alloc: no reservation");
+        if(want > bm->reserved)
+            want = bm->reserved;
+        bm->reserved -= want;
+    } else {
+        if(bm->nfree <= bm->reserved)
+            panic("bitmap_alloc: no bit left");
+        if(want > bm->nfree - bm->reserved)
+            want = bm->nfree - bm->reserved;
+    }
+    bm->nfree -= want;
+    if(goal >= bm->bits)
+        goal = bm->cursor;
+    spinlock_release(&lk_bitmap);
+
+    uint32 b0 = goal / BITS_PER_BLOCK;
+    for(uint32 i = 0; i <= bm->blocks; i++) {
+        uint32 b = (b0 + i) % bm->blocks;
+        uint32 from = 0, end = block_bits(bm, b);
+
+        if(i == 0)
+            from = goal % BITS_PER_BLOCK;
+        else if(i == bm->blocks)
+            end = goal % BITS_PER_BLOCK; // 回到起点所在block, 只剩goal之前的部分
+
+        // 摘要只是提示, 真正的结果以bitmap block为准
+        if(bm->block_free[b] == 0 || from >= end)
+            continue;
+
+        int bit = block_search_and_set(bm->start + b, from, end, want, got);
+        if(bit < 0)
+            continue;
+
+        // 归还扣除了但没有用到的部分
+        uint32 num = b * BITS_PER_BLOCK + bit;
+        spinlock_acquire(&lk_bitmap);
+        bm->block_free[b] -= *got;
+        bm->nfree += want - *got;
+        if(reserved)
+            bm->reserved += want - *got;
+        bm->cursor = (num + *got < bm->bits) ? num + *got : 0;
+        spinlock_release(&lk_bitmap);
+        return num;
+    }
+
+    panic("bitmap_alloc: no bit left");
     return 0;
 }
 
 // unset bit
-static void bitmap_unset(uint32 bitmap_block, uint32 num)
+static void bitmap_unset(bitmap_t* bm, uint32 num)
 {
-    uint32 byte = num / 8;
-    uint32 shift = num % 8;
-    uint8 bit_cmp = 1 << shift;
+    assert(num < bm->bits, "bitmap_unset: out of range");
+
+    uint32 b = num / BITS_PER_BLOCK;
+    uint32 byte = (num % BITS_PER_BLOCK) / 8;
+    uint8 bit_cmp = 1 << (num % 8);
 
-    buf_t* buf = buf_read(bitmap_block);
+    buf_t* buf = buf_read(bm->start + b);
     if((buf->data[byte] & bit_cmp) == 0)
         panic("bitmap_unset: bit already free");
     buf->data[byte] &= ~bit_cmp;
-    buf_write(buf);
+    log_write(buf);
     buf_release(buf);
+
+    spinlock_acquire(&lk_bitmap);
+    bm->block_free[b]++;
+    bm->nfree++;
+    spinlock_release(&lk_bitmap);
+}
+
+// 读入两个bitmap并建立摘要 (需要在日志恢复之后)
+void bitmap_init()
+{
+    spinlock_init(&lk_bitmap, "bitmap");
+    bitmap_load(&inode_bm, "inode", sb.inode_bitmap_start,
+                sb.inode_start - sb.inode_bitmap_start, sb.inode_blocks * INODE_PER_BLOCK);
+    bitmap_load(&data_bm, "data", sb.data_bitmap_start,
+                sb.data_start - sb.data_bitmap_start, sb.data_blocks);
 }
 
-uint32 bitmap_alloc_block()
+// 申请一个data block
+// goal: 希望得到的block_num (通常紧跟文件的上一个block), 0表示没有偏好
+// 从goal开始向后找第一个空闲block
+uint32 bitmap_alloc_block(uint32 goal)
 {
-    uint32 bit_num = bitmap_search_and_set(sb.data_bitmap_start);
-    return sb.data_start + bit_num;
+    uint32 got;
+    return bitmap_alloc_blocks(goal, 1, &got, false);
 }
 
+// 申请最多want个磁盘上连续的data block, 实际个数放入got (至少为1)
+// reserved = true 时使用调用者之前预留的block, 否则只使用没有被预留的block
+// 返回第一个block_num
+uint32 bitmap_alloc_blocks(uint32 goal, uint32 want, uint32* got, bool reserved)
+{
+    uint32 bit_goal = (goal >= sb.data_start) ? goal - sb.data_start : data_bm.bits;
+    return sb.data_start + bitmap_alloc(&data_bm, bit_goal, want, got, reserved);
+}
+
+// 释放block, 同时从未提交的日志里撤销它
 void bitmap_free_block(uint32 block_num)
 {
-    bitmap_unset(sb.data_bitmap_start, block_num - sb.data_start);
+    bitmap_unset(&data_bm, block_num - sb.data_start);
+    log_revoke(block_num);
+}
+
+// 空闲且没有被预留的data block数
+uint32 bitmap_free_blocks()
+{
+    spinlock_acquire(&lk_bitmap);
+    uint32 n = data_bm.nfree > data_bm.reserved ? data_bm.nfree - data_bm.reserved : 0;
+    spinlock_release(&lk_bitmap);
+    return n;
+}
+
+// 为延迟分配预留n个data block
+// 空间不足返回false
+bool bitmap_reserve_blocks(uint32 n)
+{
+    bool ret = false;
+    spinlock_acquire(&lk_bitmap);
+    if(data_bm.nfree >= data_bm.reserved && data_bm.nfree - data_bm.reserved >= n) {
+        data_bm.reserved += n;
+        ret = true;
+    }
+    spinlock_release(&lk_bitmap);
+    return ret;
+}
+
+// 归还预留 (真正分配之前或数据被丢弃时)
+void bitmap_unreserve_blocks(uint32 n)
+{
+    spinlock_acquire(&lk_bitmap);
+    assert(data_bm.reserved >= n, "bitmap_unreserve_blocks: underflow");
+    data_bm.reserved -= n;
+    spinlock_release(&lk_bitmap);
 }
 
 uint16 bitmap_alloc_inode()
 {
-    return (uint16)bitmap_search_and_set(sb.inode_bitmap_start);
+    uint32 got;
+    return (uint16)bitmap_alloc(&inode_bm, inode_bm.bits, 1, &got, false);
 }
 
 void bitmap_free_inode(uint16 inode_num)
 {
-    bitmap_unset(sb.inode_bitmap_start, (uint32)inode_num);
+    bitmap_unset(&inode_bm, (uint32)inode_num);
+}
+
+// 输出空闲bit摘要
+void bitmap_stat_print()
+{
+    bitmap_t* bms[2] = {&inode_bm, &data_bm};
+    for(int i = 0; i < 2; i++) {
+        printf("%s bitmap: free = %d / %d, reserved = %d, cursor = %d, per block:", 
+               bms[i]->name, bms[i]->nfree, bms[i]->bits, bms[i]->reserved, bms[i]->cursor);
+        for(uint32 b = 0; b < bms[i]->blocks; b++)
+            printf(" %d", bms[i]->block_free[b]);
+        printf("\n");
+    }
 }
 
 // 打印所有已经分配出去的bit序号(序号从0开始)
@@ -1,45 +1,143 @@
 #include "fs/buf.h"
+#include "fs/log.h"
 #include "dev/vio.h"
 #include "lib/lock.h"
 #include "lib/print.h"
 #include "lib/str.h"
 
-#define N_BLOCK_BUF 64
+#define N_BLOCK_BUF (LOG_SIZE + 64) // 日志最多pin住LOG_SIZE个, 其余64个留给正在进行的操作和预读
 #define BLOCK_NUM_UNUSED 0xFFFFFFFF
 
+/*
+    替换策略: 2Q (简化版)
+    A1in: 第一次被读入的block, FIFO, 命中不调整位置 (顺序扫描的block只会在这里停留)
+    A1out: 最近从A1in淘汰的block_num (只记编号, 不占buf)
+    Am: 热点block, LRU; 只有在A1out里再次被读入的block才能进入
+    淘汰时A1in超过N_A1IN则从A1in尾部淘汰, 否则从Am尾部淘汰
+    这样一次大文件顺序读只会冲刷A1in, inode/bitmap/目录等反复访问的block留在Am
+*/
+#define N_A1IN  (N_BLOCK_BUF / 4)
+#define N_A1OUT (N_BLOCK_BUF / 2)
+
+#define BUF_Q_A1IN 0
+#define BUF_Q_AM   1
+
 // 将buf包装成双向循环链表的node
 typedef struct buf_node {
     buf_t buf;
+    uint32 queue; // 所在队列 BUF_Q_xxx
     struct buf_node* next;
     struct buf_node* prev;
 } buf_node_t;
 
 // buf cache
 static buf_node_t buf_cache[N_BLOCK_BUF];
-static buf_node_t head_buf; // ->next 已分配 ->prev 可分配
-static spinlock_t lk_buf_cache; // 这个锁负责保护 链式结构 + buf_ref + block_num
+static buf_node_t head_a1in; // ->next 最新进入 ->prev 最早进入
+static buf_node_t head_am;   // ->next 最近使用 ->prev 最久未用
+static uint32 n_a1in;        // A1in里的buf数量
+static spinlock_t lk_buf_cache; // 这个锁负责保护 链式结构 + buf_ref + block_num + A1out
+
+// A1out: block_num的循环队列
+static uint32 a1out[N_A1OUT];
+static uint32 a1out_next; // 下一个写入位置
+
+// 命中率统计
+static uint32 stat_hit, stat_miss;
 
-// 链表操作
-static void insert_head(buf_node_t* buf_node, bool head_next)
+// 链表操作: 离开当前链表(如果在链表里), 插入head->next
+static void insert_head(buf_node_t* buf_node, buf_node_t* head)
 {
     // 离开
     if(buf_node->next && buf_node->prev) {
         buf_node->next->prev = buf_node->prev;
         buf_node->prev->next = buf_node->next;
+        if(buf_node->queue == BUF_Q_A1IN)
+            n_a1in--;
     }
 
-    // 插入
-    if(head_next) { // 插入 head->next
-        buf_node->prev = &head_buf;
-        buf_node->next = head_buf.next;
-        head_buf.next->prev = buf_node;
-        head_buf.next = buf_node;        
-    } else { // 插入 head->prev
-        buf_node->next = &head_buf;
-        buf_node->prev = head_buf.prev;
-        head_buf.prev->next = buf_node;
-        head_buf.prev = buf_node;
+    // 插入 head->next
+    buf_node->prev = head;
+    buf_node->next = head->next;
+    head->next->prev = buf_node;
+    head->next = buf_node;
+
+    buf_node->queue = (head == &head_a1in) ? BUF_Q_A1IN : BUF_Q_AM;
+    if(buf_node->queue == BUF_Q_A1IN)
+        n_a1in++;
+}
+
+// 在A1out里查找并移除block_num
+static bool a1out_take(uint32 block_num)
+{
+    for(int i = 0; i < N_A1OUT; i++) {
+        if(a1out[i] == block_num) {
+            a1out[i] = BLOCK_NUM_UNUSED;
+            return true;
+        }
     }
+    return false;
+}
+
+// 记录被A1in淘汰的block_num (覆盖最早的记录)
+static void a1out_put(uint32 block_num)
+{
+    if(block_num == BLOCK_NUM_UNUSED)
+        return;
+    a1out[a1out_next] = block_num;
+    a1out_next = (a1out_next + 1) % N_A1OUT;
+}
+
+// 在两个队列中查找block_num
+static buf_node_t* buf_lookup(uint32 block_num)
+{
+    buf_node_t* bn;
+    for(bn = head_am.next; bn != &head_am; bn = bn->next)
+        if(bn->buf.block_num == block_num)
+            return bn;
+    for(bn = head_a1in.next; bn != &head_a1in; bn = bn->next)
+        if(bn->buf.block_num == block_num)
+            return bn;
+    return NULL;
+}
+
+// 从head队列尾部找一个无人引用的buf
+static buf_node_t* buf_victim_in(buf_node_t* head)
+{
+    buf_node_t* bn;
+    for(bn = head->prev; bn != head; bn = bn->prev)
+        if(bn->buf.buf_ref == 0)
+            return bn;
+    return NULL;
+}
+
+// 选出被淘汰的buf并按2Q规则放入新block_num所在的队列
+// 找不到返回NULL
+// 调用者需持有lk_buf_cache
+static buf_node_t* buf_replace(uint32 block_num)
+{
+    buf_node_t* bn = NULL;
+
+    if(n_a1in > N_A1IN)
+        bn = buf_victim_in(&head_a1in);
+    if(bn == NULL)
+        bn = buf_victim_in(&head_am);
+    if(bn == NULL)
+        bn = buf_victim_in(&head_a1in);
+    if(bn == NULL)
+        return NULL;
+
+    if(bn->queue == BUF_Q_A1IN)
+        a1out_put(bn->buf.block_num);
+
+    // 最近被淘汰过又回来的block说明是热点, 直接进入Am
+    if(a1out_take(block_num))
+        insert_head(bn, &head_am);
+    else
+        insert_head(bn, &head_a1in);
+
+    bn->buf.block_num = block_num;
+    bn->buf.buf_ref = 1;
+    return bn;
 }
 
 // 初始化
@@ -48,22 +146,29 @@ void buf_init()
     spinlock_init(&lk_buf_cache, "buf_cache");
 
     // 初始化头节点为双向循环链表
-    head_buf.next = &head_buf;
-    head_buf.prev = &head_buf;
+    head_a1in.next = &head_a1in;
+    head_a1in.prev = &head_a1in;
+    head_am.next = &head_am;
+    head_am.prev = &head_am;
+    n_a1in = 0;
+
+    for(int i = 0; i < N_A1OUT; i++)
+        a1out[i] = BLOCK_NUM_UNUSED;
+    a1out_next = 0;
+    stat_hit = stat_miss = 0;
 
-    // 将所有buf加入链表（初始都在head.prev侧，表示可分配）
+    // 所有buf初始都在A1in中, 最先被淘汰
     for(int i = 0; i < N_BLOCK_BUF; i++) {
         buf_cache[i].buf.block_num = BLOCK_NUM_UNUSED;
         buf_cache[i].buf.buf_ref = 0;
         sleeplock_init(&buf_cache[i].buf.slk, "buf");
-        // 插入到头节点的prev侧（可分配端）
-        insert_head(&buf_cache[i], false);
+        insert_head(&buf_cache[i], &head_a1in);
     }
 }
 
 /*
     首先假设这个block_num对应的block在内存中有备份, 找到它并上锁返回
-    如果找不到, 尝试申请一个无人使用的buf, 去磁盘读取对应block并上锁返回
+    如果找不到, 按2Q规则淘汰一个无人使用的buf, 去磁盘读取对应block并上锁返回
     如果没有空闲buf, panic报错
     (建议合并xv6的bget())
 */
@@ -74,30 +179,68 @@ buf_t* buf_read(uint32 block_num)
     spinlock_acquire(&lk_buf_cache);
 
     // 查找已缓存的block
-    for(bn = head_buf.next; bn != &head_buf; bn = bn->next) {
-        if(bn->buf.block_num == block_num) {
-            bn->buf.buf_ref++;
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&bn->buf.slk);
-            return &bn->buf;
-        }
+    bn = buf_lookup(block_num);
+    if(bn != NULL) {
+        bn->buf.buf_ref++;
+        stat_hit++;
+        spinlock_release(&lk_buf_cache);
+        sleeplock_acquire(&bn->buf.slk);
+        return &bn->buf;
     }
 
-    // 未缓存，从链表尾端（LRU）找空闲buf
-    for(bn = head_buf.prev; bn != &head_buf; bn = bn->prev) {
-        if(bn->buf.buf_ref == 0) {
-            bn->buf.block_num = block_num;
-            bn->buf.buf_ref = 1;
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&bn->buf.slk);
-            // 从磁盘读取
-            virtio_disk_rw(&bn->buf, false);
-            return &bn->buf;
-        }
+    // 未缓存，淘汰一个buf
+    bn = buf_replace(block_num);
+    if(bn == NULL)
+        panic("buf_read: no free buf");
+    stat_miss++;
+
+    // ref == 0 说明无人持有睡眠锁, 这里不会睡眠
+    // 先上锁再放开lk_buf_cache, 防止其他人命中后读到旧数据
+    sleeplock_acquire(&bn->buf.slk);
+    spinlock_release(&lk_buf_cache);
+
+    // 从磁盘读取
+    virtio_disk_rw(&bn->buf, false);
+    return &bn->buf;
+}
+
+/*
+    预读: 把block_nums里不在内存中的block一次性读入buf_cache
+    所有请求先交给磁盘再统一等待, 避免逐个block等待磁盘延迟
+    读入后立即释放(ref = 0), 之后的buf_read会直接命中
+    预读的block进入A1in, 顺序读不会把它们提升为热点
+    空闲buf不足时只预读一部分, 不会panic
+*/
+void buf_prefetch(uint32* block_nums, uint32 n)
+{
+    buf_t* bufs[N_BUF_PREFETCH];
+    buf_node_t* bn;
+    uint32 cnt = 0;
+
+    if(n > N_BUF_PREFETCH)
+        n = N_BUF_PREFETCH;
+
+    spinlock_acquire(&lk_buf_cache);
+    for(uint32 i = 0; i < n; i++) {
+        // 已经在内存中
+        if(buf_lookup(block_nums[i]) != NULL)
+            continue;
+
+        bn = buf_replace(block_nums[i]);
+        if(bn == NULL)
+            break;
+        sleeplock_acquire(&bn->buf.slk);
+        bufs[cnt++] = &bn->buf;
     }
+    spinlock_release(&lk_buf_cache);
 
-    panic("buf_read: no free buf");
-    return NULL;
+    if(cnt == 0)
+        return;
+
+    virtio_disk_rw_batch(bufs, cnt, false);
+
+    for(uint32 i = 0; i < cnt; i++)
+        buf_release(bufs[i]);
 }
 
 // 写函数 (强制磁盘和内存保持一致)
@@ -119,20 +262,60 @@ void buf_release(buf_t* buf)
 
     spinlock_acquire(&lk_buf_cache);
     bn->buf.buf_ref--;
-    if(bn->buf.buf_ref == 0) {
-        // LRU: 移到链表头部（最近使用）
-        insert_head(bn, true);
+    if(bn->buf.buf_ref == 0 && bn->queue == BUF_Q_AM) {
+        // Am是LRU: 移到链表头部（最近使用）
+        // A1in是FIFO: 保持原位
+        insert_head(bn, &head_am);
     }
     spinlock_release(&lk_buf_cache);
 }
 
-// 输出buf_cache的情况
-void buf_print()
+// 日志使用: 在提交之前把buf留在内存里 (ref++)
+void buf_pin(buf_t* buf)
+{
+    spinlock_acquire(&lk_buf_cache);
+    buf->buf_ref++;
+    spinlock_release(&lk_buf_cache);
+}
+
+// 日志使用: 提交完成后归还buf_pin的引用
+void buf_unpin(buf_t* buf)
+{
+    buf_node_t* bn = (buf_node_t*)buf;
+
+    spinlock_acquire(&lk_buf_cache);
+    assert(buf->buf_ref > 0, "buf_unpin: ref");
+    buf->buf_ref--;
+    if(buf->buf_ref == 0 && bn->queue == BUF_Q_AM)
+        insert_head(bn, &head_am);
+    spinlock_release(&lk_buf_cache);
+}
+
+// 清空命中率统计
+void buf_stat_reset()
 {
-    printf("\nbuf_cache:\n");
-    buf_node_t* buf = head_buf.next;
     spinlock_acquire(&lk_buf_cache);
-    while(buf != &head_buf)
+    stat_hit = stat_miss = 0;
+    spinlock_release(&lk_buf_cache);
+}
+
+// 输出命中率统计
+void buf_stat_print()
+{
+    spinlock_acquire(&lk_buf_cache);
+    uint32 hit = stat_hit, miss = stat_miss, a1 = n_a1in;
+    spinlock_release(&lk_buf_cache);
+
+    uint32 total = hit + miss;
+    printf("buf_cache: hit = %d, miss = %d, hit rate = %d%%, A1in = %d, Am = %d\n",
+           hit, miss, total ? hit * 100 / total : 0, a1, N_BLOCK_BUF - a1);
+}
+
+// 输出一个队列的情况
+static void buf_print_queue(buf_node_t* head)
+{
+    buf_node_t* buf = head->next;
+    while(buf != head)
     {
         buf_t* b = &buf->buf;
         printf("buf %d: ref = %d, block_num = %d\n", (int)(buf-buf_cache), b->buf_ref, b->block_num);
@@ -141,5 +324,16 @@ void buf_print()
         printf("\n");
         buf = buf->next;
     }
+}
+
+// 输出buf_cache的情况
+void buf_print()
+{
+    printf("\nbuf_cache:\n");
+    spinlock_acquire(&lk_buf_cache);
+    printf("[Am]\n");
+    buf_print_queue(&head_am);
+    printf("[A1in]\n");
+    buf_print_queue(&head_a1in);
     spinlock_release(&lk_buf_cache);
-}
\ No newline at end of file
+}
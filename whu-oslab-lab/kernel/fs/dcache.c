@@ -0,0 +1,174 @@
+#include "fs/dcache.h"
+#include "fs/dir.h"
+#include "fs/inode.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "lib/str.h"
+
+/*
+    所有目录项放在一个静态池里
+    每个有效项挂在hash桶的单链表上, 同时挂在全局LRU双链表上
+    空闲项从LRU尾部取 (无效项总是被放到尾部)
+    插入和失效都在持有父目录睡眠锁时进行, 查找不需要
+*/
+
+typedef struct dentry {
+    uint16 pinum;               // 父目录 (INODE_NUM_UNUSED 表示空闲)
+    uint16 inum;                // 目标inode, INODE_NUM_UNUSED 表示负项
+    char name[DIR_NAME_LEN];
+    struct dentry* hnext;       // hash桶链表
+    struct dentry* next;        // LRU链表
+    struct dentry* prev;
+} dentry_t;
+
+static dentry_t dcache[N_DCACHE];
+static dentry_t* dhash[N_DCACHE_HASH];
+static dentry_t lru_head;       // ->next 最近使用 ->prev 最久未用
+static spinlock_t lk_dcache;    // 保护以上所有结构
+
+// 命中率统计
+static uint32 stat_hit, stat_miss;
+
+static uint32 dcache_hash(uint16 pinum, char* name)
+{
+    return (dir_hash(name) ^ (pinum * 2654435761u)) % N_DCACHE_HASH;
+}
+
+static void lru_remove(dentry_t* de)
+{
+    de->next->prev = de->prev;
+    de->prev->next = de->next;
+}
+
+// 插入LRU头部 (最近使用)
+static void lru_push_head(dentry_t* de)
+{
+    de->prev = &lru_head;
+    de->next = lru_head.next;
+    lru_head.next->prev = de;
+    lru_head.next = de;
+}
+
+// 插入LRU尾部 (最先被复用)
+static void lru_push_tail(dentry_t* de)
+{
+    de->next = &lru_head;
+    de->prev = lru_head.prev;
+    lru_head.prev->next = de;
+    lru_head.prev = de;
+}
+
+// 在hash桶里查找 (调用者持有lk_dcache)
+static dentry_t* dcache_find(uint16 pinum, char* name)
+{
+    for(dentry_t* de = dhash[dcache_hash(pinum, name)]; de != NULL; de = de->hnext)
+        if(de->pinum == pinum && strncmp(de->name, name, DIR_NAME_LEN) == 0)
+            return de;
+    return NULL;
+}
+
+// 从hash桶摘下并放到LRU尾部 (调用者持有lk_dcache)
+static void dcache_drop(dentry_t* de)
+{
+    dentry_t** pp = &dhash[dcache_hash(de->pinum, de->name)];
+    while(*pp != de)
+        pp = &(*pp)->hnext;
+    *pp = de->hnext;
+    de->hnext = NULL;
+    de->pinum = INODE_NUM_UNUSED;
+
+    lru_remove(de);
+    lru_push_tail(de);
+}
+
+// 初始化
+void dcache_init()
+{
+    spinlock_init(&lk_dcache, "dcache");
+    lru_head.next = &lru_head;
+    lru_head.prev = &lru_head;
+    for(int i = 0; i < N_DCACHE; i++) {
+        dcache[i].pinum = INODE_NUM_UNUSED;
+        dcache[i].hnext = NULL;
+        lru_push_tail(&dcache[i]);
+    }
+    for(int i = 0; i < N_DCACHE_HASH; i++)
+        dhash[i] = NULL;
+    stat_hit = stat_miss = 0;
+}
+
+// 查询 (pinum, name)
+// 命中返回true, 目标inode(ref++)放入ipp (NULL表示名字不存在)
+// 目标inode不在icache里时按未命中处理: 取得它可能睡眠, 不能在lk_dcache内进行
+// 引用在lk_dcache内取得: 项还在说明还没有被unlink, inode不会在这之前被释放
+// 不需要持有父目录的锁
+bool dcache_lookup(uint16 pinum, char* name, inode_t** ipp)
+{
+    spinlock_acquire(&lk_dcache);
+    dentry_t* de = dcache_find(pinum, name);
+    *ipp = NULL;
+    if(de != NULL && de->inum != INODE_NUM_UNUSED)
+        *ipp = inode_get_cached(de->inum);
+    if(de == NULL || (de->inum != INODE_NUM_UNUSED && *ipp == NULL)) {
+        stat_miss++;
+        spinlock_release(&lk_dcache);
+        return false;
+    }
+    lru_remove(de);
+    lru_push_head(de);
+    stat_hit++;
+    spinlock_release(&lk_dcache);
+    return true;
+}
+
+// 记录 (pinum, name) -> inum
+// 调用者需持有父目录的锁 (保证与失效操作不交错)
+void dcache_insert(uint16 pinum, char* name, uint16 inum)
+{
+    spinlock_acquire(&lk_dcache);
+
+    dentry_t* de = dcache_find(pinum, name);
+    if(de == NULL) {
+        // 复用最久未用的项
+        de = lru_head.prev;
+        if(de->pinum != INODE_NUM_UNUSED)
+            dcache_drop(de);
+        de->pinum = pinum;
+        strncpy(de->name, name, DIR_NAME_LEN);
+        uint32 h = dcache_hash(pinum, name);
+        de->hnext = dhash[h];
+        dhash[h] = de;
+    }
+    de->inum = inum;
+    lru_remove(de);
+    lru_push_head(de);
+
+    spinlock_release(&lk_dcache);
+}
+
+// 目录项 (pinum, name) 被增加或删除
+// 调用者需持有父目录的锁
+void dcache_invalidate(uint16 pinum, char* name)
+{
+    spinlock_acquire(&lk_dcache);
+    dentry_t* de = dcache_find(pinum, name);
+    if(de != NULL)
+        dcache_drop(de);
+    spinlock_release(&lk_dcache);
+}
+
+// 目录pinum被销毁: 丢弃它下面的所有目录项
+void dcache_purge(uint16 pinum)
+{
+    spinlock_acquire(&lk_dcache);
+    for(int i = 0; i < N_DCACHE; i++)
+        if(dcache[i].pinum == pinum)
+            dcache_drop(&dcache[i]);
+    spinlock_release(&lk_dcache);
+}
+
+// 输出命中率
+void dcache_stat_print()
+{
+    printf("dcache: hit = %d miss = %d\n", stat_hit, stat_miss);
+}
@@ -3,13 +3,296 @@
 #include "fs/inode.h"
 #include "fs/dir.h"
 #include "fs/bitmap.h"
+#include "fs/log.h"
+#include "fs/dcache.h"
 #include "mem/vmem.h"
 #include "lib/str.h"
 #include "lib/print.h"
 #include "proc/cpu.h"
 
-// 对目录文件的简化性假设: 每个目录文件只包括一个block
-// 也就是每个目录下最多 BLOCK_SIZE / sizeof(dirent_t) = 32 个目录项
+/*
+    目录文件的组织:
+    1. 只有一个block (size == BLOCK_SIZE) 时是线性目录, 直接存放目录项
+    2. 放不下后转换成索引目录(htree): block 0 变成索引根
+       根按名字的hash把目录项分到若干叶子block, 叶子满了就按hash一分为二
+       根满了就增加一层中间索引节点 (根 -> 中间节点 -> 叶子)
+    3. 所有block都通过inode_locate_block追加在目录末尾, 目录只增不减
+    查找一个名字只需要读 根 + (中间节点) + 叶子, 与目录大小无关
+*/
+
+// 目录里block的数量 (老映像里的目录size可能小于BLOCK_SIZE)
+static uint32 dir_blocks(inode_t* pip)
+{
+    return pip->size <= BLOCK_SIZE ? 1 : pip->size / BLOCK_SIZE;
+}
+
+// 目录名的hash (FNV-1a)
+uint32 dir_hash(char* name)
+{
+    uint32 hash = 2166136261u;
+    for(int i = 0; i < DIR_NAME_LEN && name[i] != 0; i++) {
+        hash ^= (uint8)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool dirent_valid(dirent_t* de)
+{
+    return de->name[0] != 0 && de->inode_num != INODE_NUM_UNUSED;
+}
+
+// 这个block是否存放目录项 (而不是索引节点)
+static bool dir_is_leaf(inode_t* pip, buf_t* buf)
+{
+    return pip->size <= BLOCK_SIZE || ((dx_node_t*)buf->data)->magic != DX_MAGIC;
+}
+
+// 在目录末尾追加一个清零的block, 返回它在目录里的序号
+// 新block的buf通过bufp返回, 由调用者负责log_write和释放
+static uint32 dir_append_block(inode_t* pip, buf_t** bufp)
+{
+    uint32 bn = dir_blocks(pip);
+    buf_t* buf = buf_read(inode_locate_block(pip, bn));
+    memset(buf->data, 0, BLOCK_SIZE);
+    pip->size = (bn + 1) * BLOCK_SIZE;
+    *bufp = buf;
+    return bn;
+}
+
+/*--------------------------- 索引节点 ------------------------------*/
+
+// 从根到叶子的查找路径
+typedef struct dx_path {
+    uint32 depth;                   // 根节点记录的层数
+    uint32 node[DX_MAX_DEPTH + 1];  // 每层索引节点在目录里的block序号
+    uint32 pos[DX_MAX_DEPTH + 1];   // 每层选中的entry下标
+} dx_path_t;
+
+// 二分查找最后一个 hash <= 目标hash 的entry
+// entries[0]负责从0开始的区间, 所以总能找到
+static uint32 dx_search(dx_node_t* node, uint32 hash)
+{
+    uint32 lo = 1, hi = node->count;
+    while(lo < hi) {
+        uint32 mid = (lo + hi) / 2;
+        if(node->entries[mid].hash <= hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+// 在pos之后插入一个entry (调用者保证节点未满)
+static void dx_insert(dx_node_t* node, uint32 pos, uint32 hash, uint32 block)
+{
+    assert(node->count < DX_ENTRY_PER_BLOCK, "dx_insert: full");
+    memmove(&node->entries[pos + 2], &node->entries[pos + 1],
+            (node->count - pos - 1) * sizeof(dx_entry_t));
+    node->entries[pos + 1].hash = hash;
+    node->entries[pos + 1].block = block;
+    node->count++;
+}
+
+// 找到name应当所在的叶子block, 同时记录查找路径
+static uint32 dir_leaf(inode_t* pip, char* name, dx_path_t* path)
+{
+    path->depth = 0;
+    path->node[0] = 0;
+    path->pos[0] = 0;
+
+    // 线性目录
+    if(pip->size <= BLOCK_SIZE)
+        return 0;
+
+    uint32 hash = dir_hash(name);
+    uint32 bn = 0;
+    buf_t* buf = buf_read(inode_locate_block(pip, 0));
+    dx_node_t* node = (dx_node_t*)buf->data;
+    assert(node->magic == DX_MAGIC, "dir_leaf: bad root");
+    path->depth = node->depth;
+
+    for(uint32 level = 0; ; level++) {
+        node = (dx_node_t*)buf->data;
+        assert(node->magic == DX_MAGIC && node->count > 0, "dir_leaf: bad node");
+        path->node[level] = bn;
+        path->pos[level] = dx_search(node, hash);
+        bn = node->entries[path->pos[level]].block;
+        buf_release(buf);
+        if(level == path->depth)
+            return bn;
+        buf = buf_read(inode_locate_block(pip, bn));
+    }
+}
+
+/*--------------------------- 叶子节点 ------------------------------*/
+
+// 在一个目录block里查找name
+// 成功返回目录项的偏移, 失败返回BLOCK_SIZE
+static uint32 leaf_find(buf_t* buf, char* name)
+{
+    dirent_t* de;
+    for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
+        de = (dirent_t*)(buf->data + offset);
+        if(dirent_valid(de) && strncmp(de->name, name, DIR_NAME_LEN) == 0)
+            return offset;
+    }
+    return BLOCK_SIZE;
+}
+
+// 为满的叶子选择分界hash: hash >= 分界的目录项移到新叶子
+// 相同hash的目录项必须留在同一个叶子里, 全部相同时无法分裂, 返回0
+static uint32 leaf_split_hash(dirent_t* des)
+{
+    uint32 hash[DIRENT_PER_BLOCK];
+    uint32 n = 0;
+
+    // 插入排序
+    for(uint32 i = 0; i < DIRENT_PER_BLOCK; i++) {
+        if(!dirent_valid(&des[i])) continue;
+        uint32 h = dir_hash(des[i].name);
+        uint32 j = n++;
+        for(; j > 0 && hash[j - 1] > h; j--)
+            hash[j] = hash[j - 1];
+        hash[j] = h;
+    }
+
+    // 从中间向两边找第一个hash变化的位置
+    for(uint32 i = n / 2; i < n; i++)
+        if(i > 0 && hash[i] != hash[i - 1]) return hash[i];
+    for(uint32 i = n / 2; i > 0; i--)
+        if(hash[i] != hash[i - 1]) return hash[i];
+    return 0;
+}
+
+// 把src里 hash >= split 的目录项移到dst
+static void leaf_move(dirent_t* src, dirent_t* dst, uint32 split)
+{
+    uint32 n = 0;
+    for(uint32 i = 0; i < DIRENT_PER_BLOCK; i++) {
+        if(dirent_valid(&src[i]) && dir_hash(src[i].name) >= split) {
+            dst[n++] = src[i];
+            memset(&src[i], 0, sizeof(dirent_t));
+        }
+    }
+}
+
+// 线性目录的唯一block满了: 把它的目录项分到两个新叶子, block 0 改成索引根
+// buf是block 0
+// 成功返回0 失败返回-1
+static int dx_create_root(inode_t* pip, buf_t* buf)
+{
+    uint32 split = leaf_split_hash((dirent_t*)buf->data);
+    if(split == 0)
+        return -1;
+
+    buf_t *lbuf, *rbuf;
+    uint32 left = dir_append_block(pip, &lbuf);
+    uint32 right = dir_append_block(pip, &rbuf);
+    memmove(lbuf->data, buf->data, BLOCK_SIZE);
+    leaf_move((dirent_t*)lbuf->data, (dirent_t*)rbuf->data, split);
+
+    memset(buf->data, 0, BLOCK_SIZE);
+    dx_node_t* root = (dx_node_t*)buf->data;
+    root->magic = DX_MAGIC;
+    root->depth = 0;
+    root->count = 2;
+    root->entries[0].hash = 0;
+    root->entries[0].block = left;
+    root->entries[1].hash = split;
+    root->entries[1].block = right;
+
+    log_write(buf);
+    log_write(lbuf);
+    log_write(rbuf);
+    buf_release(lbuf);
+    buf_release(rbuf);
+    inode_rw(pip, true);
+    return 0;
+}
+
+// 索引目录的叶子满了: 分裂出一个新叶子并插入父节点
+// 父节点满了先分裂父节点, 根满了则增加一层
+// lbuf是叶子, path是dir_leaf得到的查找路径
+// 成功返回0 失败返回-1 (同hash的目录项太多 或 索引已达上限)
+static int dx_split_leaf(inode_t* pip, buf_t* lbuf, dx_path_t* path)
+{
+    uint32 split = leaf_split_hash((dirent_t*)lbuf->data);
+    if(split == 0)
+        return -1;
+
+    buf_t* rbuf = buf_read(inode_locate_block(pip, 0));
+    dx_node_t* root = (dx_node_t*)rbuf->data;
+    buf_t* pbuf = rbuf;             // 新叶子要插入的索引节点
+    uint32 rpos = path->pos[0];     // 根里指向pbuf的entry
+    uint32 pos = path->pos[path->depth];
+
+    if(root->depth == 0 && root->count == DX_ENTRY_PER_BLOCK) {
+        // 根满: 全部entry搬到新的中间节点, 根只指向它
+        uint32 bn = dir_append_block(pip, &pbuf);
+        memmove(pbuf->data, rbuf->data, BLOCK_SIZE);
+        root->depth = 1;
+        root->count = 1;
+        root->entries[0].hash = 0;
+        root->entries[0].block = bn;
+        rpos = 0;
+    } else if(root->depth == 1) {
+        pbuf = buf_read(inode_locate_block(pip, path->node[1]));
+    }
+
+    dx_node_t* parent = (dx_node_t*)pbuf->data;
+    if(parent->count == DX_ENTRY_PER_BLOCK) {
+        // 中间节点满: 上半部分搬到新的中间节点
+        // 这里parent一定不是根 (根满且depth == 0的情况上面已经处理)
+        if(root->count == DX_ENTRY_PER_BLOCK) {
+            buf_release(pbuf);
+            buf_release(rbuf);
+            return -1;
+        }
+        buf_t* sbuf;
+        uint32 sibling = dir_append_block(pip, &sbuf);
+        dx_node_t* snode = (dx_node_t*)sbuf->data;
+        uint32 half = parent->count / 2;
+        snode->magic = DX_MAGIC;
+        snode->count = parent->count - half;
+        memmove(snode->entries, &parent->entries[half], snode->count * sizeof(dx_entry_t));
+        parent->count = half;
+        dx_insert(root, rpos, snode->entries[0].hash, sibling);
+
+        // 新叶子插入两者中的哪一个
+        if(pos >= half) {
+            log_write(pbuf);
+            buf_release(pbuf);
+            pbuf = sbuf;
+            parent = snode;
+            pos -= half;
+        } else {
+            log_write(sbuf);
+            buf_release(sbuf);
+        }
+    }
+
+    // 分裂叶子
+    buf_t* nbuf;
+    uint32 leaf = dir_append_block(pip, &nbuf);
+    leaf_move((dirent_t*)lbuf->data, (dirent_t*)nbuf->data, split);
+    dx_insert(parent, pos, split, leaf);
+
+    log_write(lbuf);
+    log_write(nbuf);
+    buf_release(nbuf);
+    if(pbuf != rbuf) {
+        log_write(pbuf);
+        buf_release(pbuf);
+    }
+    log_write(rbuf);
+    buf_release(rbuf);
+    inode_rw(pip, true);
+    return 0;
+}
+
+/*--------------------------- 目录项 ------------------------------*/
 
 // 查询一个目录项是否在目录里
 // 成功返回这个目录项的inode_num
@@ -20,59 +303,78 @@ uint16 dir_search_entry(inode_t *pip, char *name)
     assert(sleeplock_holding(&pip->slk), "dir_search_entry: not holding lock");
     assert(pip->type == FT_DIR, "dir_search_entry: not a directory");
     
-    dirent_t *de;
-    buf_t *buf = buf_read(pip->addrs[0]);
-    
-    for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
-        de = (dirent_t *)(buf->data + offset);
-        if(de->name[0] != 0 && strncmp(de->name, name, DIR_NAME_LEN) == 0) {
-            uint16 inum = de->inode_num;
-            buf_release(buf);
-            return inum;
-        }
-    }
-    
+    dx_path_t path;
+    uint16 inum = INODE_NUM_UNUSED;
+    buf_t *buf = buf_read(inode_locate_block(pip, dir_leaf(pip, name, &path)));
+    uint32 offset = leaf_find(buf, name);
+    if(offset != BLOCK_SIZE)
+        inum = ((dirent_t*)(buf->data + offset))->inode_num;
     buf_release(buf);
-    return INODE_NUM_UNUSED;
+
+    // 不存在的名字也记下来
+    dcache_insert(pip->inode_num, name, inum);
+    return inum;
 }
 
 // 在pip目录下添加一个目录项
-// 成功返回这个目录项的偏移量 (同时更新pip->size)
-// 失败返回BLOCK_SIZE (没有空间 或 发生重名)
+// 成功返回这个目录项在目录文件里的偏移量 (需要时扩展目录并更新pip->size)
+// 失败返回-1 (发生重名 或 目录无法继续扩展)
 // ps: 调用者需持有pip的锁
 uint32 dir_add_entry(inode_t *pip, uint16 inode_num, char *name)
 {
     assert(sleeplock_holding(&pip->slk), "dir_add_entry: not holding lock");
     assert(pip->type == FT_DIR, "dir_add_entry: not a directory");
     
-    // 检查是否重名
-    if(dir_search_entry(pip, name) != INODE_NUM_UNUSED)
-        return BLOCK_SIZE;
-    
+    dx_path_t path;
     dirent_t *de;
-    buf_t *buf = buf_read(pip->addrs[0]);
-    
-    // 查找空闲位置
-    for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
-        de = (dirent_t *)(buf->data + offset);
-        if(de->name[0] == 0 || de->inode_num == INODE_NUM_UNUSED) {
-            // 找到空位，填写目录项
-            de->inode_num = inode_num;
-            strncpy(de->name, name, DIR_NAME_LEN);
-            buf_write(buf);
+    buf_t *buf;
+    uint32 leaf;
+    int ret;
+
+    // 叶子满了就分裂后重试 (分裂后两个叶子都有空位, 最多重试一次)
+    while(1) {
+        leaf = dir_leaf(pip, name, &path);
+        buf = buf_read(inode_locate_block(pip, leaf));
+
+        // 检查是否重名
+        if(leaf_find(buf, name) != BLOCK_SIZE) {
             buf_release(buf);
-            
-            // 更新size
-            if(offset + sizeof(dirent_t) > pip->size) {
-                pip->size = offset + sizeof(dirent_t);
-                inode_rw(pip, true);
+            return -1;
+        }
+        dcache_invalidate(pip->inode_num, name);
+
+        // 查找空闲位置
+        for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
+            de = (dirent_t *)(buf->data + offset);
+            if(!dirent_valid(de)) {
+                de->inode_num = inode_num;
+                strncpy(de->name, name, DIR_NAME_LEN);
+                log_write(buf);
+                buf_release(buf);
+
+                // 老映像里的线性目录
+                if(pip->size < BLOCK_SIZE) {
+                    pip->size = BLOCK_SIZE;
+                    inode_rw(pip, true);
+                }
+                return leaf * BLOCK_SIZE + offset;
             }
-            return offset;
         }
+
+        // 分裂需要的新block先预留空间
+        if(!inode_reserve(pip, DX_SPLIT_BLOCKS)) {
+            buf_release(buf);
+            return -1;
+        }
+        if(pip->size <= BLOCK_SIZE)
+            ret = dx_create_root(pip, buf);
+        else
+            ret = dx_split_leaf(pip, buf, &path);
+        inode_prealloc_end(pip);
+        buf_release(buf);
+        if(ret < 0)
+            return -1;
     }
-    
-    buf_release(buf);
-    return BLOCK_SIZE;  // 没有空间
 }
 
 // 在pip目录下删除一个目录项
@@ -84,23 +386,20 @@ uint16 dir_delete_entry(inode_t *pip, char *name)
     assert(sleeplock_holding(&pip->slk), "dir_delete_entry: not holding lock");
     assert(pip->type == FT_DIR, "dir_delete_entry: not a directory");
     
-    dirent_t *de;
-    buf_t *buf = buf_read(pip->addrs[0]);
-    
-    for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
-        de = (dirent_t *)(buf->data + offset);
-        if(de->name[0] != 0 && strncmp(de->name, name, DIR_NAME_LEN) == 0) {
-            uint16 inum = de->inode_num;
-            // 清空目录项
-            memset(de, 0, sizeof(dirent_t));
-            buf_write(buf);
-            buf_release(buf);
-            return inum;
-        }
+    dx_path_t path;
+    uint16 inum = INODE_NUM_UNUSED;
+    buf_t *buf = buf_read(inode_locate_block(pip, dir_leaf(pip, name, &path)));
+    uint32 offset = leaf_find(buf, name);
+    dcache_invalidate(pip->inode_num, name);
+    if(offset != BLOCK_SIZE) {
+        dirent_t* de = (dirent_t*)(buf->data + offset);
+        inum = de->inode_num;
+        // 清空目录项 (叶子不回收)
+        memset(de, 0, sizeof(dirent_t));
+        log_write(buf);
     }
-    
     buf_release(buf);
-    return INODE_NUM_UNUSED;
+    return inum;
 }
 
 // 把目录下的有效目录项复制到dst (dst区域长度为len)
@@ -113,22 +412,29 @@ uint32 dir_get_entries(inode_t* pip, uint32 len, void* dst, bool user)
     
     uint32 total = 0;
     dirent_t *de;
-    buf_t *buf = buf_read(pip->addrs[0]);
-    
-    for(uint32 offset = 0; offset < BLOCK_SIZE && total < len; offset += sizeof(dirent_t)) {
-        de = (dirent_t *)(buf->data + offset);
-        if(de->name[0] != 0 && de->inode_num != INODE_NUM_UNUSED) {
-            if(user) {
-                uvm_copyout(myproc()->pgtbl, (uint64)dst + total,
-                           (uint64)de, sizeof(dirent_t));
-            } else {
-                memmove((char*)dst + total, de, sizeof(dirent_t));
+    buf_t *buf;
+    
+    for(uint32 bn = 0; bn < dir_blocks(pip) && total + sizeof(dirent_t) <= len; bn++) {
+        buf = buf_read(inode_locate_block(pip, bn));
+        if(!dir_is_leaf(pip, buf)) {
+            buf_release(buf);
+            continue;
+        }
+        for(uint32 offset = 0; offset < BLOCK_SIZE && total + sizeof(dirent_t) <= len; offset += sizeof(dirent_t)) {
+            de = (dirent_t *)(buf->data + offset);
+            if(dirent_valid(de)) {
+                if(user) {
+                    uvm_copyout(myproc()->pgtbl, (uint64)dst + total,
+                               (uint64)de, sizeof(dirent_t));
+                } else {
+                    memmove((char*)dst + total, de, sizeof(dirent_t));
+                }
+                total += sizeof(dirent_t);
             }
-            total += sizeof(dirent_t);
         }
+        buf_release(buf);
     }
     
-    buf_release(buf);
     return total;
 }
 
@@ -166,14 +472,22 @@ void dir_print(inode_t *pip)
     printf("\ninode_num = %d dirents:\n", pip->inode_num);
 
     dirent_t *de;
-    buf_t *buf = buf_read(pip->addrs[0]);
-    for (uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t))
-    {
-        de = (dirent_t *)(buf->data + offset);
-        if (de->name[0] != 0)
-            printf("inum = %d dirent = %s\n", de->inode_num, de->name);
+    buf_t *buf;
+    for(uint32 bn = 0; bn < dir_blocks(pip); bn++) {
+        buf = buf_read(inode_locate_block(pip, bn));
+        if(!dir_is_leaf(pip, buf)) {
+            dx_node_t* node = (dx_node_t*)buf->data;
+            printf("block %d: index depth = %d count = %d\n", bn, node->depth, node->count);
+            buf_release(buf);
+            continue;
+        }
+        for(uint32 offset = 0; offset < BLOCK_SIZE; offset += sizeof(dirent_t)) {
+            de = (dirent_t *)(buf->data + offset);
+            if(dirent_valid(de))
+                printf("inum = %d dirent = %s\n", de->inode_num, de->name);
+        }
+        buf_release(buf);
     }
-    buf_release(buf);
 }
 
 /*----------------------- 路径(一串目录和文件) -------------------------*/
@@ -212,6 +526,7 @@ static inode_t* search_inode(char* path, char* name, bool find_parent)
 {
     inode_t* ip;
     inode_t* next;
+    uint16 inum;
     
     // 从根目录开始（绝对路径）
     if(*path == '/') {
@@ -227,6 +542,19 @@ static inode_t* search_inode(char* path, char* name, bool find_parent)
     
     // 逐段解析路径
     while((path = skip_element(path, name)) != 0) {
+        // 先查目录项缓存: 命中说明ip是目录, 不需要上锁读目录
+        if(!find_parent || *path != '\0') {
+            if(dcache_lookup(ip->inode_num, name, &next)) {
+                if(next == NULL) {
+                    inode_free(ip);
+                    return NULL;
+                }
+                inode_free(ip);
+                ip = next;
+                continue;
+            }
+        }
+
         inode_lock(ip);
         
         // 必须是目录
@@ -241,8 +569,8 @@ static inode_t* search_inode(char* path, char* name, bool find_parent)
             return ip;
         }
         
-        // 在当前目录中查找
-        uint16 inum = dir_search_entry(ip, name);
+        // 在当前目录中查找 (结果同时进入目录项缓存)
+        inum = dir_search_entry(ip, name);
         if(inum == INODE_NUM_UNUSED) {
             inode_unlock_free(ip);
             return NULL;
@@ -315,7 +643,7 @@ inode_t* path_create_inode(char* path, uint16 type, uint16 major, uint16 minor)
     }
     
     // 在父目录中添加目录项
-    if(dir_add_entry(pip, ip->inode_num, name) == BLOCK_SIZE) {
+    if(dir_add_entry(pip, ip->inode_num, name) == -1) {
         // 添加失败，释放inode
         inode_lock(ip);
         ip->nlink = 0;
@@ -372,7 +700,7 @@ uint32 path_link(char* old_path, char* new_path)
     inode_lock(pip);
     
     // 添加目录项
-    if(dir_add_entry(pip, ip->inode_num, name) == BLOCK_SIZE) {
+    if(dir_add_entry(pip, ip->inode_num, name) == -1) {
         inode_unlock_free(pip);
         inode_unlock_free(ip);
         return -1;
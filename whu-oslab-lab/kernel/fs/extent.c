@@ -0,0 +1,232 @@
+#include "fs/buf.h"
+#include "fs/bitmap.h"
+#include "fs/inode.h"
+#include "fs/extent.h"
+#include "fs/log.h"
+#include "lib/print.h"
+#include "lib/str.h"
+
+// inode里的extent头部
+#define EXT_HEADER(ip) ((extent_header_t*)(ip)->addrs)
+// 头部之后的extent数组
+#define EXT_ENTRY(eh)  ((extent_t*)((extent_header_t*)(eh) + 1))
+
+// 二分查找最后一个 lblock <= bn 的extent
+// 不存在 (bn在第一个extent之前) 返回-1
+static int ext_search(extent_header_t* eh, uint32 bn)
+{
+    extent_t* ext = EXT_ENTRY(eh);
+    int lo = 0, hi = eh->count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(ext[mid].lblock <= bn)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+// 在pos之后插入一个extent (调用者保证未满)
+static void ext_insert_at(extent_header_t* eh, int pos, uint32 lblock, uint32 pblock, uint32 len)
+{
+    extent_t* ext = EXT_ENTRY(eh);
+    memmove(&ext[pos + 2], &ext[pos + 1], (eh->count - pos - 1) * sizeof(extent_t));
+    ext[pos + 1].lblock = lblock;
+    ext[pos + 1].pblock = pblock;
+    ext[pos + 1].len = len;
+    eh->count++;
+}
+
+// 把 bn -> block 记录进一组extent (cap是容量)
+// 能与前后extent合并就合并, 否则插入新extent
+// 成功返回true, 空间不足返回false (此时没有修改)
+static bool ext_add(extent_header_t* eh, uint32 cap, uint32 bn, uint32 block)
+{
+    extent_t* ext = EXT_ENTRY(eh);
+    int pos = ext_search(eh, bn);
+
+    // 接在前一个extent后面
+    if(pos >= 0 && ext[pos].lblock + ext[pos].len == bn && ext[pos].pblock + ext[pos].len == block) {
+        ext[pos].len++;
+        return true;
+    }
+
+    // 接在后一个extent前面
+    if(pos + 1 < eh->count && ext[pos + 1].lblock == bn + 1 && ext[pos + 1].pblock == block + 1) {
+        ext[pos + 1].lblock--;
+        ext[pos + 1].pblock--;
+        ext[pos + 1].len++;
+        return true;
+    }
+
+    if(eh->count == cap)
+        return false;
+    ext_insert_at(eh, pos, bn, block, 1);
+    return true;
+}
+
+// depth = 0 的inode放满了: extent搬进一个新叶子, inode里只留一个索引
+static void ext_grow(inode_t* ip)
+{
+    extent_header_t* ih = EXT_HEADER(ip);
+    uint32 leaf = inode_alloc_block(ip, 0);
+
+    buf_t* buf = buf_read(leaf);
+    memset(buf->data, 0, BLOCK_SIZE);
+    memmove(buf->data, ih, sizeof(extent_header_t) + ih->count * sizeof(extent_t));
+    log_write(buf);
+    buf_release(buf);
+
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ih->depth = 1;
+    ih->count = 1;
+    EXT_ENTRY(ih)[0].lblock = 0;
+    EXT_ENTRY(ih)[0].pblock = leaf;
+    EXT_ENTRY(ih)[0].len = 0;
+}
+
+// 把 bn -> block 记入 depth = 1 的extent树
+// 叶子满了则分裂 (顺序追加时新叶子只放新extent, 旧叶子保持满)
+static void ext_add_leaf(inode_t* ip, uint32 bn, uint32 block)
+{
+    extent_header_t* ih = EXT_HEADER(ip);
+    extent_t* idx = EXT_ENTRY(ih);
+    int ipos = ext_search(ih, bn);
+    if(ipos < 0) ipos = 0;
+
+    buf_t* buf = buf_read(idx[ipos].pblock);
+    extent_header_t* lh = (extent_header_t*)buf->data;
+    if(ext_add(lh, EXT_PER_BLOCK, bn, block)) {
+        log_write(buf);
+        buf_release(buf);
+        return;
+    }
+
+    if(ih->count == EXT_IN_INODE)
+        panic("extent: too many extents");
+
+    // 分裂叶子
+    uint32 leaf = inode_alloc_block(ip, 0);
+    buf_t* nbuf = buf_read(leaf);
+    memset(nbuf->data, 0, BLOCK_SIZE);
+    extent_header_t* nh = (extent_header_t*)nbuf->data;
+    int pos = ext_search(lh, bn);
+    uint32 move = (pos == lh->count - 1) ? 0 : lh->count / 2;
+    nh->count = move;
+    memmove(EXT_ENTRY(nh), &EXT_ENTRY(lh)[lh->count - move], move * sizeof(extent_t));
+    lh->count -= move;
+
+    // 新extent放入对应的叶子
+    if(move == 0 || bn >= EXT_ENTRY(nh)[0].lblock)
+        ext_add(nh, EXT_PER_BLOCK, bn, block);
+    else
+        ext_add(lh, EXT_PER_BLOCK, bn, block);
+    ext_insert_at(ih, ipos, EXT_ENTRY(nh)[0].lblock, leaf, 0);
+
+    log_write(buf);
+    log_write(nbuf);
+    buf_release(buf);
+    buf_release(nbuf);
+}
+
+// 查询从第bn块开始在磁盘上连续的一段 (不分配)
+// 返回起始block_num, *len为这一段剩余的block数; 没有映射返回0
+// 调用者需要持有slk
+uint32 extent_map(inode_t* ip, uint32 bn, uint32* len)
+{
+    extent_header_t* eh = EXT_HEADER(ip);
+    buf_t* buf = NULL;
+    uint32 ret = 0;
+
+    if(eh->depth == 1) {
+        int ipos = ext_search(eh, bn);
+        if(ipos < 0) ipos = 0;
+        buf = buf_read(EXT_ENTRY(eh)[ipos].pblock);
+        eh = (extent_header_t*)buf->data;
+    }
+
+    int pos = ext_search(eh, bn);
+    *len = 0;
+    if(pos >= 0) {
+        extent_t* e = &EXT_ENTRY(eh)[pos];
+        if(bn < e->lblock + e->len) {
+            ret = e->pblock + (bn - e->lblock);
+            *len = e->lblock + e->len - bn;
+        }
+    }
+
+    if(buf != NULL)
+        buf_release(buf);
+    return ret;
+}
+
+// extent格式的inode_locate_block
+// 不存在则在上一段的末尾之后申请, 尽量让文件在磁盘上连续
+// 调用者需要持有slk, 负责写回inode
+uint32 extent_locate_block(inode_t* ip, uint32 bn)
+{
+    extent_header_t* ih = EXT_HEADER(ip);
+    uint32 len;
+    uint32 block = extent_map(ip, bn, &len);
+    if(block != 0)
+        return block;
+
+    // 目标位置: 紧跟上一个block
+    uint32 goal = 0;
+    if(bn > 0) {
+        goal = extent_map(ip, bn - 1, &len);
+        if(goal != 0) goal++;
+    }
+    block = inode_alloc_data(ip, goal);
+
+    if(ih->depth == 0) {
+        if(ext_add(ih, EXT_IN_INODE, bn, block))
+            return block;
+        ext_grow(ip);
+    }
+    ext_add_leaf(ip, bn, block);
+    return block;
+}
+
+// 释放所有数据block和叶子block, addrs清零
+// 调用者需要持有slk, 负责写回inode
+void extent_free(inode_t* ip)
+{
+    extent_header_t* ih = EXT_HEADER(ip);
+    extent_t* ext = EXT_ENTRY(ih);
+
+    for(int i = 0; i < ih->count; i++) {
+        if(ih->depth == 0) {
+            for(uint32 j = 0; j < ext[i].len; j++)
+                bitmap_free_block(ext[i].pblock + j);
+            continue;
+        }
+        buf_t* buf = buf_read(ext[i].pblock);
+        extent_header_t* lh = (extent_header_t*)buf->data;
+        for(int k = 0; k < lh->count; k++)
+            for(uint32 j = 0; j < EXT_ENTRY(lh)[k].len; j++)
+                bitmap_free_block(EXT_ENTRY(lh)[k].pblock + j);
+        buf_release(buf);
+        bitmap_free_block(ext[i].pblock);
+    }
+
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+}
+
+// 输出extent
+// for debug
+void extent_print(inode_t* ip)
+{
+    extent_header_t* ih = EXT_HEADER(ip);
+    extent_t* ext = EXT_ENTRY(ih);
+
+    printf("extents: depth = %d count = %d\n", ih->depth, ih->count);
+    for(int i = 0; i < ih->count; i++) {
+        if(ih->depth == 0) {
+            printf("  [%d, %d) -> %d\n", ext[i].lblock, ext[i].lblock + ext[i].len, ext[i].pblock);
+            continue;
+        }
+        printf("  leaf %d from %d\n", ext[i].pblock, ext[i].lblock);
+    }
+}
@@ -0,0 +1,126 @@
+#include "fs/fdtable.h"
+#include "fs/file.h"
+#include "fs/log.h"
+#include "mem/pmem.h"
+#include "lib/print.h"
+#include "lib/str.h"
+
+// w中最低的0位 (调用者保证w不全为1)
+static int fd_lowest_zero(uint64 w)
+{
+    int bit = 0;
+
+    w = ~w;
+    if((w & 0xFFFFFFFFul) == 0) { w >>= 32; bit += 32; }
+    if((w & 0xFFFFul) == 0)     { w >>= 16; bit += 16; }
+    if((w & 0xFFul) == 0)       { w >>= 8;  bit += 8;  }
+    if((w & 0xFul) == 0)        { w >>= 4;  bit += 4;  }
+    if((w & 0x3ul) == 0)        { w >>= 2;  bit += 2;  }
+    if((w & 0x1ul) == 0)        { bit += 1; }
+    return bit;
+}
+
+static bool fd_used(fdtable_t* fdt, int fd)
+{
+    return (fdt->used[fd / 64] >> (fd % 64)) & 1;
+}
+
+// 换成FD_MAX项的扩展页, 搬过去已有的项
+// 成功返回0 失败返回-1
+static int fdtable_grow(fdtable_t* fdt)
+{
+    if(fdt->size == FD_MAX)
+        return -1;
+
+    file_t** files = (file_t**)pmem_alloc(true);
+    if(files == NULL)
+        return -1;
+    memmove(files, fdt->inline_files, sizeof(fdt->inline_files));
+    fdt->files = files;
+    fdt->size = FD_MAX;
+    return 0;
+}
+
+// 初始化为空的内嵌表
+void fdtable_init(fdtable_t* fdt)
+{
+    fdt->files = fdt->inline_files;
+    fdt->size = FD_INLINE;
+    fdt->nopen = 0;
+    memset(fdt->used, 0, sizeof(fdt->used));
+    memset(fdt->inline_files, 0, sizeof(fdt->inline_files));
+}
+
+// 把file放到fd处 (fd必须空闲), 表不够大时扩展
+// 成功返回0 失败返回-1
+int fdtable_install(fdtable_t* fdt, int fd, file_t* file)
+{
+    if(fd < 0 || fd >= FD_MAX || fd_used(fdt, fd))
+        return -1;
+    if(fd >= fdt->size && fdtable_grow(fdt) < 0)
+        return -1;
+
+    fdt->files[fd] = file;
+    fdt->used[fd / 64] |= 1ul << (fd % 64);
+    fdt->nopen++;
+    return 0;
+}
+
+// 把file放到最小的空闲fd处
+// 成功返回fd 失败返回-1
+int fdtable_alloc(fdtable_t* fdt, file_t* file)
+{
+    if(fdt->nopen == FD_MAX)
+        return -1;
+
+    for(int i = 0; i < FD_WORDS; i++) {
+        if(fdt->used[i] != ~0ul) {
+            int fd = i * 64 + fd_lowest_zero(fdt->used[i]);
+            return fdtable_install(fdt, fd, file) < 0 ? -1 : fd;
+        }
+    }
+    return -1;
+}
+
+// fd对应的file, 没有则返回NULL
+file_t* fdtable_get(fdtable_t* fdt, int fd)
+{
+    if(fd < 0 || fd >= fdt->size)
+        return NULL;
+    return fdt->files[fd];
+}
+
+// 从表里取下fd对应的file (不关闭, 引用交给调用者)
+// 没有则返回NULL
+file_t* fdtable_remove(fdtable_t* fdt, int fd)
+{
+    file_t* file = fdtable_get(fdt, fd);
+    if(file == NULL)
+        return NULL;
+
+    fdt->files[fd] = NULL;
+    fdt->used[fd / 64] &= ~(1ul << (fd % 64));
+    fdt->nopen--;
+    return file;
+}
+
+// 关闭所有打开的文件, 归还扩展页, 恢复为空的内嵌表
+// 最后一次关闭可能刷盘或删除inode, 和sys_close一样每个文件各占一个日志操作
+// 调用者不能处于日志操作中
+void fdtable_close_all(fdtable_t* fdt)
+{
+    for(int i = 0; i < FD_WORDS; i++) {
+        while(fdt->used[i] != 0) {
+            int fd = i * 64 + fd_lowest_zero(~fdt->used[i]);
+            file_t* file = fdtable_remove(fdt, fd);
+            log_begin_op();
+            file_close(file);
+            log_end_op();
+        }
+    }
+    assert(fdt->nopen == 0, "fdtable_close_all: nopen");
+
+    if(fdt->files != fdt->inline_files)
+        pmem_free((uint64)fdt->files, true);
+    fdtable_init(fdt);
+}
@@ -4,55 +4,49 @@
 #include "fs/bitmap.h"
 #include "fs/inode.h"
 #include "fs/file.h"
+#include "fs/pcache.h"
+#include "fs/log.h"
 #include "mem/vmem.h"
+#include "mem/slab.h"
 #include "proc/cpu.h"
 #include "lib/print.h"
+#include "lib/str.h"
 
 // 设备列表(读写接口)
 dev_t devlist[N_DEV];
 
-// ftable + 保护它的锁
-#define N_FILE 32
-file_t ftable[N_FILE];
-spinlock_t lk_ftable;
+/*
+    file_t 从slab分配, 打开的文件数只受内核内存限制
+    引用计数用原子操作维护: file_dup / file_close 不需要全局锁,
+    只有分配和最后一次关闭 (把file_t还给slab) 会拿slab自己的锁
+*/
+static slab_cache_t file_cache;
 
-// ftable初始化 + devlist初始化
+// file_cache初始化 + devlist初始化
 void file_init()
 {
-    spinlock_init(&lk_ftable, "ftable");
-    for(int i = 0; i < N_FILE; i++) {
-        ftable[i].ref = 0;
-        ftable[i].type = FD_UNUSED;
-    }
+    slab_cache_init(&file_cache, "file", sizeof(file_t));
     for(int i = 0; i < N_DEV; i++) {
         devlist[i].read = NULL;
         devlist[i].write = NULL;
     }
 }
 
-// alloc file_t in ftable
-// 失败则panic
+// 分配并清空一个file_t, 引用数为1
+// 内核内存耗尽时返回NULL
 file_t* file_alloc()
 {
-    spinlock_acquire(&lk_ftable);
-    for(int i = 0; i < N_FILE; i++) {
-        if(ftable[i].ref == 0) {
-            ftable[i].ref = 1;
-            ftable[i].type = FD_UNUSED;
-            ftable[i].readable = false;
-            ftable[i].writable = false;
-            ftable[i].offset = 0;
-            ftable[i].ip = NULL;
-            spinlock_release(&lk_ftable);
-            return &ftable[i];
-        }
-    }
-    spinlock_release(&lk_ftable);
-    panic("file_alloc: no free file");
-    return NULL;
+    file_t* file = slab_alloc(&file_cache);
+    if(file == NULL)
+        return NULL;
+    memset(file, 0, sizeof(file_t));
+    file->type = FD_UNUSED;
+    file->ref = 1;
+    return file;
 }
 
 // 创建设备文件(供proczero创建console)
+// 调用者需在日志操作内
 file_t* file_create_dev(char* path, uint16 major, uint16 minor)
 {
     // 创建设备文件inode
@@ -62,6 +56,10 @@ file_t* file_create_dev(char* path, uint16 major, uint16 minor)
     
     // 分配file
     file_t* file = file_alloc();
+    if(file == NULL) {
+        inode_free(ip);
+        return NULL;
+    }
     file->type = FD_DEVICE;
     file->readable = true;
     file->writable = true;
@@ -91,6 +89,10 @@ file_t* file_open(char* path, uint32 open_mode)
     
     // 分配file
     file = file_alloc();
+    if(file == NULL) {
+        inode_unlock_free(ip);
+        return NULL;
+    }
     
     // 根据inode类型设置file类型
     if(ip->type == FT_DIR) {
@@ -112,27 +114,27 @@ file_t* file_open(char* path, uint32 open_mode)
 }
 
 // 释放一个file
+// 最后一个引用负责释放inode或关闭管道的一端, 然后把file_t还给slab
 void file_close(file_t* file)
 {
-    spinlock_acquire(&lk_ftable);
-    
-    if(file->ref < 1)
+    uint32 old = __atomic_fetch_sub(&file->ref, 1, __ATOMIC_ACQ_REL);
+    if(old < 1)
         panic("file_close: ref < 1");
-    
-    file->ref--;
-    
-    if(file->ref == 0) {
-        // 最后一个引用，释放inode
-        inode_t* ip = file->ip;
-        file->type = FD_UNUSED;
-        file->ip = NULL;
-        spinlock_release(&lk_ftable);
-        
-        if(ip != NULL) {
-            inode_free(ip);
-        }
-    } else {
-        spinlock_release(&lk_ftable);
+    if(old > 1)
+        return;
+
+    // 已经没有其他引用, 不会再有人访问file
+    inode_t* ip = file->ip;
+    pipe_t* pi = file->pipe;
+    bool writable = file->writable;
+    file->type = FD_UNUSED;
+    slab_free(&file_cache, file);
+
+    if(ip != NULL) {
+        inode_free(ip);
+    }
+    if(pi != NULL) {
+        pipe_close(pi, writable);
     }
 }
 
@@ -150,9 +152,13 @@ uint32 file_read(file_t* file, uint32 len, uint64 dst, bool user)
         if(file->major < N_DEV && devlist[file->major].read != NULL) {
             ret = devlist[file->major].read(len, dst, user);
         }
+    } else if(file->type == FD_PIPE) {
+        ret = pipe_read(file->pipe, len, dst, user);
     } else if(file->type == FD_FILE || file->type == FD_DIR) {
         // 普通文件或目录
         inode_lock(file->ip);
+        if(file->type == FD_FILE)
+            inode_readahead(file->ip, &file->ra, file->offset, len);
         ret = inode_read_data(file->ip, file->offset, len, (void*)dst, user);
         file->offset += ret;
         inode_unlock(file->ip);
@@ -175,17 +181,293 @@ uint32 file_write(file_t* file, uint32 len, uint64 src, bool user)
         if(file->major < N_DEV && devlist[file->major].write != NULL) {
             ret = devlist[file->major].write(len, src, user);
         }
+    } else if(file->type == FD_PIPE) {
+        ret = pipe_write(file->pipe, len, src, user);
     } else if(file->type == FD_FILE) {
         // 普通文件
+        // 分段写入, 每段是一个日志操作, 避免单个操作超出日志容量
+        while(ret < len) {
+            uint32 n = len - ret;
+            if(n > LOG_WRITE_MAX)
+                n = LOG_WRITE_MAX;
+
+            log_begin_op();
+            inode_lock(file->ip);
+            uint32 cnt = inode_write_data(file->ip, file->offset, n, (void*)(src + ret), user);
+            file->offset += cnt;
+            inode_unlock(file->ip);
+            log_end_op();
+
+            ret += cnt;
+            if(cnt != n)
+                break;
+        }
+    }
+    
+    return ret;
+}
+
+// splice的actor: 把管道槽里的数据写入文件
+static uint32 splice_actor(void* ctx, uint64 kaddr, uint32 n)
+{
+    return file_write((file_t*)ctx, n, kaddr, false);
+}
+
+/*
+    在管道和文件之间移动最多len字节, 不经过用户态缓冲区
+    in是管道: 数据从管道的槽直接写入out (普通文件 设备或另一个管道)
+    in是普通文件且out是管道: 页缓存的页直接放进管道, 不拷贝数据
+    返回移动的字节数, 参数不合法返回-1
+*/
+int file_splice(file_t* in, file_t* out, uint32 len)
+{
+    if(!in->readable || !out->writable)
+        return -1;
+
+    if(in->type == FD_PIPE) {
+        if(out->type == FD_DIR || (out->type == FD_PIPE && out->pipe == in->pipe))
+            return -1;
+        return pipe_drain(in->pipe, len, splice_actor, out);
+    }
+    if(in->type == FD_FILE && out->type == FD_PIPE)
+        return pipe_splice_in(out->pipe, in, len);
+
+    return -1;
+}
+
+// 把管道in里最多len字节复制到管道out, 不消费in的数据
+// 返回复制的字节数, 参数不合法返回-1
+int file_tee(file_t* in, file_t* out, uint32 len)
+{
+    if(!in->readable || !out->writable)
+        return -1;
+    if(in->type != FD_PIPE || out->type != FD_PIPE || in->pipe == out->pipe)
+        return -1;
+    return pipe_tee(in->pipe, out->pipe, len);
+}
+
+/*
+    把普通文件in从当前偏移开始的最多len字节写入out (普通文件 设备或管道)
+    数据直接从页缓存的页写出, 不经过用户态缓冲区; 读取时页被钉住, 不持有in的inode锁
+    返回写入的字节数, 参数不合法返回-1
+*/
+int file_sendfile(file_t* out, file_t* in, uint32 len)
+{
+    if(!in->readable || in->type != FD_FILE || !out->writable || out->type == FD_DIR)
+        return -1;
+
+    inode_t* ip = in->ip;
+    uint32 ret = 0;
+
+    while(ret < len) {
+        inode_lock(ip);
+        uint32 off = in->offset;
+        if(off >= ip->size) {
+            inode_unlock(ip);
+            break;
+        }
+        uint32 n = len - ret;
+        if(n > ip->size - off)
+            n = ip->size - off;
+
+        uint32 cnt;
+        if(ip->flags & INODE_F_INLINE) {
+            char tmp[INODE_INLINE_MAX];
+            n = inode_read_data(ip, off, n, tmp, false);
+            inode_unlock(ip);
+            cnt = file_write(out, n, (uint64)tmp, false);
+        } else {
+            inode_readahead(ip, &in->ra, off, n);
+            if(n > PGSIZE - off % PGSIZE)
+                n = PGSIZE - off % PGSIZE;
+            page_t* pg = pcache_get(ip, off / PGSIZE, true);
+            inode_unlock(ip);
+            if(pg == NULL)
+                break;
+            cnt = file_write(out, n, pg->pa + off % PGSIZE, false);
+            pcache_put(pg, false);
+        }
+
+        in->offset += cnt;
+        ret += cnt;
+        if(cnt != n)
+            break;
+    }
+    return ret;
+}
+
+// readv读管道的actor: 依次填满用户态的各段缓冲区
+typedef struct iov_ctx {
+    iovec_t* iov;
+    uint32 cnt;
+    uint32 idx;     // 当前段
+    uint32 done;    // 当前段已经填了多少字节
+} iov_ctx_t;
+
+static uint32 iov_actor(void* ctx, uint64 kaddr, uint32 n)
+{
+    iov_ctx_t* c = (iov_ctx_t*)ctx;
+    uint32 ret = 0;
+
+    while(ret < n && c->idx < c->cnt) {
+        iovec_t* v = &c->iov[c->idx];
+        uint32 m = v->len - c->done;
+        if(m > n - ret)
+            m = n - ret;
+        uvm_copyout(myproc()->pgtbl, v->base + c->done, kaddr + ret, m);
+        ret += m;
+        c->done += m;
+        if(c->done == v->len) {
+            c->idx++;
+            c->done = 0;
+        }
+    }
+    return ret;
+}
+
+/*
+    把文件内容依次读进用户态的cnt段缓冲区iov (readv / pread)
+    offset指向读取位置: &file->offset 时读完更新文件偏移, 否则是pread的局部偏移
+    普通文件和目录只加一次inode锁; 管道只等待一次数据, 有多少读多少
+    设备逐段读取, 某段没读满就停止
+    返回读取的总字节数
+*/
+uint32 file_readv(file_t* file, iovec_t* iov, uint32 cnt, uint32* offset)
+{
+    if(!file->readable)
+        return 0;
+
+    uint32 ret = 0, total = 0;
+    for(uint32 i = 0; i < cnt; i++)
+        total += iov[i].len;
+
+    if(file->type == FD_FILE || file->type == FD_DIR) {
         inode_lock(file->ip);
-        ret = inode_write_data(file->ip, file->offset, len, (void*)src, user);
-        file->offset += ret;
+        if(file->type == FD_FILE && offset == &file->offset)
+            inode_readahead(file->ip, &file->ra, *offset, total);
+        for(uint32 i = 0; i < cnt; i++) {
+            uint32 n = inode_read_data(file->ip, *offset, iov[i].len, (void*)iov[i].base, true);
+            *offset += n;
+            ret += n;
+            if(n != iov[i].len)
+                break;
+        }
         inode_unlock(file->ip);
+    } else if(file->type == FD_PIPE) {
+        iov_ctx_t ctx = { .iov = iov, .cnt = cnt, .idx = 0, .done = 0 };
+        ret = pipe_drain(file->pipe, total, iov_actor, &ctx);
+    } else {
+        for(uint32 i = 0; i < cnt; i++) {
+            uint32 n = file_read(file, iov[i].len, iov[i].base, true);
+            ret += n;
+            if(n != iov[i].len)
+                break;
+        }
+    }
+    return ret;
+}
+
+/*
+    把用户态的cnt段缓冲区iov依次写入文件 (writev / pwrite)
+    offset的含义同file_readv
+    普通文件: 尽量多的段放进同一个日志操作, 只加一次inode锁
+              一个日志操作最多写LOG_WRITE_MAX字节, 超出时在段中间拆开
+    管道和设备逐段写入
+    返回写入的总字节数
+*/
+uint32 file_writev(file_t* file, iovec_t* iov, uint32 cnt, uint32* offset)
+{
+    if(!file->writable)
+        return 0;
+
+    uint32 ret = 0;
+
+    if(file->type != FD_FILE) {
+        for(uint32 i = 0; i < cnt; i++) {
+            uint32 n = file_write(file, iov[i].len, iov[i].base, true);
+            ret += n;
+            if(n != iov[i].len)
+                break;
+        }
+        return ret;
+    }
+
+    uint32 i = 0, done = 0;
+    bool fail = false;
+    while(i < cnt && !fail) {
+        log_begin_op();
+        inode_lock(file->ip);
+        for(uint32 batch = 0; i < cnt && batch < LOG_WRITE_MAX; ) {
+            uint32 n = iov[i].len - done;
+            if(n > LOG_WRITE_MAX - batch)
+                n = LOG_WRITE_MAX - batch;
+            uint32 m = inode_write_data(file->ip, *offset, n, (void*)(iov[i].base + done), true);
+            *offset += m;
+            batch += m;
+            ret += m;
+            if(m != n) {
+                fail = true;
+                break;
+            }
+            done += m;
+            if(done == iov[i].len) {
+                i++;
+                done = 0;
+            }
+        }
+        inode_unlock(file->ip);
+        log_end_op();
     }
-    
     return ret;
 }
 
+// 为普通文件的[offset, offset + len)预先分配磁盘空间, 不改变文件大小
+// 分段进行, 每段是一个日志操作
+// 成功返回0 失败返回-1 (失败时前面的段可能已经分配)
+int file_fallocate(file_t* file, uint32 offset, uint32 len)
+{
+    if(!file->writable || file->type != FD_FILE)
+        return -1;
+
+    uint32 done = 0;
+    while(done < len) {
+        uint32 n = len - done;
+        if(n > LOG_FALLOC_MAX)
+            n = LOG_FALLOC_MAX;
+
+        log_begin_op();
+        inode_lock(file->ip);
+        int ret = inode_fallocate(file->ip, offset + done, n);
+        inode_unlock(file->ip);
+        log_end_op();
+
+        if(ret < 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// 把文件的脏页和脏inode写回磁盘
+// wait = true 时等待日志提交后返回; false 由调用者稍后调用log_sync (合并多次fsync)
+// 成功返回0 失败返回-1
+int file_fsync(file_t* file, bool wait)
+{
+    if(file->type != FD_FILE && file->type != FD_DIR)
+        return -1;
+
+    log_begin_op();
+    inode_lock(file->ip);
+    pcache_flush(file->ip);
+    inode_sync(file->ip);
+    inode_unlock(file->ip);
+    log_end_op();
+
+    if(wait)
+        log_sync();
+    return 0;
+}
+
 // flags 可能取值
 #define LSEEK_SET 0  // file->offset = offset
 #define LSEEK_ADD 1  // file->offset += offset
@@ -217,13 +499,11 @@ uint32 file_lseek(file_t* file, uint32 offset, int flags)
     return file->offset;
 }
 
-// file->ref++ with lock
+// file->ref++ (原子操作, 调用者必须已经持有一个引用)
 file_t* file_dup(file_t* file)
 {
-    spinlock_acquire(&lk_ftable);
-    assert(file->ref > 0, "file_dup: ref");
-    file->ref++;
-    spinlock_release(&lk_ftable);
+    uint32 old = __atomic_fetch_add(&file->ref, 1, __ATOMIC_RELAXED);
+    assert(old > 0, "file_dup: ref");
     return file;
 }
 
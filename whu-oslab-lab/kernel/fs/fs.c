@@ -3,6 +3,10 @@
 #include "fs/bitmap.h"
 #include "fs/inode.h"
 #include "fs/dir.h"
+#include "fs/log.h"
+#include "fs/dcache.h"
+#include "fs/pipe.h"
+#include "fs/file.h"
 #include "lib/str.h"
 #include "lib/print.h"
 
@@ -25,6 +29,8 @@ static void sb_print()
     printf("inode start = %d\n", sb.inode_start);
     printf("data bitmap start = %d\n", sb.data_bitmap_start);
     printf("data start = %d\n", sb.data_start);
+    printf("log start = %d, log blocks = %d\n", sb.log_start, sb.log_blocks);
+    printf("features = %x\n", sb.features);
 }
 
 // 测试用的辅助数据
@@ -44,15 +50,27 @@ static bool blockcmp(uint8* a, uint8* b)
 void fs_init()
 {
     buf_init();
+    pcache_init();
+    dcache_init();
+    file_init();
+    pipe_init();
 
     buf_t* buf; 
     buf = buf_read(SB_BLOCK_NUM);
     memmove(&sb, buf->data, sizeof(sb));
     assert(sb.magic == FS_MAGIC, "fs_init: magic");
-    assert(sb.block_size == BLOCK_SIZE, "fs_init: block size");
+    // block大小在编译时确定, 与镜像不一致时必须用相同的BLOCK_SIZE重新生成fs.img
+    if(sb.block_size != BLOCK_SIZE) {
+        printf("fs_init: image block size %d, kernel block size %d\n", sb.block_size, BLOCK_SIZE);
+        panic("fs_init: block size mismatch");
+    }
     buf_release(buf);
     sb_print();
 
+    // 重做上次已提交但未写回的日志
+    log_init(sb.log_start, sb.log_blocks);
+    bitmap_init();
+
     // ========== inode读写测试开始 ==========
     printf("\n========== INODE READ/WRITE TEST ==========\n");
     
@@ -64,6 +82,7 @@ void fs_init()
         str[i] = (uint8)i;
 
     // 创建新的inode
+    log_begin_op();
     inode_t* nip = inode_create(FT_FILE, 0, 0);
     inode_lock(nip);
     
@@ -91,6 +110,10 @@ void fs_init()
     inode_print(nip);
     
     inode_unlock_free(nip);
+    log_end_op();
+    log_print();
+    bitmap_stat_print();
+    inode_stat_print();
 
     // 测试结果
     printf("\n========== TEST RESULT ==========\n");
@@ -2,31 +2,235 @@
 #include "fs/bitmap.h"
 #include "fs/inode.h"
 #include "fs/fs.h"
+#include "fs/pcache.h"
+#include "fs/log.h"
+#include "fs/dcache.h"
+#include "fs/extent.h"
 #include "mem/vmem.h"
+#include "mem/pmem.h"
 #include "proc/cpu.h"
 #include "lib/print.h"
 #include "lib/str.h"
 
 extern super_block_t sb;
 
-// 内存中的inode资源 + 保护它的锁
-#define N_INODE 32
-static inode_t icache[N_INODE];
+/*
+    内存中的inode (icache)
+    按inode_num挂在hash桶的单链表上, 桶锁保护链表和桶内inode的ref
+    ref == 0 但仍然有效的inode挂在LRU链表上, 再次打开时无需从磁盘读入
+    空闲inode串在free_list上, 用完时从内核申请物理页切分 (最多N_ICACHE_PAGE页)
+    达到上限后淘汰LRU尾部的inode
+    lk_icache 保护: LRU链表 + free_list + 统计
+    锁顺序: 桶锁 -> lk_icache
+*/
+
+typedef struct icache_bucket {
+    spinlock_t lk;
+    inode_t* head;
+} icache_bucket_t;
+
+static icache_bucket_t ihash[N_ICACHE_HASH];
+static inode_t lru_head;    // ->next 最近释放 ->prev 最久未用
+static inode_t* free_list;  // 空闲inode (用hnext串联)
 static spinlock_t lk_icache;
 
+// 已申请的物理页数 + 统计
+static uint32 n_pages;
+static uint32 stat_reuse, stat_miss, stat_evict, stat_coalesce;
+
 // icache初始化
 void inode_init()
 {
     spinlock_init(&lk_icache, "icache");
-    for(int i = 0; i < N_INODE; i++) {
-        sleeplock_init(&icache[i].slk, "inode");
+    for(int i = 0; i < N_ICACHE_HASH; i++) {
+        spinlock_init(&ihash[i].lk, "icache_bucket");
+        ihash[i].head = NULL;
+    }
+    lru_head.next = &lru_head;
+    lru_head.prev = &lru_head;
+    free_list = NULL;
+    n_pages = 0;
+}
+
+static inline icache_bucket_t* inode_bucket(uint16 inode_num)
+{
+    return &ihash[inode_num % N_ICACHE_HASH];
+}
+
+// 以下两个函数需持有lk_icache
+static void lru_remove(inode_t* ip)
+{
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+    ip->next = ip->prev = NULL;
+}
+
+static void lru_push_head(inode_t* ip)
+{
+    ip->prev = &lru_head;
+    ip->next = lru_head.next;
+    lru_head.next->prev = ip;
+    lru_head.next = ip;
+}
+
+// 在桶里查找 (调用者持有桶锁)
+static inode_t* bucket_find(icache_bucket_t* b, uint16 inode_num)
+{
+    for(inode_t* ip = b->head; ip != NULL; ip = ip->hnext)
+        if(ip->inode_num == inode_num)
+            return ip;
+    return NULL;
+}
+
+// 从桶里摘下 (调用者持有桶锁)
+static void bucket_remove(icache_bucket_t* b, inode_t* ip)
+{
+    inode_t** pp = &b->head;
+    while(*pp != ip)
+        pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+    ip->hnext = NULL;
+}
+
+// ref++, 从LRU里复活 (调用者持有桶锁)
+static void inode_get(inode_t* ip)
+{
+    if(ip->ref++ == 0) {
+        spinlock_acquire(&lk_icache);
+        lru_remove(ip);
+        stat_reuse++;
+        spinlock_release(&lk_icache);
+    }
+}
+
+// 申请一页内存切分成inode放入free_list (调用者持有lk_icache)
+// 达到上限或内存不足返回false
+static bool icache_grow()
+{
+    if(n_pages == N_ICACHE_PAGE)
+        return false;
+    inode_t* arr = (inode_t*)pmem_alloc(true);
+    if(arr == NULL)
+        return false;
+    n_pages++;
+    for(int i = 0; i < ICACHE_PER_PAGE; i++) {
+        sleeplock_init(&arr[i].slk, "inode");
+        arr[i].hnext = free_list;
+        free_list = &arr[i];
     }
+    return true;
+}
+
+// 获得一个不在任何桶里的空闲inode
+// 优先free_list, 其次扩容, 最后淘汰LRU尾部 (丢弃它的页缓存)
+static inode_t* icache_get_free()
+{
+    inode_t* ip;
+
+    while(1) {
+        spinlock_acquire(&lk_icache);
+        if(free_list == NULL)
+            icache_grow();
+        if(free_list != NULL) {
+            ip = free_list;
+            free_list = ip->hnext;
+            ip->hnext = NULL;
+            stat_miss++;
+            spinlock_release(&lk_icache);
+            return ip;
+        }
+
+        ip = lru_head.prev;
+        if(ip == &lru_head)
+            panic("inode_alloc: no free inode");
+        uint16 inode_num = ip->inode_num;
+        spinlock_release(&lk_icache);
+
+        // 按锁顺序重新上锁, 期间它可能被复活或释放, 需要再次确认
+        icache_bucket_t* b = inode_bucket(inode_num);
+        spinlock_acquire(&b->lk);
+        spinlock_acquire(&lk_icache);
+        bool ok = (ip->inode_num == inode_num && ip->ref == 0 && ip->next != NULL);
+        if(ok) {
+            lru_remove(ip);
+            stat_evict++;
+            stat_miss++;
+        }
+        spinlock_release(&lk_icache);
+        if(ok)
+            bucket_remove(b, ip);
+        spinlock_release(&b->lk);
+
+        if(!ok)
+            continue;
+        assert(!ip->dirty, "icache_get_free: dirty inode in lru");
+
+        // 脏页已在inode_free时写回, 这里直接丢弃
+        // 已经不在桶里, 没有其他人能找到它
+        if(ip->pages != NULL) {
+            sleeplock_acquire(&ip->slk);
+            pcache_drop(ip);
+            sleeplock_release(&ip->slk);
+        }
+        return ip;
+    }
+}
+
+// 归还空闲inode
+static void icache_put_free(inode_t* ip)
+{
+    spinlock_acquire(&lk_icache);
+    ip->hnext = free_list;
+    free_list = ip;
+    spinlock_release(&lk_icache);
 }
 
 /*---------------------- 与inode本身相关 -------------------*/
 
+/*
+    脏inode: 只有size变化(写入数据)时不立即写回, 标记为dirty并保存一份快照
+    在最后一次关闭 / fsync时写回, 或者同一block里的其他inode写回时顺带写入快照
+    快照由持有slk的人生成, 因此总是一致的, 顺带写入时不需要对方的slk
+    dirty和快照由inode所在的hash桶锁保护
+    分配block等其他元数据变化仍然立即写回, 与bitmap的修改在同一个日志操作里
+*/
+
+// 标记ip为脏 (调用者持有slk)
+void inode_mark_dirty(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_mark_dirty: not holding lock");
+
+    icache_bucket_t* b = inode_bucket(ip->inode_num);
+    spinlock_acquire(&b->lk);
+    memmove(ip->snap, &ip->type, INODE_DISK_SIZE);
+    ip->dirty = true;
+    spinlock_release(&b->lk);
+}
+
+// 把同一block里其他脏inode的快照写入buf (调用者持有buf的睡眠锁)
+static void inode_coalesce(buf_t* buf, uint16 self)
+{
+    uint16 first = self - self % INODE_PER_BLOCK;
+
+    for(uint16 num = first; num < first + INODE_PER_BLOCK; num++) {
+        if(num == self)
+            continue;
+        icache_bucket_t* b = inode_bucket(num);
+        spinlock_acquire(&b->lk);
+        inode_t* ip = bucket_find(b, num);
+        if(ip != NULL && ip->dirty) {
+            memmove(buf->data + (num % INODE_PER_BLOCK) * INODE_DISK_SIZE, ip->snap, INODE_DISK_SIZE);
+            ip->dirty = false;
+            spinlock_acquire(&lk_icache);
+            stat_coalesce++;
+            spinlock_release(&lk_icache);
+        }
+        spinlock_release(&b->lk);
+    }
+}
+
 // 使用磁盘里的inode更新内存里的inode (write = false)
-// 或 使用内存里的inode更新磁盘里的inode (write = true)
+// 或 使用内存里的inode更新磁盘里的inode (write = true, 同一block里的脏inode一起写入)
 // 调用者需要设置inode_num并持有睡眠锁
 void inode_rw(inode_t* ip, bool write)
 {
@@ -42,7 +246,13 @@ void inode_rw(inode_t* ip, bool write)
     if(write) {
         // 内存 -> 磁盘
         memmove(dip, &ip->type, INODE_DISK_SIZE);
-        buf_write(buf);
+        inode_coalesce(buf, ip->inode_num);
+        log_write(buf);
+
+        icache_bucket_t* b = inode_bucket(ip->inode_num);
+        spinlock_acquire(&b->lk);
+        ip->dirty = false;
+        spinlock_release(&b->lk);
     } else {
         // 磁盘 -> 内存
         memmove(&ip->type, dip, INODE_DISK_SIZE);
@@ -50,36 +260,44 @@ void inode_rw(inode_t* ip, bool write)
     buf_release(buf);
 }
 
-// 在icache里查询inode
+// 在icache里查询inode (包括LRU里未被引用的inode, 它们的元数据仍然有效)
 // 如果没有查询到则申请一个空闲inode
-// 如果icache没有空闲inode则报错
+// 如果icache没有空闲inode且无法淘汰则报错
 // 注意: 获得的inode没有上锁
 inode_t* inode_alloc(uint16 inode_num)
 {    
-    inode_t* empty = NULL;
-    
-    spinlock_acquire(&lk_icache);
-    
-    // 查找已缓存的inode
-    for(int i = 0; i < N_INODE; i++) {
-        if(icache[i].ref > 0 && icache[i].inode_num == inode_num) {
-            icache[i].ref++;
-            spinlock_release(&lk_icache);
-            return &icache[i];
-        }
-        if(empty == NULL && icache[i].ref == 0)
-            empty = &icache[i];
+    icache_bucket_t* b = inode_bucket(inode_num);
+    inode_t* ip;
+
+    spinlock_acquire(&b->lk);
+    ip = bucket_find(b, inode_num);
+    if(ip != NULL) {
+        inode_get(ip);
+        spinlock_release(&b->lk);
+        return ip;
     }
-    
-    // 分配新的inode缓存位置
-    if(empty == NULL)
-        panic("inode_alloc: no free inode");
-    
+    spinlock_release(&b->lk);
+
+    // 申请空闲inode可能睡眠 (淘汰时丢弃页缓存), 不能持有桶锁
+    inode_t* empty = icache_get_free();
+
+    // 放锁期间其他人可能已经插入了同一个inode
+    spinlock_acquire(&b->lk);
+    ip = bucket_find(b, inode_num);
+    if(ip != NULL) {
+        inode_get(ip);
+        spinlock_release(&b->lk);
+        icache_put_free(empty);
+        return ip;
+    }
+
     empty->inode_num = inode_num;
     empty->ref = 1;
     empty->valid = false;
-    
-    spinlock_release(&lk_icache);
+    empty->hnext = b->head;
+    b->head = empty;
+    spinlock_release(&b->lk);
+
     return empty;
 }
 
@@ -89,6 +307,10 @@ inode_t* inode_alloc(uint16 inode_num)
 // 注意: 获得的inode没有上锁
 inode_t* inode_create(uint16 type, uint16 major, uint16 minor)
 {
+    // 目录的第一个block先预留空间
+    if(type == FT_DIR && !bitmap_reserve_blocks(DALLOC_RESERVE(1)))
+        return NULL;
+
     // 在磁盘申请inode
     uint16 inode_num = bitmap_alloc_inode();
     
@@ -98,6 +320,11 @@ inode_t* inode_create(uint16 type, uint16 major, uint16 minor)
     // 上锁并初始化
     inode_lock(ip);
     ip->type = type;
+    ip->flags = 0;
+    if((sb.features & FS_FEAT_INLINE) && type == FT_FILE)
+        ip->flags |= INODE_F_INLINE;
+    else if((sb.features & FS_FEAT_EXTENT) && type != FT_DEVICE)
+        ip->flags |= INODE_F_EXTENT;
     ip->major = major;
     ip->minor = minor;
     ip->nlink = 1;
@@ -110,9 +337,14 @@ inode_t* inode_create(uint16 type, uint16 major, uint16 minor)
     
     // 如果是目录，创建.和..  
     if(type == FT_DIR) {
-        // 分配一个数据块
-        ip->addrs[0] = bitmap_alloc_block();
-        ip->size = 0;  // dir_add_entry会更新size
+        // 分配一个数据块 (清零, 避免残留的旧目录项)
+        inode_prealloc(ip, 1);
+        buf_t* buf = buf_read(inode_locate_block(ip, 0));
+        inode_prealloc_end(ip);
+        memset(buf->data, 0, BLOCK_SIZE);
+        log_write(buf);
+        buf_release(buf);
+        ip->size = BLOCK_SIZE;  // 线性目录, 放满后由dir_add_entry转换成索引目录
         inode_rw(ip, true);
     }
     
@@ -122,12 +354,14 @@ inode_t* inode_create(uint16 type, uint16 major, uint16 minor)
 
 // 供inode_free调用
 // 在磁盘上删除一个inode及其管理的文件 (修改inode bitmap + block bitmap)
-// 调用者需要持有lk_icache, 但不应该持有slk
+// 调用者需要持有slk
 static void inode_destroy(inode_t* ip)
 {
-    sleeplock_acquire(&ip->slk);
-    
-    // 释放数据块
+    // 目录下的目录项缓存失效
+    if(ip->type == FT_DIR)
+        dcache_purge(ip->inode_num);
+
+    // 释放数据块 (同时丢弃页缓存)
     inode_free_data(ip);
     
     // 清除磁盘inode
@@ -137,32 +371,79 @@ static void inode_destroy(inode_t* ip)
     // 释放bitmap
     bitmap_free_inode(ip->inode_num);
     
-    sleeplock_release(&ip->slk);
     ip->valid = false;
 }
 
 // 向icache里归还inode
 // inode->ref--
+// 最后一个引用: 无链接则销毁inode, 否则把页缓存里的脏页写回磁盘
+// 之后仍然有效的inode进入LRU (保留元数据和页缓存), 无效的直接回到free_list
 // 调用者不应该持有slk
 void inode_free(inode_t* ip)
 {
-    spinlock_acquire(&lk_icache);
+    icache_bucket_t* b = inode_bucket(ip->inode_num);
+
+    spinlock_acquire(&b->lk);
     
-    if(ip->ref == 1 && ip->valid && ip->nlink == 0) {
-        // 最后一个引用且无链接，销毁inode
-        inode_destroy(ip);
+    if(ip->ref == 1 && ip->valid) {
+        // ref == 1 说明没有其他人持有睡眠锁, 这里不会睡眠
+        sleeplock_acquire(&ip->slk);
+        spinlock_release(&b->lk);
+
+        if(ip->nlink == 0) {
+            inode_destroy(ip);
+        } else {
+            pcache_flush(ip);
+            inode_sync(ip);
+        }
+
+        sleeplock_release(&ip->slk);
+        spinlock_acquire(&b->lk);
     }
     
-    ip->ref--;
-    spinlock_release(&lk_icache);
+    if(--ip->ref == 0) {
+        if(ip->valid) {
+            spinlock_acquire(&lk_icache);
+            lru_push_head(ip);
+            spinlock_release(&lk_icache);
+        } else {
+            bucket_remove(b, ip);
+            icache_put_free(ip);
+        }
+    }
+    spinlock_release(&b->lk);
+}
+
+// 脏inode写回磁盘
+// 调用者需持有slk, 并处于日志操作中
+void inode_sync(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_sync: not holding lock");
+    if(ip->dirty)
+        inode_rw(ip, true);
+}
+
+// 只在icache里查询inode, 找到则ref++, 否则返回NULL
+// 只使用自旋锁, 不会睡眠
+inode_t* inode_get_cached(uint16 inode_num)
+{
+    icache_bucket_t* b = inode_bucket(inode_num);
+
+    spinlock_acquire(&b->lk);
+    inode_t* ip = bucket_find(b, inode_num);
+    if(ip != NULL)
+        inode_get(ip);
+    spinlock_release(&b->lk);
+    return ip;
 }
 
 // ip->ref++ with lock
 inode_t* inode_dup(inode_t* ip)
 {
-    spinlock_acquire(&lk_icache);
-    ip->ref++;
-    spinlock_release(&lk_icache);
+    icache_bucket_t* b = inode_bucket(ip->inode_num);
+    spinlock_acquire(&b->lk);
+    inode_get(ip);
+    spinlock_release(&b->lk);
     return ip;
 }
 
@@ -196,12 +477,95 @@ void inode_unlock_free(inode_t* ip)
 
 /*---------------------------- 与inode管理的data相关 --------------------------*/
 
+/*
+    预分配窗口: 一次从bitmap申请一段连续的block, 供接下来的数据block依次使用
+    延迟分配刷盘和fallocate在分配前调用inode_prealloc(ip, n)说明总共需要n个
+    窗口用完后按剩余需求重新申请, inode_prealloc_end归还没用完的部分
+    间接block和extent叶子不从窗口里取, 数据block因此在磁盘上保持连续
+    调用者事先预留DALLOC_RESERVE(n)个block, 期间数据和元数据都从ip->rsv里扣除,
+    不会拿走别的文件预留的空间; 没用完的预留在inode_prealloc_end归还
+*/
+
+// 为接下来的n个新block预留空间 (含最坏情况的元数据) 并开始预分配
+// 空间不足返回false, 成功时分配完后调用inode_prealloc_end
+// 调用者需持有slk
+bool inode_reserve(inode_t* ip, uint32 n)
+{
+    if(!bitmap_reserve_blocks(DALLOC_RESERVE(n)))
+        return false;
+    inode_prealloc(ip, n);
+    return true;
+}
+
+// 接下来需要分配n个数据block (已预留DALLOC_RESERVE(n)个)
+// 调用者需持有slk
+void inode_prealloc(inode_t* ip, uint32 n)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_prealloc: not holding lock");
+    assert(ip->rsv == 0, "inode_prealloc: nested");
+    ip->pa_len = 0;
+    ip->pa_want = n;
+    ip->rsv = DALLOC_RESERVE(n);
+}
+
+// 归还窗口里没有用完的block和剩余的预留
+void inode_prealloc_end(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_prealloc_end: not holding lock");
+    for(; ip->pa_len > 0; ip->pa_len--)
+        bitmap_free_block(ip->pa_start++);
+    ip->pa_want = 0;
+    bitmap_unreserve_blocks(ip->rsv);
+    ip->rsv = 0;
+}
+
+// 为文件申请一个block (数据或元数据)
+// 有预留时使用预留, 否则只能使用没有被预留的block
+uint32 inode_alloc_block(inode_t* ip, uint32 goal)
+{
+    uint32 got;
+
+    if(ip->rsv == 0)
+        return bitmap_alloc_block(goal);
+    ip->rsv--;
+    return bitmap_alloc_blocks(goal, 1, &got, true);
+}
+
+// 为文件申请一个数据block
+// 有预分配需求时从窗口里取, 否则从goal开始找
+uint32 inode_alloc_data(inode_t* ip, uint32 goal)
+{
+    if(ip->pa_len == 0 && ip->pa_want > 0 && ip->rsv > 0) {
+        uint32 want = ip->pa_want < ip->rsv ? ip->pa_want : ip->rsv;
+        ip->pa_start = bitmap_alloc_blocks(goal, want, &ip->pa_len, true);
+        ip->rsv -= ip->pa_len;
+    }
+
+    if(ip->pa_len == 0)
+        return inode_alloc_block(ip, goal);
+
+    ip->pa_len--;
+    ip->pa_want--;
+    return ip->pa_start++;
+}
+
 // 辅助 inode_locate_block
 // 递归查询或创建block
-static uint32 locate_block(uint32* entry, uint32 bn, uint32 size)
+// 新建的间接block需要清零, 被修改的间接block记入日志
+// goal: 新block希望的位置 (同一级的前一个block之后)
+static uint32 locate_block(inode_t* ip, uint32* entry, uint32 bn, uint32 size, uint32 goal)
 {
-    if(*entry == 0)
-        *entry = bitmap_alloc_block();
+    buf_t* buf;
+
+    if(*entry == 0) {
+        *entry = (size == 1) ? inode_alloc_data(ip, goal) : inode_alloc_block(ip, goal);
+        if(size != 1) {
+            buf = buf_read(*entry);
+            memset(buf->data, 0, BLOCK_SIZE);
+            log_write(buf);
+            buf_release(buf);
+        }
+    }
 
     if(size == 1)
         return *entry;    
@@ -211,48 +575,125 @@ static uint32 locate_block(uint32* entry, uint32 bn, uint32 size)
     uint32 next_bn = bn % next_size;
     uint32 ret = 0;
 
-    buf_t* buf = buf_read(*entry);
+    buf = buf_read(*entry);
     next_entry = (uint32*)(buf->data) + bn / next_size;
-    ret = locate_block(next_entry, next_bn, next_size);
+    uint32 old_entry = *next_entry;
+    goal = (bn / next_size > 0 && next_entry[-1] != 0) ? next_entry[-1] + 1 : *entry + 1;
+    ret = locate_block(ip, next_entry, next_bn, next_size, goal);
+    if(*next_entry != old_entry)
+        log_write(buf);
     buf_release(buf);
 
     return ret;
 }
 
-// 确定inode里第bn块data block的block_num
-// 如果不存在第bn块data block则申请一个并返回它的block_num
-// 由于inode->addrs的结构, 这个过程比较复杂, 需要单独处理
-static uint32 inode_locate_block(inode_t* ip, uint32 bn)
+// addrs[i]新block的目标位置: 紧跟addrs[i-1]
+static uint32 addrs_goal(inode_t* ip, uint32 i)
+{
+    return (i > 0 && ip->addrs[i - 1] != 0) ? ip->addrs[i - 1] + 1 : 0;
+}
+
+// 辅助 inode_map_run: 只查询不创建, 不存在返回0
+static uint32 lookup_block(uint32 block_num, uint32 bn, uint32 size)
+{
+    while(size != 1 && block_num != 0) {
+        uint32 next_size = size / ENTRY_PER_BLOCK;
+        buf_t* buf = buf_read(block_num);
+        block_num = ((uint32*)buf->data)[bn / next_size];
+        buf_release(buf);
+        bn %= next_size;
+        size = next_size;
+    }
+    return block_num;
+}
+
+// 文件第bn块由addrs的哪一项管理
+// *b为这一项内部的序号, *size为这一项管理的block数
+static uint32 addrs_slot(uint32 bn, uint32* b, uint32* size)
 {
     // 在第一个区域（一级映射）
-    if(bn < N_ADDRS_1)
-        return locate_block(&ip->addrs[bn], bn, 1);
+    if(bn < N_ADDRS_1) {
+        *b = bn;
+        *size = 1;
+        return bn;
+    }
 
     // 在第二个区域（二级映射）
     bn -= N_ADDRS_1;
-    if(bn < N_ADDRS_2 * ENTRY_PER_BLOCK)
-    {
-        uint32 size = ENTRY_PER_BLOCK;
-        uint32 idx = bn / size;
-        uint32 b = bn % size;
-        return locate_block(&ip->addrs[N_ADDRS_1 + idx], b, size);
+    if(bn < N_ADDRS_2 * ENTRY_PER_BLOCK) {
+        *size = ENTRY_PER_BLOCK;
+        *b = bn % *size;
+        return N_ADDRS_1 + bn / *size;
     }
 
     // 在第三个区域（三级映射）
     bn -= N_ADDRS_2 * ENTRY_PER_BLOCK;
-    if(bn < N_ADDRS_3 * ENTRY_PER_BLOCK * ENTRY_PER_BLOCK)
-    {
-        uint32 size = ENTRY_PER_BLOCK * ENTRY_PER_BLOCK;
-        uint32 idx = bn / size;
-        uint32 b = bn % size;
-        return locate_block(&ip->addrs[N_ADDRS_1 + N_ADDRS_2 + idx], b, size);
+    if(bn < N_ADDRS_3 * ENTRY_PER_BLOCK * ENTRY_PER_BLOCK) {
+        *size = ENTRY_PER_BLOCK * ENTRY_PER_BLOCK;
+        *b = bn % *size;
+        return N_ADDRS_1 + N_ADDRS_2 + bn / *size;
     }
 
-    panic("inode_locate_block: overflow");
+    panic("addrs_slot: overflow");
     return 0;
 }
 
+// 确定inode里第bn块data block的block_num
+// 如果不存在第bn块data block则申请一个并返回它的block_num
+// 由于inode->addrs的结构, 这个过程比较复杂, 需要单独处理
+// 调用者需要持有 inode 锁
+uint32 inode_locate_block(inode_t* ip, uint32 bn)
+{
+    assert(!(ip->flags & INODE_F_INLINE), "inode_locate_block: inline inode");
+    if(ip->flags & INODE_F_EXTENT)
+        return extent_locate_block(ip, bn);
+
+    uint32 b, size;
+    uint32 idx = addrs_slot(bn, &b, &size);
+    return locate_block(ip, &ip->addrs[idx], b, size, addrs_goal(ip, idx));
+}
+
+// 查询文件第bn块开始在磁盘上连续的一段 (不申请新block)
+// 返回起始block_num, *len为连续的block数
+// 还没有分配(延迟分配或崩溃留下的空洞)返回0, *len = 1
+// extent格式一次查询得到整段, 其他格式每次只返回一个block
+// 调用者需要持有slk
+uint32 inode_map_run(inode_t* ip, uint32 bn, uint32* len)
+{
+    assert(!(ip->flags & INODE_F_INLINE), "inode_map_run: inline inode");
+    if(ip->flags & INODE_F_EXTENT) {
+        uint32 block = extent_map(ip, bn, len);
+        if(block == 0)
+            *len = 1;
+        return block;
+    }
+
+    uint32 b, size;
+    uint32 idx = addrs_slot(bn, &b, &size);
+    *len = 1;
+    return lookup_block(ip->addrs[idx], b, size);
+}
+
+// 从buf_cache或页缓存拷出数据
+static void data_copyout(void* dst, uint32 total, void* src, uint32 len, bool user)
+{
+    if(user)
+        uvm_copyout(myproc()->pgtbl, (uint64)dst + total, (uint64)src, len);
+    else
+        memmove((char*)dst + total, src, len);
+}
+
+// 向buf_cache或页缓存拷入数据
+static void data_copyin(void* dst, void* src, uint32 total, uint32 len, bool user)
+{
+    if(user)
+        uvm_copyin(myproc()->pgtbl, (uint64)dst, (uint64)src + total, len);
+    else
+        memmove(dst, (char*)src + total, len);
+}
+
 // 读取 inode 管理的 data block
+// 目录经过buf_cache, 普通文件经过页缓存
 // 调用者需要持有 inode 锁
 // 成功返回读出的字节数, 失败返回0
 uint32 inode_read_data(inode_t* ip, uint32 offset, uint32 len, void* dst, bool user)
@@ -266,7 +707,34 @@ uint32 inode_read_data(inode_t* ip, uint32 offset, uint32 len, void* dst, bool u
         len = ip->size - offset;
     
     uint32 total = 0;
-    uint32 block_num, block_offset, read_len;
+    uint32 read_len;
+
+    // 内联文件不需要读盘
+    if(ip->flags & INODE_F_INLINE) {
+        data_copyout(dst, 0, (uint8*)ip->addrs + offset, len, user);
+        return len;
+    }
+    
+    if(ip->type != FT_DIR) {
+        while(total < len) {
+            uint32 page_offset = offset % PGSIZE;
+            read_len = PGSIZE - page_offset;
+            if(read_len > len - total)
+                read_len = len - total;
+
+            page_t* pg = pcache_get(ip, offset / PGSIZE, true);
+            if(pg == NULL)
+                break;
+            data_copyout(dst, total, (void*)(pg->pa + page_offset), read_len, user);
+            pcache_put(pg, false);
+
+            total += read_len;
+            offset += read_len;
+        }
+        return total;
+    }
+
+    uint32 block_num, block_offset;
     
     while(total < len) {
         block_num = inode_locate_block(ip, offset / BLOCK_SIZE);
@@ -278,15 +746,9 @@ uint32 inode_read_data(inode_t* ip, uint32 offset, uint32 len, void* dst, bool u
             read_len = len - total;
         
         buf_t* buf = buf_read(block_num);
-        
-        if(user) {
-            uvm_copyout(myproc()->pgtbl, (uint64)dst + total, 
-                       (uint64)(buf->data + block_offset), read_len);
-        } else {
-            memmove((char*)dst + total, buf->data + block_offset, read_len);
-        }
-        
+        data_copyout(dst, total, buf->data + block_offset, read_len, user);
         buf_release(buf);
+
         total += read_len;
         offset += read_len;
     }
@@ -294,7 +756,111 @@ uint32 inode_read_data(inode_t* ip, uint32 offset, uint32 len, void* dst, bool u
     return total;
 }
 
+/*
+    在inode_read_data之前调用, 根据本次读取的位置更新预读状态
+    顺序读: 窗口从RA_MIN_WINDOW开始成倍增长到RA_MAX_WINDOW
+    随机读: 窗口归零, 只批量读取本次请求覆盖的部分
+    普通文件以页为单位交给pcache_prefetch, 目录以block为单位交给buf_prefetch
+    调用者需要持有 inode 锁
+*/
+void inode_readahead(inode_t* ip, readahead_t* ra, uint32 offset, uint32 len)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_readahead: not holding lock");
+
+    if(len == 0 || offset >= ip->size || (ip->flags & INODE_F_INLINE))
+        return;
+    if(offset + len > ip->size)
+        len = ip->size - offset;
+
+    uint32 unit = (ip->type == FT_DIR) ? BLOCK_SIZE : PGSIZE;
+    uint32 first = offset / unit;
+    uint32 last = (offset + len - 1) / unit;
+    uint32 nunits = (ip->size + unit - 1) / unit;
+
+    // 紧接上一次读取 (上一次可能停在单元中间) 视为顺序读
+    if(offset == 0 || first == ra->next_bn || first + 1 == ra->next_bn) {
+        if(ra->window == 0)
+            ra->window = RA_MIN_WINDOW;
+        else if(ra->window * 2 <= RA_MAX_WINDOW)
+            ra->window *= 2;
+    } else {
+        ra->window = 0;
+        ra->ahead_bn = 0;
+    }
+    ra->next_bn = last + 1;
+
+    // 跳过已经预读过的部分
+    uint32 start = first;
+    if(ra->window != 0 && ra->ahead_bn > start)
+        start = ra->ahead_bn;
+
+    uint32 end = last + 1 + ra->window;
+    if(end > nunits)
+        end = nunits;
+    if(end > start + N_BUF_PREFETCH)
+        end = start + N_BUF_PREFETCH;
+    if(start >= end)
+        return;
+
+    if(ip->type == FT_DIR) {
+        uint32 block_nums[N_BUF_PREFETCH];
+        for(uint32 bn = start; bn < end; bn++)
+            block_nums[bn - start] = inode_locate_block(ip, bn);
+        buf_prefetch(block_nums, end - start);
+    } else {
+        pcache_prefetch(ip, start, end - start);
+    }
+
+    ra->ahead_bn = end;
+}
+
+/*
+    为页内第[b_first, b_last]个还没有磁盘位置的block确定位置 (普通文件写入前调用)
+    已经分配过的(fallocate)直接使用, 其他的只预留空间, 记为BLOCK_DELAYED
+    延迟页达到DALLOC_MAX_PAGES时先分配本文件的延迟block, 仍然超过则立即分配
+    立即分配时*mapped = true (调用者负责写回inode)
+    空间不足返回false
+*/
+static bool page_prepare_blocks(inode_t* ip, page_t* pg, uint32 b_first, uint32 b_last, bool* mapped)
+{
+    uint32 base = pg->index * BLOCK_PER_PAGE;
+    uint32 need = 0, len;
+
+    for(uint32 i = b_first; i <= b_last; i++) {
+        if(pg->blocks[i] == 0)
+            pg->blocks[i] = inode_map_run(ip, base + i, &len);
+        if(pg->blocks[i] == 0)
+            need++;
+    }
+    if(need == 0)
+        return true;
+    if(!bitmap_reserve_blocks(DALLOC_RESERVE(need)))
+        return false;
+
+    bool delay = true;
+    if(!pg->delayed && pcache_delayed_pages() >= DALLOC_MAX_PAGES) {
+        pcache_alloc_delayed(ip);
+        if(pcache_delayed_pages() >= DALLOC_MAX_PAGES)
+            delay = false;
+    }
+
+    if(!delay)
+        inode_prealloc(ip, need);
+    for(uint32 i = b_first; i <= b_last; i++)
+        if(pg->blocks[i] == 0)
+            pg->blocks[i] = delay ? BLOCK_DELAYED : inode_locate_block(ip, base + i);
+    if(delay) {
+        pcache_set_delayed(pg);
+    } else {
+        inode_prealloc_end(ip);
+        *mapped = true;
+    }
+    return true;
+}
+
 // 写入 inode 管理的 data block (可能导致管理的 block 增加)
+// 普通文件只写入页缓存并预留空间, 刷盘时才分配block (见pcache.h)
+// 普通文件只改变了size时inode被标记为脏, 不立即写回
 // 调用者需要持有 inode 锁
 // 成功返回写入的字节数, 失败返回0
 uint32 inode_write_data(inode_t* ip, uint32 offset, uint32 len, void* src, bool user)
@@ -308,43 +874,180 @@ uint32 inode_write_data(inode_t* ip, uint32 offset, uint32 len, void* src, bool
         return 0;
     
     uint32 total = 0;
-    uint32 block_num, block_offset, write_len;
+    uint32 write_len;
+    bool mapped = false;
+
+    // 内联文件: 放得下就直接写入addrs, 否则先转换
+    if(ip->flags & INODE_F_INLINE) {
+        if(offset + len <= INODE_INLINE_MAX) {
+            data_copyin((uint8*)ip->addrs + offset, src, 0, len, user);
+            if(offset + len > ip->size)
+                ip->size = offset + len;
+            inode_mark_dirty(ip);
+            return len;
+        }
+        if(inode_inline_expand(ip) < 0)
+            return 0;
+    }
     
-    while(total < len) {
-        block_num = inode_locate_block(ip, offset / BLOCK_SIZE);
-        block_offset = offset % BLOCK_SIZE;
-        
-        // 计算这次写入的字节数
-        write_len = BLOCK_SIZE - block_offset;
-        if(write_len > len - total)
-            write_len = len - total;
-        
-        buf_t* buf = buf_read(block_num);
-        
-        if(user) {
-            uvm_copyin(myproc()->pgtbl, (uint64)(buf->data + block_offset),
-                      (uint64)src + total, write_len);
-        } else {
-            memmove(buf->data + block_offset, (char*)src + total, write_len);
+    if(ip->type != FT_DIR) {
+        while(total < len) {
+            uint32 index = offset / PGSIZE;
+            uint32 page_offset = offset % PGSIZE;
+            write_len = PGSIZE - page_offset;
+            if(write_len > len - total)
+                write_len = len - total;
+
+            // 整页覆盖时无需读盘
+            page_t* pg = pcache_get(ip, index, write_len != PGSIZE);
+            if(pg == NULL)
+                break;
+            // 写回不持有slk, 等它结束后再修改blocks[]和页内数据
+            pcache_wait_writeback(pg);
+
+            // 本次写到的block如果还没有磁盘位置, 预留空间
+            uint32 b_first = page_offset / BLOCK_SIZE;
+            uint32 b_last = (page_offset + write_len - 1) / BLOCK_SIZE;
+            if(!page_prepare_blocks(ip, pg, b_first, b_last, &mapped)) {
+                pcache_put(pg, false);
+                break;
+            }
+
+            data_copyin((void*)(pg->pa + page_offset), src, total, write_len, user);
+            pcache_put(pg, true);
+
+            total += write_len;
+            offset += write_len;
+        }
+    } else {
+        uint32 block_num, block_offset, run;
+
+        while(total < len) {
+            // 新block先预留空间, 不足时停止写入
+            bool grow = inode_map_run(ip, offset / BLOCK_SIZE, &run) == 0;
+            if(grow && !inode_reserve(ip, 1))
+                break;
+            block_num = inode_locate_block(ip, offset / BLOCK_SIZE);
+            if(grow)
+                inode_prealloc_end(ip);
+            block_offset = offset % BLOCK_SIZE;
+            
+            // 计算这次写入的字节数
+            write_len = BLOCK_SIZE - block_offset;
+            if(write_len > len - total)
+                write_len = len - total;
+            
+            buf_t* buf = buf_read(block_num);
+            data_copyin(buf->data + block_offset, src, total, write_len, user);
+            log_write(buf);
+            buf_release(buf);
+
+            total += write_len;
+            offset += write_len;
         }
-        
-        buf_write(buf);
-        buf_release(buf);
-        total += write_len;
-        offset += write_len;
     }
     
     // 更新size
+    bool grown = false;
     if(offset > ip->size) {
         ip->size = offset;
+        grown = true;
     }
     
     // 写回inode元数据
-    inode_rw(ip, true);
+    if(ip->type == FT_DIR || mapped)
+        inode_rw(ip, true);
+    else if(grown)
+        inode_mark_dirty(ip);
     
     return total;
 }
 
+/*
+    为普通文件的[offset, offset + len)预先分配磁盘block, 不改变文件大小
+    已有的延迟block先分配, 保证新旧block按文件顺序排列
+    之后写入这个范围时直接使用这些block, 不再预留和分配
+    调用者需要持有 inode 锁, 并处于日志操作中
+    成功返回0, 失败返回-1 (参数不合法或空间不足, 此时没有分配)
+*/
+int inode_fallocate(inode_t* ip, uint32 offset, uint32 len)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_fallocate: not holding lock");
+
+    if(ip->type != FT_FILE || len == 0)
+        return -1;
+    if(offset + len > INODE_MAXSIZE || offset + len < offset)
+        return -1;
+
+    if(ip->flags & INODE_F_INLINE) {
+        if(offset + len <= INODE_INLINE_MAX)
+            return 0;
+        if(inode_inline_expand(ip) < 0)
+            return -1;
+    }
+
+    pcache_alloc_delayed(ip);
+
+    uint32 first = offset / BLOCK_SIZE;
+    uint32 last = (offset + len - 1) / BLOCK_SIZE;
+    uint32 need = 0, run;
+
+    for(uint32 bn = first; bn <= last; bn += run) {
+        if(inode_map_run(ip, bn, &run) == 0)
+            need++;
+    }
+    if(need == 0)
+        return 0;
+    if(!inode_reserve(ip, need))
+        return -1;
+
+    for(uint32 bn = first; bn <= last; bn += run) {
+        if(inode_map_run(ip, bn, &run) == 0)
+            inode_locate_block(ip, bn);
+    }
+    inode_prealloc_end(ip);
+
+    inode_rw(ip, true);
+    return 0;
+}
+
+/*
+    把内联文件转换成用block存放 (增长超过INODE_INLINE_MAX或者被mmap时)
+    原来的内容重新经过页缓存写入, 之后和普通文件一样延迟分配
+    调用者需要持有 inode 锁, 并处于日志操作中
+    成功返回0, 空间不足返回-1 (此时仍然是内联文件)
+*/
+int inode_inline_expand(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "inode_inline_expand: not holding lock");
+
+    if(!(ip->flags & INODE_F_INLINE))
+        return 0;
+
+    uint8 data[INODE_INLINE_MAX];
+    uint32 size = ip->size;
+    uint8 flags = ip->flags;
+    memmove(data, ip->addrs, size);
+
+    ip->flags &= ~INODE_F_INLINE;
+    if(sb.features & FS_FEAT_EXTENT)
+        ip->flags |= INODE_F_EXTENT;
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+
+    if(inode_write_data(ip, 0, size, data, false) != size) {
+        pcache_drop(ip);
+        ip->flags = flags;
+        memmove(ip->addrs, data, size);
+        ip->size = size;
+        return -1;
+    }
+
+    // 磁盘上仍是原来的内联内容, 延迟写回即可
+    inode_mark_dirty(ip);
+    return 0;
+}
+
 // 辅助 inode_free_data 做递归释放
 static void data_free(uint32 block_num, uint32 level)
 {  
@@ -357,8 +1060,8 @@ static void data_free(uint32 block_num, uint32 level)
     buf_t* buf = buf_read(block_num);
     for(uint32* addr = (uint32*)buf->data; addr < (uint32*)(buf->data + BLOCK_SIZE); addr++) 
     {
-        if(*addr == 0) break;
-        data_free(*addr, level - 1);
+        if(*addr != 0)   // 延迟分配可能先分配后面的block, 中间会有空洞
+            data_free(*addr, level - 1);
     }
     buf_release(buf);
 
@@ -368,11 +1071,23 @@ ret:
 }
 
 // 释放inode管理的 data block
-// ip->addrs被清空 ip->size置0
+// ip->addrs被清空 ip->size置0, 页缓存被丢弃
 // 调用者需要持有slk
 void inode_free_data(inode_t* ip)
 {
     assert(sleeplock_holding(&ip->slk), "inode_free_data: not holding lock");
+
+    pcache_drop(ip);
+
+    if(ip->flags & INODE_F_INLINE) {
+        memset(ip->addrs, 0, sizeof(ip->addrs));
+        goto out;
+    }
+
+    if(ip->flags & INODE_F_EXTENT) {
+        extent_free(ip);
+        goto out;
+    }
     
     // 释放一级映射的block
     for(int i = 0; i < N_ADDRS_1; i++) {
@@ -397,7 +1112,8 @@ void inode_free_data(inode_t* ip)
             ip->addrs[N_ADDRS_1 + N_ADDRS_2 + i] = 0;
         }
     }
-    
+
+out:
     ip->size = 0;
     inode_rw(ip, true);
 }
@@ -418,8 +1134,30 @@ void inode_print(inode_t* ip)
     printf("\ninode information:\n");
     printf("num = %d, ref = %d, valid = %d\n", ip->inode_num, ip->ref, ip->valid);
     printf("type = %s, major = %d, minor = %d, nlink = %d\n", inode_types[ip->type], ip->major, ip->minor, ip->nlink);
+    if(ip->flags & INODE_F_INLINE) {
+        printf("size = %d, inline data\n", ip->size);
+        return;
+    }
+    if(ip->flags & INODE_F_EXTENT) {
+        printf("size = %d, ", ip->size);
+        extent_print(ip);
+        return;
+    }
     printf("size = %d, addrs =", ip->size);
     for(int i = 0; i < N_ADDRS; i++)
         printf(" %d", ip->addrs[i]);
     printf("\n");
-}
\ No newline at end of file
+}
+
+// 输出icache的使用情况
+// for debug
+void inode_stat_print()
+{
+    uint32 lru = 0;
+    spinlock_acquire(&lk_icache);
+    for(inode_t* ip = lru_head.next; ip != &lru_head; ip = ip->next)
+        lru++;
+    printf("icache: pages = %d / %d, unreferenced = %d, reuse = %d, miss = %d, evict = %d, coalesce = %d\n",
+           n_pages, N_ICACHE_PAGE, lru, stat_reuse, stat_miss, stat_evict, stat_coalesce);
+    spinlock_release(&lk_icache);
+}
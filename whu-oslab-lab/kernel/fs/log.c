@@ -0,0 +1,264 @@
+#include "fs/log.h"
+#include "fs/buf.h"
+#include "dev/vio.h"
+#include "proc/proc.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "lib/str.h"
+
+// 日志头 (磁盘和内存里的格式相同)
+typedef struct log_header {
+    uint32 n;                     // 本次提交包含的block数量
+    uint32 block_num[LOG_SIZE];   // 每个block的原位置
+} log_header_t;
+
+typedef struct log {
+    spinlock_t lk;        // 保护下面所有字段
+    uint32 start;         // 日志头所在的block
+    uint32 size;          // 日志区能容纳的block数 (老映像的日志区可能小于LOG_SIZE)
+    uint32 outstanding;   // 正在执行的文件系统操作数
+    bool committing;      // 正在提交, 新的操作需要等待
+    log_header_t lh;      // 还没有提交的block
+    buf_t* bufs[LOG_SIZE];// lh.block_num[i]对应的buf (已经pin住)
+
+    uint32 stat_ops;      // 统计: 完成的操作数
+    uint32 stat_commits;  // 统计: 提交次数
+    uint32 stat_blocks;   // 统计: 提交的block总数
+} log_t;
+
+static log_t lg;
+
+// 日志头的写缓冲区
+static uint8 head_block[BLOCK_SIZE];
+
+// 把日志头写入磁盘 (n = 0 表示清空日志)
+static void log_write_head(uint32 n)
+{
+    log_header_t* lh = (log_header_t*)head_block;
+    vio_req_t req;
+
+    lh->n = n;
+    for(uint32 i = 0; i < n; i++)
+        lh->block_num[i] = lg.lh.block_num[i];
+
+    req.block_num = lg.start;
+    req.len = BLOCK_SIZE;
+    req.data = head_block;
+    virtio_disk_rw_reqs(&req, 1, true);
+}
+
+// 启动时检查日志: 如果上次已经提交但没有写回原位置, 重做一遍
+static void log_recover()
+{
+    buf_t* buf = buf_read(lg.start);
+    memmove(&lg.lh, buf->data, sizeof(log_header_t));
+    buf_release(buf);
+
+    if(lg.lh.n > lg.size)
+        panic("log_recover: bad log header");
+
+    for(uint32 i = 0; i < lg.lh.n; i++) {
+        buf_t* lbuf = buf_read(lg.start + 1 + i);
+        buf_t* dbuf = buf_read(lg.lh.block_num[i]);
+        memmove(dbuf->data, lbuf->data, BLOCK_SIZE);
+        buf_write(dbuf);
+        buf_release(lbuf);
+        buf_release(dbuf);
+    }
+    if(lg.lh.n > 0)
+        printf("log: recovered %d blocks\n", lg.lh.n);
+
+    lg.lh.n = 0;
+    log_write_head(0);
+}
+
+// 初始化 (日志区: [start, start + size))
+void log_init(uint32 start, uint32 size)
+{
+    assert(sizeof(log_header_t) <= BLOCK_SIZE, "log_init: log header too big");
+    assert(size >= 1 + LOG_OP_BLOCKS, "log_init: log area too small");
+
+    spinlock_init(&lg.lk, "log");
+    lg.start = start;
+    lg.size = (size - 1 < LOG_SIZE) ? size - 1 : LOG_SIZE;
+    lg.outstanding = 0;
+    lg.committing = false;
+    lg.stat_ops = lg.stat_commits = lg.stat_blocks = 0;
+
+    log_recover();
+}
+
+/*
+    提交 (调用者保证没有进行中的操作)
+    1. 日志里的block一次性批量写入日志区
+    2. 写日志头 (真正的提交点, 之后崩溃也能重做)
+    3. 日志里的block一次性批量写回原位置
+    4. 清空日志头
+    每一步都是一次批量I/O, 与本次提交包含多少个操作无关
+*/
+static void log_commit()
+{
+    // 提交是串行的 (committing), 请求数组太大, 不放在内核栈上
+    static vio_req_t reqs[LOG_SIZE];
+    uint32 n = lg.lh.n;
+
+    if(n == 0)
+        return;
+
+    // 锁住所有buf, 保证写出的是一致的内容
+    for(uint32 i = 0; i < n; i++) {
+        sleeplock_acquire(&lg.bufs[i]->slk);
+        reqs[i].block_num = lg.start + 1 + i;
+        reqs[i].len = BLOCK_SIZE;
+        reqs[i].data = lg.bufs[i]->data;
+    }
+    virtio_disk_rw_reqs(reqs, n, true);
+
+    log_write_head(n);
+
+    for(uint32 i = 0; i < n; i++)
+        reqs[i].block_num = lg.lh.block_num[i];
+    virtio_disk_rw_reqs(reqs, n, true);
+
+    log_write_head(0);
+
+    for(uint32 i = 0; i < n; i++) {
+        sleeplock_release(&lg.bufs[i]->slk);
+        buf_unpin(lg.bufs[i]);
+    }
+
+    lg.stat_commits++;
+    lg.stat_blocks += n;
+    lg.lh.n = 0;
+}
+
+// 文件系统操作开始
+// 日志正在提交或剩余空间可能不够时等待
+void log_begin_op()
+{
+    spinlock_acquire(&lg.lk);
+    while(1) {
+        if(lg.committing) {
+            proc_sleep(&lg, &lg.lk);
+        } else if(lg.lh.n + (lg.outstanding + 1) * LOG_OP_BLOCKS > lg.size) {
+            // 这个操作可能用完日志空间, 等待提交
+            proc_sleep(&lg, &lg.lk);
+        } else {
+            lg.outstanding++;
+            break;
+        }
+    }
+    spinlock_release(&lg.lk);
+}
+
+// 文件系统操作结束
+// 最后一个进行中的操作负责提交
+void log_end_op()
+{
+    bool do_commit = false;
+
+    spinlock_acquire(&lg.lk);
+    assert(lg.outstanding > 0, "log_end_op: no outstanding op");
+    assert(!lg.committing, "log_end_op: committing");
+    lg.outstanding--;
+    lg.stat_ops++;
+    if(lg.outstanding == 0) {
+        do_commit = true;
+        lg.committing = true;
+    } else {
+        // 预留空间减少了, 等待空间的操作可以开始
+        proc_wakeup(&lg);
+    }
+    spinlock_release(&lg.lk);
+
+    if(do_commit) {
+        // 提交时不能持有自旋锁 (需要睡眠锁和磁盘I/O)
+        log_commit();
+        spinlock_acquire(&lg.lk);
+        lg.committing = false;
+        proc_wakeup(&lg);
+        spinlock_release(&lg.lk);
+    }
+}
+
+/*
+    记录一个被修改的buf (代替buf_write)
+    buf被pin在buf_cache里, 直到提交时才写入磁盘
+    同一个block在一次提交里只占一个位置 (吸收)
+    调用者需持有buf的睡眠锁
+*/
+void log_write(buf_t* buf)
+{
+    assert(sleeplock_holding(&buf->slk), "log_write: not holding lock");
+
+    spinlock_acquire(&lg.lk);
+    if(lg.outstanding < 1)
+        panic("log_write: outside of transaction");
+
+    uint32 i;
+    for(i = 0; i < lg.lh.n; i++)
+        if(lg.lh.block_num[i] == buf->block_num)
+            break;
+
+    if(i == lg.lh.n) {
+        if(lg.lh.n >= lg.size)
+            panic("log_write: transaction too big");
+        lg.lh.block_num[i] = buf->block_num;
+        lg.bufs[i] = buf;
+        buf_pin(buf);
+        lg.lh.n++;
+    }
+    spinlock_release(&lg.lk);
+}
+
+/*
+    block被释放时调用: 从未提交的日志里撤销它
+    否则提交时可能把旧的元数据写到已经被页缓存重新使用的block上
+*/
+void log_revoke(uint32 block_num)
+{
+    buf_t* buf = NULL;
+
+    spinlock_acquire(&lg.lk);
+    for(uint32 i = 0; i < lg.lh.n; i++) {
+        if(lg.lh.block_num[i] == block_num) {
+            buf = lg.bufs[i];
+            lg.lh.n--;
+            lg.lh.block_num[i] = lg.lh.block_num[lg.lh.n];
+            lg.bufs[i] = lg.bufs[lg.lh.n];
+            break;
+        }
+    }
+    spinlock_release(&lg.lk);
+
+    if(buf != NULL)
+        buf_unpin(buf);
+}
+
+// 等待此前结束的操作全部提交到磁盘 (fsync使用)
+// 调用者不在日志操作中
+void log_sync()
+{
+    spinlock_acquire(&lg.lk);
+    if(lg.committing) {
+        // 正在进行的提交包含了此前结束的所有操作
+        while(lg.committing)
+            proc_sleep(&lg, &lg.lk);
+    } else if(lg.lh.n > 0) {
+        // 还有操作在进行, 等它们结束后的那次提交
+        uint32 gen = lg.stat_commits;
+        while(lg.committing || lg.stat_commits == gen)
+            proc_sleep(&lg, &lg.lk);
+    }
+    spinlock_release(&lg.lk);
+}
+
+// 输出日志的统计信息
+// for debug
+void log_print()
+{
+    spinlock_acquire(&lg.lk);
+    printf("log: ops = %d, commits = %d, blocks = %d, pending = %d\n",
+           lg.stat_ops, lg.stat_commits, lg.stat_blocks, lg.lh.n);
+    spinlock_release(&lg.lk);
+}
@@ -0,0 +1,657 @@
+#include "fs/pcache.h"
+#include "fs/inode.h"
+#include "fs/bitmap.h"
+#include "dev/vio.h"
+#include "mem/pmem.h"
+#include "lib/lock.h"
+#include "riscv.h"
+#include "lib/print.h"
+#include "lib/str.h"
+#include "proc/proc.h"
+
+// 页描述符 + LRU链表头 + 保护它们的锁
+// lk_pcache 保护: 基数树结构 + 描述符的ip/index/ref/dirty + LRU链表 + 空闲链表 + 计数
+static page_t pages[N_PCACHE_PAGE];
+static page_t lru_head;      // ->next 最近释放 ->prev 最久未用
+static page_t* free_list;    // 空闲描述符 (ip == NULL 且 ref == 0), 用next串成单向链表
+static spinlock_t lk_pcache;
+static uint32 n_delayed;     // delayed = true 的页数
+static uint32 n_referenced;  // ref > 0 的页数
+
+// 物理页 -> 描述符 (页缓存的物理页都来自内核区域, 分配后不再归还)
+static page_t* pa_page[KERNEL_PAGES];
+
+// pa在内核区域里的页号, 不在内核区域返回-1
+static int pa_index(uint64 pa)
+{
+    uint64 base = PG_ROUND_UP((uint64)ALLOC_BEGIN);
+    if(pa < base || pa >= base + (uint64)KERNEL_PAGES * PGSIZE)
+        return -1;
+    return (pa - base) / PGSIZE;
+}
+
+// 基数树节点仓库 (空闲节点用slots[0]串成单向链表)
+static pcache_node_t nodes[N_PCACHE_NODE];
+static pcache_node_t* node_list;
+
+// 初始化
+void pcache_init()
+{
+    spinlock_init(&lk_pcache, "pcache");
+
+    lru_head.next = &lru_head;
+    lru_head.prev = &lru_head;
+
+    free_list = NULL;
+    for(int i = N_PCACHE_PAGE - 1; i >= 0; i--) {
+        pages[i].ip = NULL;
+        pages[i].ref = 0;
+        pages[i].pa = 0;
+        pages[i].delayed = false;
+        pages[i].writeback = false;
+        pages[i].next = free_list;
+        free_list = &pages[i];
+    }
+    n_delayed = 0;
+    n_referenced = 0;
+
+    node_list = NULL;
+    for(int i = 0; i < N_PCACHE_NODE; i++) {
+        nodes[i].slots[0] = node_list;
+        node_list = &nodes[i];
+    }
+}
+
+/*--------------------------- LRU链表 + 基数树 (持有lk_pcache) ---------------------------*/
+
+static void lru_remove(page_t* pg)
+{
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pg->prev = NULL;
+}
+
+// head_next = true 插入链表头 (最后淘汰), 否则插入链表尾 (最先淘汰)
+static void lru_insert(page_t* pg, bool head_next)
+{
+    if(head_next) {
+        pg->prev = &lru_head;
+        pg->next = lru_head.next;
+    } else {
+        pg->next = &lru_head;
+        pg->prev = lru_head.prev;
+    }
+    pg->next->prev = pg;
+    pg->prev->next = pg;
+}
+
+static pcache_node_t* node_alloc()
+{
+    pcache_node_t* node = node_list;
+    if(node == NULL)
+        panic("pcache: no free node");
+    node_list = node->slots[0];
+    memset(node, 0, sizeof(pcache_node_t));
+    return node;
+}
+
+static void node_free(pcache_node_t* node)
+{
+    node->slots[0] = node_list;
+    node_list = node;
+}
+
+// 第level层(叶子为0)里index对应的槽号
+static inline uint32 node_slot(uint32 index, int level)
+{
+    return (index >> (level * PCACHE_SHIFT)) & (PCACHE_SLOTS - 1);
+}
+
+// 查找ip的基数树里index对应的叶子槽
+// alloc = true 时沿途创建节点
+static page_t** tree_slot(inode_t* ip, uint32 index, bool alloc)
+{
+    pcache_node_t** node = &ip->pages;
+
+    for(int level = PCACHE_HEIGHT - 1; ; level--) {
+        if(*node == NULL) {
+            if(!alloc)
+                return NULL;
+            *node = node_alloc();
+        }
+        if(level == 0)
+            return (page_t**)&(*node)->slots[node_slot(index, 0)];
+        node = (pcache_node_t**)&(*node)->slots[node_slot(index, level)];
+    }
+}
+
+// 从ip的基数树里删除index, 并回收变空的节点
+static void tree_remove(inode_t* ip, uint32 index)
+{
+    pcache_node_t** path[PCACHE_HEIGHT];
+    pcache_node_t** node = &ip->pages;
+
+    for(int level = PCACHE_HEIGHT - 1; level >= 0; level--) {
+        assert(*node != NULL, "tree_remove: not found");
+        path[level] = node;
+        node = (pcache_node_t**)&(*node)->slots[node_slot(index, level)];
+    }
+    *node = NULL;
+
+    // 自底向上回收空节点
+    for(int level = 0; level < PCACHE_HEIGHT; level++) {
+        pcache_node_t* n = *path[level];
+        for(int i = 0; i < PCACHE_SLOTS; i++)
+            if(n->slots[i] != NULL)
+                return;
+        node_free(n);
+        *path[level] = NULL;
+    }
+}
+
+// 以node为根的第level层子树 (覆盖的第一页是base) 里页号不小于start的第一页
+static page_t* node_next(pcache_node_t* node, int level, uint32 start, uint32 base)
+{
+    uint32 shift = level * PCACHE_SHIFT;
+
+    for(uint32 i = 0; i < PCACHE_SLOTS; i++) {
+        uint32 lo = base + (i << shift);
+        if(node->slots[i] == NULL || lo + (1u << shift) <= start)
+            continue;
+        if(level == 0)
+            return node->slots[i];
+        page_t* pg = node_next(node->slots[i], level - 1, start, lo);
+        if(pg != NULL)
+            return pg;
+    }
+    return NULL;
+}
+
+// ip的基数树里页号不小于start的第一页, 没有返回NULL
+// 按页号顺序遍历ip的所有页, 不需要扫描全部描述符
+static page_t* tree_next(inode_t* ip, uint32 start)
+{
+    if(ip->pages == NULL)
+        return NULL;
+    return node_next(ip->pages, PCACHE_HEIGHT - 1, start, 0);
+}
+
+// 页里延迟分配的block数
+static uint32 page_delayed_blocks(page_t* pg)
+{
+    uint32 n = 0;
+    for(uint32 i = 0; i < BLOCK_PER_PAGE; i++)
+        if(pg->blocks[i] == BLOCK_DELAYED)
+            n++;
+    return n;
+}
+
+// 把页从所属inode上摘下来, 变为空闲描述符
+// 延迟分配的数据被丢弃, 归还预留的空间
+static void page_detach(page_t* pg)
+{
+    if(pg->delayed) {
+        bitmap_unreserve_blocks(DALLOC_RESERVE(page_delayed_blocks(pg)));
+        pg->delayed = false;
+        n_delayed--;
+    }
+    tree_remove(pg->ip, pg->index);
+    pg->ip = NULL;
+    pg->dirty = false;
+}
+
+// ref++ (页原来不被引用时一定在LRU里)
+static void page_hold(page_t* pg)
+{
+    if(pg->ref++ == 0) {
+        lru_remove(pg);
+        n_referenced++;
+    }
+}
+
+// ref--, 归还最后一个引用时放回LRU (head_next含义同lru_insert)
+// 已经被pcache_drop丢弃的页(ip == NULL)变为空闲描述符
+static void page_release(page_t* pg, bool head_next)
+{
+    assert(pg->ref > 0, "page_release: ref");
+    if(--pg->ref > 0)
+        return;
+    n_referenced--;
+    if(pg->ip != NULL) {
+        lru_insert(pg, head_next);
+    } else {
+        pg->next = free_list;
+        free_list = pg;
+    }
+}
+
+// 申请一个页描述符 (ref = 1): 优先用空闲的, 其次淘汰LRU尾部的干净页
+// 失败返回NULL (只剩下脏页或全部被引用)
+static page_t* page_alloc()
+{
+    page_t* pg = free_list;
+
+    if(pg != NULL && pg->pa == 0) {
+        pg->pa = (uint64)pmem_alloc(true);
+        if(pg->pa != 0)
+            pa_page[pa_index(pg->pa)] = pg;
+    }
+
+    if(pg != NULL && pg->pa != 0) {
+        free_list = pg->next;
+        pg->next = NULL;
+    } else {
+        // 内核物理页耗尽, 只能淘汰
+        for(pg = lru_head.prev; pg != &lru_head; pg = pg->prev)
+            if(!pg->dirty)
+                break;
+        if(pg == &lru_head)
+            return NULL;
+        lru_remove(pg);
+        page_detach(pg);
+    }
+
+    pg->ref = 1;
+    n_referenced++;
+    return pg;
+}
+
+/*--------------------------- 磁盘I/O (不持有lk_pcache) ---------------------------*/
+
+// 把页内磁盘上连续的block合并成请求, 返回请求数
+static uint32 page_make_reqs(page_t* pg, vio_req_t* reqs)
+{
+    uint32 n = 0, i = 0, j;
+
+    while(i < BLOCK_PER_PAGE) {
+        assert(pg->blocks[i] != BLOCK_DELAYED, "page_make_reqs: delayed block");
+        if(pg->blocks[i] == 0) {
+            i++;
+            continue;
+        }
+        for(j = i + 1; j < BLOCK_PER_PAGE && pg->blocks[j] == pg->blocks[j-1] + 1; j++);
+        reqs[n].block_num = pg->blocks[i];
+        reqs[n].len = (j - i) * BLOCK_SIZE;
+        reqs[n].data = (void*)(pg->pa + i * BLOCK_SIZE);
+        n++;
+        i = j;
+    }
+    return n;
+}
+
+// 确定页内每个block的磁盘位置 (文件范围之外的block为0)
+// 调用者需持有ip->slk
+static void page_map_blocks(inode_t* ip, page_t* pg)
+{
+    uint32 nblocks = (ip->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32 bn = pg->index * BLOCK_PER_PAGE;
+    uint32 i = 0, block, len;
+
+    // 一次查询得到磁盘上连续的一段
+    while(i < BLOCK_PER_PAGE) {
+        if(bn >= nblocks) {
+            pg->blocks[i++] = 0;
+            continue;
+        }
+        block = inode_map_run(ip, bn, &len);
+        for(; len > 0 && i < BLOCK_PER_PAGE && bn < nblocks; len--, i++, bn++)
+            pg->blocks[i] = block++;
+    }
+}
+
+// 写回LRU里最久未用的脏页 (它可能属于其他inode)
+// 写回期间持有引用, 页不会被淘汰; 所需的block_num已记录在页里, 无需对方的inode锁
+// 延迟分配的页需要对方的inode锁才能分配, 跳过
+// 没有脏页可写回返回false
+static bool page_writeback_one()
+{
+    page_t* pg;
+    vio_req_t reqs[BLOCK_PER_PAGE];
+
+    spinlock_acquire(&lk_pcache);
+    for(pg = lru_head.prev; pg != &lru_head; pg = pg->prev)
+        if(pg->dirty && !pg->delayed)
+            break;
+    if(pg == &lru_head) {
+        spinlock_release(&lk_pcache);
+        return false;
+    }
+    page_hold(pg);
+    pg->dirty = false;
+    pg->writeback = true;
+    spinlock_release(&lk_pcache);
+
+    virtio_disk_rw_reqs(reqs, page_make_reqs(pg, reqs), true);
+
+    spinlock_acquire(&lk_pcache);
+    pg->writeback = false;
+    proc_wakeup(pg);
+    page_release(pg, false);
+    spinlock_release(&lk_pcache);
+    return true;
+}
+
+/*--------------------------- 对外接口 ---------------------------*/
+
+/*
+    获取ip的第index页 (ref++)
+    页不在缓存时申请一个新页:
+      fill = true  从磁盘读入文件内容 (文件范围之外补0)
+      fill = false 调用者会覆盖整页, 只补0不读盘
+    调用者需持有ip->slk, 用完后调用pcache_put
+    页缓存的页全部被引用(或只剩延迟分配的脏页)时返回NULL
+*/
+page_t* pcache_get(inode_t* ip, uint32 index, bool fill)
+{
+    assert(sleeplock_holding(&ip->slk), "pcache_get: not holding lock");
+    assert(!(ip->flags & INODE_F_INLINE), "pcache_get: inline inode");
+
+    page_t** slot;
+    page_t* pg;
+
+    spinlock_acquire(&lk_pcache);
+
+    slot = tree_slot(ip, index, false);
+    if(slot != NULL && *slot != NULL) {
+        pg = *slot;
+        page_hold(pg);
+        spinlock_release(&lk_pcache);
+        return pg;
+    }
+
+    // 只有持有ip->slk的人会向ip的树里插入, 放锁写回期间不会有人插入同一页
+    while((pg = page_alloc()) == NULL) {
+        spinlock_release(&lk_pcache);
+        if(!page_writeback_one())
+            return NULL;
+        spinlock_acquire(&lk_pcache);
+    }
+    pg->ip = ip;
+    pg->index = index;
+    pg->dirty = false;
+    *tree_slot(ip, index, true) = pg;
+
+    spinlock_release(&lk_pcache);
+
+    memset((void*)pg->pa, 0, PGSIZE);
+    page_map_blocks(ip, pg);
+    if(fill) {
+        vio_req_t reqs[BLOCK_PER_PAGE];
+        uint32 n = page_make_reqs(pg, reqs);
+        if(n > 0)
+            virtio_disk_rw_reqs(reqs, n, false);
+    }
+    return pg;
+}
+
+// 归还页 (ref--), dirty = true 表示调用者修改了页内容
+// 页已经被丢弃时修改不再写回
+void pcache_put(page_t* pg, bool dirty)
+{
+    spinlock_acquire(&lk_pcache);
+    if(dirty && pg->ip != NULL)
+        pg->dirty = true;
+    page_release(pg, true);
+    spinlock_release(&lk_pcache);
+}
+
+// 通过物理地址找到页描述符 (用户页表里MAP_SHARED映射的页, 可能已经被丢弃)
+// 找不到返回NULL
+page_t* pcache_find(uint64 pa)
+{
+    int i = pa_index(pa);
+    if(i < 0)
+        return NULL;
+
+    spinlock_acquire(&lk_pcache);
+    page_t* pg = pa_page[i];
+    if(pg != NULL && pg->ip == NULL && pg->ref == 0)
+        pg = NULL;
+    spinlock_release(&lk_pcache);
+    return pg;
+}
+
+// ref++ (调用者已持有一个引用, 不需要inode锁)
+void pcache_dup(page_t* pg)
+{
+    spinlock_acquire(&lk_pcache);
+    assert(pg->ref > 0, "pcache_dup: ref");
+    pg->ref++;
+    spinlock_release(&lk_pcache);
+}
+
+/*
+    预读: 把[index, index + n)中不在缓存里的页批量读入
+    页缓存紧张(只剩脏页)时提前停止, 不会为预读写回脏页
+    调用者需持有ip->slk
+*/
+void pcache_prefetch(inode_t* ip, uint32 index, uint32 n)
+{
+    assert(sleeplock_holding(&ip->slk), "pcache_prefetch: not holding lock");
+
+    page_t* pgs[PCACHE_BATCH];
+    vio_req_t reqs[PCACHE_BATCH * BLOCK_PER_PAGE];
+    uint32 npages = (ip->size + PGSIZE - 1) / PGSIZE;
+    uint32 end = index + n;
+    bool full = false;
+
+    if(end > npages)
+        end = npages;
+
+    while(index < end && !full) {
+        uint32 cnt = 0, nreq = 0;
+
+        spinlock_acquire(&lk_pcache);
+        for(; index < end && cnt < PCACHE_BATCH; index++) {
+            page_t** slot = tree_slot(ip, index, false);
+            if(slot != NULL && *slot != NULL)
+                continue;
+            page_t* pg = page_alloc();
+            if(pg == NULL) {
+                full = true;
+                break;
+            }
+            pg->ip = ip;
+            pg->index = index;
+            pg->dirty = false;
+            *tree_slot(ip, index, true) = pg;
+            pgs[cnt++] = pg;
+        }
+        spinlock_release(&lk_pcache);
+
+        for(uint32 i = 0; i < cnt; i++) {
+            memset((void*)pgs[i]->pa, 0, PGSIZE);
+            page_map_blocks(ip, pgs[i]);
+            nreq += page_make_reqs(pgs[i], reqs + nreq);
+        }
+        if(nreq > 0)
+            virtio_disk_rw_reqs(reqs, nreq, false);
+        for(uint32 i = 0; i < cnt; i++)
+            pcache_put(pgs[i], false);
+    }
+}
+
+// 页里出现了延迟分配的block
+// 调用者需持有ip->slk和页的引用
+void pcache_set_delayed(page_t* pg)
+{
+    assert(sleeplock_holding(&pg->ip->slk), "pcache_set_delayed: not holding lock");
+
+    spinlock_acquire(&lk_pcache);
+    if(!pg->delayed) {
+        pg->delayed = true;
+        n_delayed++;
+    }
+    spinlock_release(&lk_pcache);
+}
+
+// 等待page_writeback_one对这一页的写回结束
+// 调用者持有页的引用 (此后不会开始新的写回), 在修改blocks[]和页内数据之前调用
+void pcache_wait_writeback(page_t* pg)
+{
+    spinlock_acquire(&lk_pcache);
+    while(pg->writeback)
+        proc_sleep(pg, &lk_pcache);
+    spinlock_release(&lk_pcache);
+}
+
+// 含有延迟block的页数
+uint32 pcache_delayed_pages()
+{
+    return n_delayed;
+}
+
+/*
+    为ip所有延迟分配的block分配磁盘位置
+    先把预留的一部分换成一个预分配窗口(尽量连续的一段), 再按页号从小到大逐个映射
+    这样同时写入的多个文件不会在磁盘上交错
+    调用者需持有ip->slk, 并处于日志操作中
+*/
+void pcache_alloc_delayed(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "pcache_alloc_delayed: not holding lock");
+
+    page_t* pg;
+    uint32 n = 0, next = 0;
+
+    spinlock_acquire(&lk_pcache);
+    for(pg = tree_next(ip, 0); pg != NULL; pg = tree_next(ip, pg->index + 1))
+        if(pg->delayed)
+            n += page_delayed_blocks(pg);
+    spinlock_release(&lk_pcache);
+
+    if(n == 0)
+        return;
+    // 页里预留的DALLOC_RESERVE(n)个block交给ip->rsv, 用于数据和元数据
+    inode_prealloc(ip, n);
+
+    while(1) {
+        // 页号不小于next的第一个延迟页 (基数树按页号有序)
+        page_t* min;
+        spinlock_acquire(&lk_pcache);
+        for(min = tree_next(ip, next); min != NULL && !min->delayed; min = tree_next(ip, min->index + 1))
+            ;
+        if(min == NULL) {
+            spinlock_release(&lk_pcache);
+            break;
+        }
+        // 持有引用期间不会被写回
+        page_hold(min);
+        min->delayed = false;
+        n_delayed--;
+        spinlock_release(&lk_pcache);
+
+        for(uint32 i = 0; i < BLOCK_PER_PAGE; i++)
+            if(min->blocks[i] == BLOCK_DELAYED)
+                min->blocks[i] = inode_locate_block(ip, min->index * BLOCK_PER_PAGE + i);
+        next = min->index + 1;
+        pcache_put(min, false);
+    }
+
+    inode_prealloc_end(ip);
+    inode_rw(ip, true);
+}
+
+/*
+    把ip的所有脏页写回磁盘 (每批PCACHE_BATCH页一起提交)
+    延迟分配的block先分配位置
+    调用者需持有ip->slk, 并处于日志操作中
+*/
+void pcache_flush(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "pcache_flush: not holding lock");
+
+    pcache_alloc_delayed(ip);
+
+    page_t* pgs[PCACHE_BATCH];
+    vio_req_t reqs[PCACHE_BATCH * BLOCK_PER_PAGE];
+
+    uint32 next = 0;
+
+    while(1) {
+        uint32 cnt = 0, nreq = 0;
+
+        spinlock_acquire(&lk_pcache);
+        for(page_t* pg = tree_next(ip, next); pg != NULL && cnt < PCACHE_BATCH; pg = tree_next(ip, next)) {
+            next = pg->index + 1;
+            if(!pg->dirty)
+                continue;
+            page_hold(pg);
+            pg->dirty = false;
+            pgs[cnt++] = pg;
+        }
+        spinlock_release(&lk_pcache);
+
+        if(cnt == 0)
+            break;
+
+        for(uint32 i = 0; i < cnt; i++)
+            nreq += page_make_reqs(pgs[i], reqs + nreq);
+        if(nreq > 0)
+            virtio_disk_rw_reqs(reqs, nreq, true);
+        for(uint32 i = 0; i < cnt; i++)
+            pcache_put(pgs[i], false);
+    }
+}
+
+/*
+    丢弃ip的所有页 (不写回), 用于截断/删除文件和inode被复用
+    仍被引用的页(管道, 用户映射)只从基数树上摘下, 由最后一个pcache_put归还,
+    不能等这些引用: 它们可能要等到同一个进程读管道或解除映射, 而调用者持有inode锁和日志操作
+    只等待正在进行的写回, 否则写操作可能落到随后被释放的block上 (磁盘I/O总会完成)
+    调用者需持有ip->slk
+*/
+void pcache_drop(inode_t* ip)
+{
+    assert(sleeplock_holding(&ip->slk), "pcache_drop: not holding lock");
+
+    page_t* pg;
+    uint32 next = 0;
+
+    spinlock_acquire(&lk_pcache);
+    while((pg = tree_next(ip, next)) != NULL) {
+        // 睡眠期间页可能被淘汰, 醒来后重新查找
+        if(pg->writeback) {
+            proc_sleep(pg, &lk_pcache);
+            continue;
+        }
+        next = pg->index + 1;
+        if(pg->ref != 0) {
+            page_detach(pg);
+            continue;
+        }
+        lru_remove(pg);
+        page_detach(pg);
+        pg->next = free_list;
+        free_list = pg;
+    }
+    assert(ip->pages == NULL, "pcache_drop: tree not empty");
+    spinlock_release(&lk_pcache);
+}
+
+// 输出页缓存的使用情况
+// 被引用的页数 (包括用户页表映射着的页)
+uint32 pcache_referenced()
+{
+    return n_referenced;
+}
+
+// for debug
+void pcache_print()
+{
+    uint32 used = 0, dirty = 0, busy = 0, delayed = 0;
+
+    spinlock_acquire(&lk_pcache);
+    for(page_t* pg = pages; pg < pages + N_PCACHE_PAGE; pg++) {
+        if(pg->ip == NULL)
+            continue;
+        used++;
+        if(pg->dirty) dirty++;
+        if(pg->ref) busy++;
+        if(pg->delayed) delayed++;
+    }
+    spinlock_release(&lk_pcache);
+
+    printf("pcache: used = %d, dirty = %d, delayed = %d, referenced = %d, total = %d\n",
+           used, dirty, delayed, busy, N_PCACHE_PAGE);
+}
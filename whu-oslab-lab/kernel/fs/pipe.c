@@ -0,0 +1,431 @@
+#include "fs/pipe.h"
+#include "fs/file.h"
+#include "fs/inode.h"
+#include "fs/pcache.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "proc/cpu.h"
+#include "lib/print.h"
+#include "lib/str.h"
+
+// 管道池 + 保护used字段的锁
+static pipe_t pipes[N_PIPE];
+static spinlock_t lk_pipes;
+
+// 管道池初始化
+void pipe_init()
+{
+    spinlock_init(&lk_pipes, "pipes");
+    for(int i = 0; i < N_PIPE; i++) {
+        spinlock_init(&pipes[i].lk, "pipe");
+        sleeplock_init(&pipes[i].rslk, "pipe_read");
+        sleeplock_init(&pipes[i].wslk, "pipe_write");
+        pipes[i].used = false;
+    }
+}
+
+// 累计序号i对应的缓冲槽
+static inline pipe_buf_t* pipe_buf(pipe_t* pi, uint32 i)
+{
+    return &pi->bufs[i % PIPE_PAGES];
+}
+
+/*
+    释放环里已经读完的槽, 归还页缓存的引用
+    写者可能正往最后一个槽(管道自己的页)里追加, keep_last = true 时只要它还有空闲部分就保留
+    持有wslk的写者调用时传false
+    环从满变成不满时唤醒写者
+    调用者需持有pi->lk
+*/
+static void pipe_retire(pipe_t* pi, bool keep_last)
+{
+    bool full = (pi->head - pi->tail == PIPE_PAGES);
+    uint32 old = pi->tail;
+
+    while(pi->tail != pi->head) {
+        pipe_buf_t* b = pipe_buf(pi, pi->tail);
+        if(b->len != 0)
+            break;
+        if(keep_last && pi->tail + 1 == pi->head && b->pg == NULL && b->off < PGSIZE)
+            break;
+        if(b->pg != NULL) {
+            pcache_put(b->pg, false);
+            b->pg = NULL;
+        }
+        pi->tail++;
+    }
+
+    if(full && pi->tail != old)
+        proc_wakeup(&pi->tail);
+}
+
+// 归还管道的缓冲页和管道本身
+static void pipe_free(pipe_t* pi)
+{
+    for(uint32 i = pi->tail; i != pi->head; i++) {
+        pipe_buf_t* b = pipe_buf(pi, i);
+        if(b->pg != NULL)
+            pcache_put(b->pg, false);
+        b->pg = NULL;
+    }
+    for(int i = 0; i < PIPE_PAGES; i++) {
+        if(pi->pages[i] != 0)
+            pmem_free(pi->pages[i], true);
+        pi->pages[i] = 0;
+    }
+    spinlock_acquire(&lk_pipes);
+    pi->used = false;
+    spinlock_release(&lk_pipes);
+}
+
+// 创建管道, 读端和写端的file通过rf和wf返回
+// 成功返回0 失败返回-1
+int pipe_alloc(file_t** rf, file_t** wf)
+{
+    pipe_t* pi = NULL;
+
+    spinlock_acquire(&lk_pipes);
+    for(int i = 0; i < N_PIPE; i++) {
+        if(!pipes[i].used) {
+            pi = &pipes[i];
+            pi->used = true;
+            break;
+        }
+    }
+    spinlock_release(&lk_pipes);
+    if(pi == NULL)
+        return -1;
+
+    pi->head = 0;
+    pi->tail = 0;
+    pi->size = 0;
+    for(int i = 0; i < PIPE_PAGES; i++) {
+        pi->bufs[i].pg = NULL;
+        pi->pages[i] = (uint64)pmem_alloc(true);
+        if(pi->pages[i] == 0) {
+            pipe_free(pi);
+            return -1;
+        }
+    }
+    pi->readopen = true;
+    pi->writeopen = true;
+
+    *rf = file_alloc();
+    *wf = file_alloc();
+    if(*rf == NULL || *wf == NULL) {
+        // 还没有和管道关联, file_close只归还file_t
+        if(*rf != NULL)
+            file_close(*rf);
+        if(*wf != NULL)
+            file_close(*wf);
+        pipe_free(pi);
+        return -1;
+    }
+
+    (*rf)->type = FD_PIPE;
+    (*rf)->readable = true;
+    (*rf)->pipe = pi;
+
+    (*wf)->type = FD_PIPE;
+    (*wf)->writable = true;
+    (*wf)->pipe = pi;
+
+    return 0;
+}
+
+// 关闭管道的一端 (writable = true 表示写端), 两端都关闭后释放管道
+void pipe_close(pipe_t* pi, bool writable)
+{
+    spinlock_acquire(&pi->lk);
+    if(writable) {
+        pi->writeopen = false;
+        proc_wakeup(&pi->head);
+    } else {
+        pi->readopen = false;
+        proc_wakeup(&pi->tail);
+    }
+    bool dead = !pi->readopen && !pi->writeopen;
+    spinlock_release(&pi->lk);
+
+    if(dead)
+        pipe_free(pi);
+}
+
+/*
+    消费管道里最多len字节: 每段数据交给actor处理 (不持有自旋锁)
+    管道为空时等待, 直到有数据或写端关闭; 有多少处理多少, 不等凑满len
+    actor处理的字节数少于给它的字节数时停止
+    返回处理掉的字节数 (写端关闭且没有数据时返回0)
+*/
+uint32 pipe_drain(pipe_t* pi, uint32 len, pipe_actor_t actor, void* ctx)
+{
+    uint32 ret = 0;
+
+    sleeplock_acquire(&pi->rslk);
+    spinlock_acquire(&pi->lk);
+    while(pi->size == 0 && pi->writeopen)
+        proc_sleep(&pi->head, &pi->lk);
+
+    while(ret < len && pi->size > 0) {
+        // 释放读完的槽后, tail处的槽一定有数据
+        pipe_retire(pi, true);
+        uint32 i = pi->tail;
+        pipe_buf_t* b = pipe_buf(pi, i);
+        uint64 kaddr = b->pa + b->off;
+        uint32 n = b->len;
+        if(n > len - ret)
+            n = len - ret;
+        spinlock_release(&pi->lk);
+
+        uint32 cnt = actor(ctx, kaddr, n);
+
+        spinlock_acquire(&pi->lk);
+        b->off += cnt;
+        b->len -= cnt;
+        pi->size -= cnt;
+        ret += cnt;
+        pipe_retire(pi, true);
+        if(cnt != n)
+            break;
+    }
+    spinlock_release(&pi->lk);
+    sleeplock_release(&pi->rslk);
+
+    return ret;
+}
+
+// pipe_read的actor: 拷贝到dst (用户地址或内核地址)
+typedef struct pipe_copy_ctx {
+    uint64 dst;
+    bool user;
+} pipe_copy_ctx_t;
+
+static uint32 pipe_copy_actor(void* ctx, uint64 kaddr, uint32 n)
+{
+    pipe_copy_ctx_t* c = (pipe_copy_ctx_t*)ctx;
+    if(c->user)
+        uvm_copyout(myproc()->pgtbl, c->dst, kaddr, n);
+    else
+        memmove((void*)c->dst, (void*)kaddr, n);
+    c->dst += n;
+    return n;
+}
+
+// 从管道读出最多len字节, 返回读出的字节数
+uint32 pipe_read(pipe_t* pi, uint32 len, uint64 dst, bool user)
+{
+    pipe_copy_ctx_t ctx = { .dst = dst, .user = user };
+    return pipe_drain(pi, len, pipe_copy_actor, &ctx);
+}
+
+/*
+    为写入找到空闲空间: 最后一个槽是管道自己的页且没写满时追加, 否则占用一个新槽
+    返回可写的字节数 (0表示环满), 槽的序号和写入位置通过参数返回
+    调用者需持有pi->lk和pi->wslk
+*/
+static uint32 pipe_reserve(pipe_t* pi, uint32* idx, uint64* kaddr)
+{
+    pipe_retire(pi, false);
+
+    if(pi->head != pi->tail) {
+        pipe_buf_t* b = pipe_buf(pi, pi->head - 1);
+        if(b->pg == NULL && b->off + b->len < PGSIZE) {
+            *idx = pi->head - 1;
+            *kaddr = b->pa + b->off + b->len;
+            return PGSIZE - b->off - b->len;
+        }
+    }
+    if(pi->head - pi->tail == PIPE_PAGES)
+        return 0;
+
+    pipe_buf_t* b = pipe_buf(pi, pi->head);
+    b->pa = pi->pages[pi->head % PIPE_PAGES];
+    b->off = 0;
+    b->len = 0;
+    b->pg = NULL;
+    *idx = pi->head++;
+    *kaddr = b->pa;
+    return PGSIZE;
+}
+
+// 槽idx新增了n字节数据, 管道从空变成非空时唤醒读者
+// 调用者需持有pi->lk
+static void pipe_commit(pipe_t* pi, uint32 idx, uint32 n)
+{
+    if(pi->size == 0 && n > 0)
+        proc_wakeup(&pi->head);
+    pipe_buf(pi, idx)->len += n;
+    pi->size += n;
+}
+
+// pipe_write的主体, 调用者需持有pi->wslk
+static uint32 pipe_write_locked(pipe_t* pi, uint32 len, uint64 src, bool user)
+{
+    uint32 ret = 0, idx, n;
+    uint64 kaddr;
+
+    while(ret < len) {
+        spinlock_acquire(&pi->lk);
+        while((n = pipe_reserve(pi, &idx, &kaddr)) == 0 && pi->readopen)
+            proc_sleep(&pi->tail, &pi->lk);
+        if(!pi->readopen) {
+            spinlock_release(&pi->lk);
+            break;
+        }
+        spinlock_release(&pi->lk);
+
+        if(n > len - ret)
+            n = len - ret;
+        if(user)
+            uvm_copyin(myproc()->pgtbl, kaddr, src + ret, n);
+        else
+            memmove((void*)kaddr, (void*)(src + ret), n);
+
+        spinlock_acquire(&pi->lk);
+        pipe_commit(pi, idx, n);
+        spinlock_release(&pi->lk);
+
+        ret += n;
+    }
+    return ret;
+}
+
+// 向管道写入len字节
+// 环满时等待读者, 每次拷贝尽可能多的字节
+// 返回写入的字节数 (读端关闭时可能少于len)
+uint32 pipe_write(pipe_t* pi, uint32 len, uint64 src, bool user)
+{
+    sleeplock_acquire(&pi->wslk);
+    uint32 ret = pipe_write_locked(pi, len, src, user);
+    sleeplock_release(&pi->wslk);
+    return ret;
+}
+
+// 把页缓存的页pg中[off, off + len)放进一个新槽, 调用者持有的引用转交给管道
+// 成功返回0, 读端已关闭返回-1 (引用仍归调用者)
+// 调用者需持有pi->wslk
+static int pipe_push_page(pipe_t* pi, page_t* pg, uint32 off, uint32 len)
+{
+    spinlock_acquire(&pi->lk);
+    pipe_retire(pi, false);
+    while(pi->head - pi->tail == PIPE_PAGES && pi->readopen) {
+        proc_sleep(&pi->tail, &pi->lk);
+        pipe_retire(pi, false);
+    }
+    if(!pi->readopen) {
+        spinlock_release(&pi->lk);
+        return -1;
+    }
+
+    pipe_buf_t* b = pipe_buf(pi, pi->head);
+    b->pa = pg->pa;
+    b->off = off;
+    b->len = 0;
+    b->pg = pg;
+    pipe_commit(pi, pi->head++, len);
+    spinlock_release(&pi->lk);
+    return 0;
+}
+
+/*
+    把普通文件in从当前偏移开始的最多len字节放进管道 (splice)
+    页缓存的页直接放进缓冲槽, 不拷贝数据; 内联文件没有页缓存, 拷贝进管道自己的页
+    环满时等待读者
+    返回放进管道的字节数 (到达文件末尾或读端关闭时可能少于len)
+*/
+uint32 pipe_splice_in(pipe_t* pi, file_t* in, uint32 len)
+{
+    inode_t* ip = in->ip;
+    uint32 ret = 0;
+
+    sleeplock_acquire(&pi->wslk);
+    while(ret < len) {
+        inode_lock(ip);
+        uint32 off = in->offset;
+        if(off >= ip->size) {
+            inode_unlock(ip);
+            break;
+        }
+        uint32 n = len - ret;
+        if(n > ip->size - off)
+            n = ip->size - off;
+
+        if(ip->flags & INODE_F_INLINE) {
+            char tmp[INODE_INLINE_MAX];
+            n = inode_read_data(ip, off, n, tmp, false);
+            inode_unlock(ip);
+            n = pipe_write_locked(pi, n, (uint64)tmp, false);
+        } else {
+            inode_readahead(ip, &in->ra, off, n);
+            if(n > PGSIZE - off % PGSIZE)
+                n = PGSIZE - off % PGSIZE;
+            page_t* pg = pcache_get(ip, off / PGSIZE, true);
+            inode_unlock(ip);
+            if(pg == NULL) {
+                n = 0;
+            } else if(pipe_push_page(pi, pg, off % PGSIZE, n) < 0) {
+                pcache_put(pg, false);
+                n = 0;
+            }
+        }
+
+        in->offset += n;
+        ret += n;
+        if(n == 0)
+            break;
+    }
+    sleeplock_release(&pi->wslk);
+
+    return ret;
+}
+
+/*
+    把管道in里最多len字节复制到管道out, 不消费in的数据 (tee)
+    页缓存的页只增加引用, 管道自己的页没有引用计数, 拷贝数据
+    in为空时等待, 只复制调用时已有的数据
+    返回复制的字节数
+*/
+uint32 pipe_tee(pipe_t* in, pipe_t* out, uint32 len)
+{
+    uint32 ret = 0;
+
+    sleeplock_acquire(&in->rslk);
+    sleeplock_acquire(&out->wslk);
+
+    spinlock_acquire(&in->lk);
+    while(in->size == 0 && in->writeopen)
+        proc_sleep(&in->head, &in->lk);
+    pipe_retire(in, true);
+    uint32 head = in->head;
+    uint32 i = in->tail;
+    spinlock_release(&in->lk);
+
+    // 持有in->rslk, 没有人能消费或释放[tail, head)里的槽, 槽里已有的数据不会变
+    for(; i != head && ret < len; i++) {
+        spinlock_acquire(&in->lk);
+        pipe_buf_t b = *pipe_buf(in, i);
+        spinlock_release(&in->lk);
+
+        uint32 n = b.len;
+        if(n > len - ret)
+            n = len - ret;
+        if(n == 0)
+            continue;
+
+        if(b.pg != NULL) {
+            pcache_dup(b.pg);
+            if(pipe_push_page(out, b.pg, b.off, n) < 0) {
+                pcache_put(b.pg, false);
+                break;
+            }
+        } else if(pipe_write_locked(out, n, b.pa + b.off, false) != n) {
+            break;
+        }
+        ret += n;
+    }
+
+    sleeplock_release(&out->wslk);
+    sleeplock_release(&in->rslk);
+
+    return ret;
+}
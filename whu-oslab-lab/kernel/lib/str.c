@@ -1,14 +1,152 @@
 #include "common.h"
 #include "lib/str.h"
 
+/*
+    memset / memmove / memcmp 按8字节的字处理:
+    先逐字节走到8字节对齐, 中间每轮处理4个字(32字节), 剩下不足一个字的部分再逐字节
+    memmove和memcmp只有在两个地址的低3位相同时才能同时对齐, 否则退回逐字节
+    编译时定义STR_RVV (make RVV=1) 则长度不小于RVV_MIN的操作改用V扩展的向量指令
+*/
+
+#define WSIZE  sizeof(uint64)
+#define WMASK  (WSIZE - 1)
+
+// 可以和任何类型互为别名的字, 避免按字访问时被编译器当成违反别名规则
+typedef uint64 __attribute__((may_alias)) word_t;
+
+#ifdef STR_RVV
+
+#include "lib/lock.h"
+
+#define RVV_MIN 64
+
+/*
+    向量寄存器不属于进程上下文 (swtch和trapframe都不保存), 所以:
+    1. 只在内联汇编里用 .option arch 临时打开V扩展, 编译器不会在别处生成向量指令
+    2. 使用期间push_off关中断, 不会在中途被时钟中断切换到另一个也在用向量寄存器的内核线程
+    每轮vsetvli按剩余长度取vl (e8, m8: 8个向量寄存器一组)
+*/
+
+static void
+rvv_memset(uint8 *d, int c, uint32 n)
+{
+  uint64 vl;
+
+  push_off();
+  while(n > 0){
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vsetvli %0, %1, e8, m8, ta, ma\n"
+                 "vmv.v.x v8, %2\n"
+                 "vse8.v v8, (%3)\n"
+                 ".option pop"
+                 : "=&r"(vl) : "r"((uint64)n), "r"(c), "r"(d) : "memory");
+    d += vl;
+    n -= vl;
+  }
+  pop_off();
+}
+
+// 每轮先把整段读进向量寄存器再写, 所以重叠时只需要决定从前往后还是从后往前
+static void
+rvv_memmove(uint8 *d, const uint8 *s, uint32 n)
+{
+  uint64 vl;
+  bool backward = (s < d && s + n > d);
+
+  push_off();
+  while(n > 0){
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vsetvli %0, %1, e8, m8, ta, ma\n"
+                 ".option pop"
+                 : "=r"(vl) : "r"((uint64)n));
+    n -= vl;
+    const uint8 *from = backward ? s + n : s;
+    uint8 *to = backward ? d + n : d;
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vle8.v v8, (%0)\n"
+                 "vse8.v v8, (%1)\n"
+                 ".option pop"
+                 : : "r"(from), "r"(to) : "memory");
+    if(!backward){
+      s += vl;
+      d += vl;
+    }
+  }
+  pop_off();
+}
+
+// 找到第一个不同的字节返回其下标, 全部相同返回-1
+static int64
+rvv_memcmp(const uint8 *s1, const uint8 *s2, uint32 n)
+{
+  uint64 vl;
+  int64 idx, base = 0;
+
+  push_off();
+  while(n > 0){
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vsetvli %0, %2, e8, m8, ta, ma\n"
+                 "vle8.v v8, (%3)\n"
+                 "vle8.v v16, (%4)\n"
+                 "vmsne.vv v0, v8, v16\n"
+                 "vfirst.m %1, v0\n"
+                 ".option pop"
+                 : "=&r"(vl), "=&r"(idx)
+                 : "r"((uint64)n), "r"(s1 + base), "r"(s2 + base) : "memory");
+    if(idx >= 0){
+      pop_off();
+      return base + idx;
+    }
+    base += vl;
+    n -= vl;
+  }
+  pop_off();
+  return -1;
+}
+
+#endif
+
 void*
 memset(void *dst, int c, uint32 n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint8 *d = (uint8 *) dst;
+
+#ifdef STR_RVV
+  if(n >= RVV_MIN){
+    rvv_memset(d, c, n);
+    return dst;
+  }
+#endif
+
+  while(n > 0 && ((uint64)d & WMASK)){
+    *d++ = c;
+    n--;
+  }
+
+  if(n >= WSIZE){
+    word_t *wd = (word_t *) d;
+    uint64 w = (uint8) c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+
+    for(; n >= 4 * WSIZE; n -= 4 * WSIZE, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (uint8 *) wd;
   }
+
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -19,6 +157,32 @@ memcmp(const void *v1, const void *v2, uint32 n)
 
   s1 = v1;
   s2 = v2;
+
+#ifdef STR_RVV
+  if(n >= RVV_MIN){
+    int64 i = rvv_memcmp((const uint8 *) s1, (const uint8 *) s2, n);
+    return i < 0 ? 0 : s1[i] - s2[i];
+  }
+#endif
+
+  // 按字比较找到第一个不同的字, 再交给下面逐字节比较得到返回值
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while(n > 0 && ((uint64)s1 & WMASK)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    const word_t *w1 = (const word_t *) s1;
+    const word_t *w2 = (const word_t *) s2;
+    for(; n >= 4 * WSIZE; n -= 4 * WSIZE, w1 += 4, w2 += 4)
+      if(w1[0] != w2[0] || w1[1] != w2[1] || w1[2] != w2[2] || w1[3] != w2[3])
+        break;
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    s1 = (const char *) w1;
+    s2 = (const char *) w2;
+  }
+
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -31,23 +195,69 @@ memcmp(const void *v1, const void *v2, uint32 n)
 void*
 memmove(void *dst, const void *src, uint32 n)
 {
-  const char *s;
-  char *d;
+  const uint8 *s;
+  uint8 *d;
+  uint64 w0, w1, w2, w3;
 
-  if(n == 0)
-    return dst;
-  
-  //有重叠且源在目标之前,选择从后往前复制避免覆盖还未复制的源数据
   s = src;
   d = dst;
+  if(n == 0 || s == d)
+    return dst;
+
+#ifdef STR_RVV
+  if(n >= RVV_MIN){
+    rvv_memmove(d, s, n);
+    return dst;
+  }
+#endif
+
+  bool aligned = ((((uint64)s ^ (uint64)d) & WMASK) == 0);
+
+  //有重叠且源在目标之前,选择从后往前复制避免覆盖还未复制的源数据
+  //每轮先把4个字都读出来再写, 所以按字复制时同样不会覆盖未复制的源数据
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *--d = *--s;
+        n--;
+      }
+      word_t *wd = (word_t *) d;
+      const word_t *ws = (const word_t *) s;
+      for(; n >= 4 * WSIZE; n -= 4 * WSIZE){
+        ws -= 4;
+        wd -= 4;
+        w3 = ws[3]; w2 = ws[2]; w1 = ws[1]; w0 = ws[0];
+        wd[3] = w3; wd[2] = w2; wd[1] = w1; wd[0] = w0;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      d = (uint8 *) wd;
+      s = (const uint8 *) ws;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *d++ = *s++;
+        n--;
+      }
+      word_t *wd = (word_t *) d;
+      const word_t *ws = (const word_t *) s;
+      for(; n >= 4 * WSIZE; n -= 4 * WSIZE, ws += 4, wd += 4){
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      d = (uint8 *) wd;
+      s = (const uint8 *) ws;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
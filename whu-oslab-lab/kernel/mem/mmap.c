@@ -18,7 +18,19 @@ static mmap_region_node_t list_mmap_region_node[N_MMAP];
 static mmap_region_node_t* list_head;
 static spinlock_t list_lk;
 
-// 初始化上述三个数据结构
+// 包装 mmap_file_t 用于仓库组织
+typedef struct mmap_file_node {
+    mmap_file_t mf;
+    struct mmap_file_node* next;
+} mmap_file_node_t;
+
+#define N_MMAP_FILE 64
+
+// mmap_file_node_t 仓库(单向链表) + 指向链表头节点的指针 (与mmap_region共用list_lk)
+static mmap_file_node_t list_mmap_file_node[N_MMAP_FILE];
+static mmap_file_node_t* list_file_head;
+
+// 初始化上述数据结构
 void mmap_init()
 {
     // 初始化自旋锁
@@ -33,6 +45,14 @@ void mmap_init()
         list_mmap_region_node[i].next = list_head->next;
         list_head->next = &list_mmap_region_node[i];
     }
+
+    // list_mmap_file_node[0] 作为保留的头节点
+    list_file_head = &list_mmap_file_node[0];
+    list_file_head->next = NULL;
+    for (int i = 1; i < N_MMAP_FILE; i++) {
+        list_mmap_file_node[i].next = list_file_head->next;
+        list_file_head->next = &list_mmap_file_node[i];
+    }
 }
 
 // 从仓库申请一个 mmap_region_t
@@ -80,6 +100,40 @@ void mmap_region_free(mmap_region_t* mmap)
     spinlock_release(&list_lk);
 }
 
+// 从仓库申请一个 mmap_file_t
+// 若申请失败则 panic
+mmap_file_t* mmap_file_alloc()
+{
+    spinlock_acquire(&list_lk);
+    
+    if (list_file_head->next == NULL) {
+        spinlock_release(&list_lk);
+        panic("mmap_file_alloc: no available mmap_file");
+    }
+    
+    mmap_file_node_t* node = list_file_head->next;
+    list_file_head->next = node->next;
+    
+    spinlock_release(&list_lk);
+    
+    memset(&node->mf, 0, sizeof(mmap_file_t));
+    return &node->mf;
+}
+
+// 向仓库归还一个 mmap_file_t
+// 注意: 调用者负责释放mf->file的引用
+void mmap_file_free(mmap_file_t* mf)
+{
+    if (mf == NULL) return;
+    
+    mmap_file_node_t* node = (mmap_file_node_t*)mf;
+    
+    spinlock_acquire(&list_lk);
+    node->next = list_file_head->next;
+    list_file_head->next = node;
+    spinlock_release(&list_lk);
+}
+
 // 输出仓库里可用的 mmap_region_node_t
 // for debug
 void mmap_show_mmaplist()
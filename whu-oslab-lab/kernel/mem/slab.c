@@ -0,0 +1,112 @@
+#include "mem/slab.h"
+#include "mem/pmem.h"
+#include "lib/print.h"
+#include "riscv.h"
+
+// 对象区在slab_t之后, 按8字节对齐
+#define SLAB_OBJ_BEGIN  ((sizeof(slab_t) + 7) & ~7ul)
+
+// 初始化一个cache (不预先分配slab)
+void slab_cache_init(slab_cache_t* cache, char* name, uint32 objsize)
+{
+    spinlock_init(&cache->lk, name);
+    cache->name = name;
+    cache->objsize = (objsize < sizeof(void*) ? sizeof(void*) : objsize + 7) & ~7u;
+    cache->perslab = (PGSIZE - SLAB_OBJ_BEGIN) / cache->objsize;
+    assert(cache->perslab > 0, "slab_cache_init: object too large");
+    cache->partial = NULL;
+    cache->nslab = 0;
+}
+
+// 把slab放到partial链表头
+static void slab_link(slab_cache_t* cache, slab_t* s)
+{
+    s->prev = NULL;
+    s->next = cache->partial;
+    if(cache->partial != NULL)
+        cache->partial->prev = s;
+    cache->partial = s;
+}
+
+// 把slab从partial链表摘下
+static void slab_unlink(slab_cache_t* cache, slab_t* s)
+{
+    if(s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        cache->partial = s->next;
+    if(s->next != NULL)
+        s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+// 申请一页切成对象, 串成空闲链表
+// 失败返回NULL
+static slab_t* slab_grow(slab_cache_t* cache)
+{
+    slab_t* s = (slab_t*)pmem_alloc(true);
+    if(s == NULL)
+        return NULL;
+
+    s->free = NULL;
+    s->inuse = 0;
+    uint64 obj = (uint64)s + SLAB_OBJ_BEGIN + (uint64)(cache->perslab - 1) * cache->objsize;
+    for(uint32 i = 0; i < cache->perslab; i++, obj -= cache->objsize) {
+        *(void**)obj = s->free;
+        s->free = (void*)obj;
+    }
+    cache->nslab++;
+    return s;
+}
+
+// 分配一个对象 (内容未初始化)
+// 内核内存耗尽时返回NULL
+void* slab_alloc(slab_cache_t* cache)
+{
+    spinlock_acquire(&cache->lk);
+
+    slab_t* s = cache->partial;
+    if(s == NULL) {
+        s = slab_grow(cache);
+        if(s == NULL) {
+            spinlock_release(&cache->lk);
+            return NULL;
+        }
+        slab_link(cache, s);
+    }
+
+    void* obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == NULL)
+        slab_unlink(cache, s);
+
+    spinlock_release(&cache->lk);
+    return obj;
+}
+
+// 释放一个对象
+// slab全部空闲且cache还有别的partial slab时, 把这一页还给pmem
+void slab_free(slab_cache_t* cache, void* obj)
+{
+    slab_t* s = (slab_t*)PG_ROUND_DOWN((uint64)obj);
+
+    spinlock_acquire(&cache->lk);
+    assert(s->inuse > 0, "slab_free: inuse");
+
+    if(s->free == NULL)
+        slab_link(cache, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->inuse--;
+
+    if(s->inuse == 0 && (s->prev != NULL || s->next != NULL)) {
+        slab_unlink(cache, s);
+        cache->nslab--;
+        spinlock_release(&cache->lk);
+        pmem_free((uint64)s, true);
+        return;
+    }
+
+    spinlock_release(&cache->lk);
+}
@@ -2,13 +2,26 @@
 #include "mem/pmem.h"
 #include "mem/vmem.h"
 #include "proc/cpu.h"
+#include "fs/file.h"
+#include "fs/pcache.h"
+#include "fs/log.h"
 #include "lib/print.h"
 #include "lib/str.h"
 #include "memlayout.h"
 #include "riscv.h"
 
+// 查找va所在的文件映射, 找不到返回NULL
+static mmap_file_t* mmap_file_find(mmap_file_t* mfile, uint64 va)
+{
+    for (; mfile != NULL; mfile = mfile->next)
+        if (va >= mfile->begin && va < mfile->begin + mfile->npages * PGSIZE)
+            return mfile;
+    return NULL;
+}
+
 // 连续虚拟空间的复制(在uvm_copy_pgtbl中使用)
-static void copy_range(pgtbl_t old, pgtbl_t new, uint64 begin, uint64 end)
+// 文件映射里的页(exec载入的段)由uvm_copy_pgtbl单独处理, 这里跳过
+static void copy_range(pgtbl_t old, pgtbl_t new, uint64 begin, uint64 end, mmap_file_t* mfile)
 {
     uint64 va, pa, page;
     int flags;
@@ -16,6 +29,8 @@ static void copy_range(pgtbl_t old, pgtbl_t new, uint64 begin, uint64 end)
 
     for(va = begin; va < end; va += PGSIZE)
     {
+        if(mmap_file_find(mfile, va) != NULL)
+            continue;
         pte = vm_getpte(old, va, false);
         assert(pte != NULL, "uvm_copy_pgtbl: pte == NULL");
         assert((*pte) & PTE_V, "uvm_copy_pgtbl: pte not valid");
@@ -76,7 +91,8 @@ static void destroy_pgtbl(pgtbl_t pgtbl, uint32 level)
         
         if (level == 0) {
             // 最低级页表，pte 指向物理页
-            // 释放该物理页
+            // 释放该物理页 (页缓存里的页不属于进程)
+            if (pte & PTE_SHARED) continue;
             uint64 pa = PTE_TO_PA(pte);
             pmem_free(pa, false);
         } else if (PTE_CHECK(pte)) {
@@ -100,23 +116,23 @@ void uvm_destroy_pgtbl(pgtbl_t pgtbl)
     // 解除 trampoline 映射（不释放物理页，因为是共享的）
     vm_unmappages(pgtbl, TRAMPOLINE, PGSIZE, false);
     
-    // 解除 trapframe 映射（需要释放物理页，因为是进程独有的）
-    vm_unmappages(pgtbl, TRAPFRAME, PGSIZE, true);
+    // 解除 trapframe 映射（物理页属于进程, 由proc_free释放; exec换页表时还要继续使用）
+    vm_unmappages(pgtbl, TRAPFRAME, PGSIZE, false);
     
     // 递归释放整个页表（从顶级页表 level=2 开始）
     destroy_pgtbl(pgtbl, 2);
 }
 
 // 拷贝页表 (拷贝并不包括trapframe 和 trampoline)
-void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pages, mmap_region_t* mmap)
+void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pages, mmap_region_t* mmap, mmap_file_t* mfile)
 {
     /* step-1: USER_BASE ~ heap_top (代码段+数据段+堆) */
     // 注意：用户空间从 PGSIZE 开始（跳过空白保护页）
-    copy_range(old, new, PGSIZE, heap_top);
+    copy_range(old, new, PGSIZE, heap_top, mfile);
 
     /* step-2: ustack (用户栈) */
     uint64 ustack_begin = TRAPFRAME - ustack_pages * PGSIZE;
-    copy_range(old, new, ustack_begin, TRAPFRAME);
+    copy_range(old, new, ustack_begin, TRAPFRAME, NULL);
 
     /* step-3: mmap_region (已映射的内存映射区域)*/
     // mmap链表记录的是可分配的空闲区域
@@ -128,6 +144,9 @@ void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pag
     #define MMAP_BEGIN   (MMAP_END - 8096 * PGSIZE)
     
     for (uint64 va = MMAP_BEGIN; va < MMAP_END; va += PGSIZE) {
+        // 文件映射在step-4单独处理
+        if (mmap_file_find(mfile, va) != NULL)
+            continue;
         pte_t* pte = vm_getpte(old, va, false);
         // 检查页面是否已映射
         if (pte != NULL && (*pte & PTE_V)) {
@@ -146,16 +165,41 @@ void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint32 ustack_pag
     
     #undef MMAP_END
     #undef MMAP_BEGIN
+
+    /* step-4: mmap_file (文件映射中已经载入的页) */
+    // MAP_SHARED: 父子进程映射同一个页缓存页 (ref++)
+    // MAP_PRIVATE: 拷贝私有副本
+    for (; mfile != NULL; mfile = mfile->next) {
+        for (uint32 i = 0; i < mfile->npages; i++) {
+            uint64 va = mfile->begin + i * PGSIZE;
+            pte_t* pte = vm_getpte(old, va, false);
+            if (pte == NULL || !(*pte & PTE_V))
+                continue;
+            
+            uint64 pa = (uint64)PTE_TO_PA(*pte);
+            int flags = (int)PTE_FLAGS(*pte);
+
+            if (*pte & PTE_SHARED) {
+                page_t* pg = pcache_find(pa);
+                assert(pg != NULL, "uvm_copy_pgtbl: shared page not in pcache");
+                pcache_dup(pg);
+                vm_mappages(new, va, pa, PGSIZE, flags);
+            } else {
+                uint64 page = (uint64)pmem_alloc(false);
+                if (page == 0) {
+                    panic("uvm_copy_pgtbl: out of memory for mmap_file");
+                }
+                memmove((char*)page, (const char*)pa, PGSIZE);
+                vm_mappages(new, va, page, PGSIZE, flags);
+            }
+        }
+    }
 }
 
-// 在用户页表和进程mmap链里 新增mmap区域 [begin, begin + npages * PGSIZE)
-// 页面权限为perm
-void uvm_mmap(uint64 begin, uint32 npages, int perm)
+// 从进程mmap链里扣除区域 [begin, begin + npages * PGSIZE)
+// 供uvm_mmap和uvm_mmap_file使用
+static void mmap_region_take(proc_t* p, uint64 begin, uint32 npages)
 {
-    if(npages == 0) return;
-    assert(begin % PGSIZE == 0, "uvm_mmap: begin not aligned");
-
-    proc_t* p = myproc();
     uint64 len = npages * PGSIZE;
     
     // 遍历mmap链表，从空闲区域中分割
@@ -198,6 +242,17 @@ void uvm_mmap(uint64 begin, uint32 npages, int perm)
         prev = curr;
         curr = curr->next;
     }
+}
+
+// 在用户页表和进程mmap链里 新增mmap区域 [begin, begin + npages * PGSIZE)
+// 页面权限为perm
+void uvm_mmap(uint64 begin, uint32 npages, int perm)
+{
+    if(npages == 0) return;
+    assert(begin % PGSIZE == 0, "uvm_mmap: begin not aligned");
+
+    proc_t* p = myproc();
+    mmap_region_take(p, begin, npages);
     
     // 为每个页面申请物理页并建立映射
     for (uint32 i = 0; i < npages; i++) {
@@ -211,7 +266,149 @@ void uvm_mmap(uint64 begin, uint32 npages, int perm)
     }
 }
 
+/*
+    在进程p的文件映射链里新增文件映射 [begin, begin + npages * PGSIZE)
+    只记录映射关系, 不分配物理页也不读文件 (由uvm_fault在第一次访问时完成)
+    只有前filelen字节来自文件, 之后是清零的页
+    file的引用由调用者转交给映射
+*/
+void uvm_mmap_file(proc_t* p, uint64 begin, uint32 npages, int perm, int flags, file_t* file, uint32 offset, uint32 filelen)
+{
+    if(npages == 0) return;
+    assert(begin % PGSIZE == 0 && offset % PGSIZE == 0, "uvm_mmap_file: not aligned");
+    if(filelen > npages * PGSIZE)
+        filelen = npages * PGSIZE;
+    assert(filelen == npages * PGSIZE || (flags & MAP_PRIVATE), "uvm_mmap_file: short shared mapping");
+
+    mmap_region_take(p, begin, npages);
+
+    mmap_file_t* mf = mmap_file_alloc();
+    mf->begin = begin;
+    mf->npages = npages;
+    mf->offset = offset;
+    mf->filelen = filelen;
+    mf->perm = perm;
+    mf->flags = flags;
+    mf->file = file;
+    mf->next = p->mmap_file;
+    p->mmap_file = mf;
+}
+
+/*
+    处理文件映射[lo, hi)里已经载入的页
+    MAP_SHARED: 被写过(PTE_D)的页标记为脏并写回文件
+                unmap = true 归还映射持有的页缓存引用, 否则去掉写权限以便重新记录写入
+    MAP_PRIVATE: unmap = true 时释放私有副本 (共享的只读页归还页缓存引用)
+*/
+static void mmap_file_sync(proc_t* p, mmap_file_t* mf, uint64 lo, uint64 hi, bool unmap)
+{
+    bool shared = (mf->flags & MAP_SHARED) != 0;
+    bool dirty = false;
+
+    uvm_walk_reset(p);
+
+    for (uint64 va = lo; va < hi; va += PGSIZE) {
+        pte_t* pte = vm_getpte(p->pgtbl, va, false);
+        if (pte == NULL || !(*pte & PTE_V))
+            continue;
+
+        if (!(*pte & PTE_SHARED)) {
+            if (unmap)
+                vm_unmappages(p->pgtbl, va, PGSIZE, true);
+            continue;
+        }
+        if (!shared) {
+            if (unmap) {
+                page_t* pg = pcache_find(PTE_TO_PA(*pte));
+                assert(pg != NULL, "mmap_file_sync: shared page not in pcache");
+                *pte = 0;
+                pcache_put(pg, false);
+            }
+            continue;
+        }
+
+        page_t* pg = pcache_find(PTE_TO_PA(*pte));
+        assert(pg != NULL, "mmap_file_sync: shared page not in pcache");
+        if (*pte & PTE_D) {
+            pcache_dup(pg);
+            pcache_put(pg, true);
+            dirty = true;
+        }
+        if (unmap) {
+            *pte = 0;
+            pcache_put(pg, false);
+        } else {
+            *pte &= ~(PTE_W | PTE_D);
+        }
+    }
+
+    if (dirty) {
+        inode_t* ip = mf->file->ip;
+        inode_lock(ip);
+        pcache_flush(ip);
+        inode_unlock(ip);
+    }
+}
+
+// 解除[begin, end)与文件映射的重叠部分, 必要时拆分映射
+static void mmap_file_unmap(proc_t* p, uint64 begin, uint64 end)
+{
+    mmap_file_t** pmf = &p->mmap_file;
+
+    while (*pmf != NULL) {
+        mmap_file_t* mf = *pmf;
+        uint64 mf_end = mf->begin + mf->npages * PGSIZE;
+        uint64 lo = begin > mf->begin ? begin : mf->begin;
+        uint64 hi = end < mf_end ? end : mf_end;
+
+        if (lo >= hi) {
+            pmf = &mf->next;
+            continue;
+        }
+
+        mmap_file_sync(p, mf, lo, hi, true);
+
+        if (lo == mf->begin && hi == mf_end) {
+            // 整个映射被解除
+            *pmf = mf->next;
+            file_close(mf->file);
+            mmap_file_free(mf);
+            continue;
+        } else if (lo == mf->begin) {
+            // 解除头部
+            mf->offset += hi - mf->begin;
+            mf->filelen = mf->filelen > hi - mf->begin ? mf->filelen - (hi - mf->begin) : 0;
+            mf->begin = hi;
+            mf->npages = (mf_end - hi) / PGSIZE;
+        } else if (hi == mf_end) {
+            // 解除尾部
+            mf->npages = (lo - mf->begin) / PGSIZE;
+            if (mf->filelen > lo - mf->begin)
+                mf->filelen = lo - mf->begin;
+        } else {
+            // 解除中间, 拆分成两个映射
+            mmap_file_t* tail = mmap_file_alloc();
+            tail->begin = hi;
+            tail->npages = (mf_end - hi) / PGSIZE;
+            tail->offset = mf->offset + (hi - mf->begin);
+            tail->filelen = mf->filelen > hi - mf->begin ? mf->filelen - (hi - mf->begin) : 0;
+            tail->perm = mf->perm;
+            tail->flags = mf->flags;
+            tail->file = file_dup(mf->file);
+            tail->next = mf->next;
+            mf->npages = (lo - mf->begin) / PGSIZE;
+            if (mf->filelen > lo - mf->begin)
+                mf->filelen = lo - mf->begin;
+            mf->next = tail;
+            pmf = &tail->next;
+            continue;
+        }
+        pmf = &mf->next;
+    }
+}
+
 // 在用户页表和进程mmap链里释放mmap区域 [begin, begin + npages * PGSIZE)
+// 区域内的文件映射先写回再解除
 void uvm_munmap(uint64 begin, uint32 npages)
 {
     if(npages == 0) return;
@@ -219,6 +416,11 @@ void uvm_munmap(uint64 begin, uint32 npages)
 
     proc_t* p = myproc();
     uint64 len = npages * PGSIZE;
+
+    uvm_walk_reset(p);
+
+    // 解除文件映射
+    mmap_file_unmap(p, begin, begin + len);
     
     // 创建新的空闲区域
     mmap_region_t* new_region = mmap_region_alloc();
@@ -262,8 +464,127 @@ void uvm_munmap(uint64 begin, uint32 npages)
         mmap_merge(prev, new_region, true);
     }
     
-    // 解除页表映射并释放物理页
-    vm_unmappages(p->pgtbl, begin, len, true);
+    // 解除页表映射并释放物理页 (文件映射的页已经处理过了)
+    for (uint64 va = begin; va < begin + len; va += PGSIZE) {
+        pte_t* pte = vm_getpte(p->pgtbl, va, false);
+        if (pte != NULL && (*pte & PTE_V))
+            vm_unmappages(p->pgtbl, va, PGSIZE, true);
+    }
+}
+
+// 解除进程p的所有文件映射 (进程退出和exec时调用)
+// 每个映射的写回和关闭各占一个日志操作, 调用者不能处于日志操作中
+void uvm_munmap_files(proc_t* p)
+{
+    while (p->mmap_file != NULL) {
+        mmap_file_t* mf = p->mmap_file;
+        log_begin_op();
+        mmap_file_unmap(p, mf->begin, mf->begin + mf->npages * PGSIZE);
+        log_end_op();
+    }
+}
+
+// 把[begin, begin + npages * PGSIZE)内MAP_SHARED映射被修改的页写回文件
+void uvm_msync(uint64 begin, uint32 npages)
+{
+    proc_t* p = myproc();
+    uint64 end = begin + npages * PGSIZE;
+
+    for (mmap_file_t* mf = p->mmap_file; mf != NULL; mf = mf->next) {
+        uint64 mf_end = mf->begin + mf->npages * PGSIZE;
+        uint64 lo = begin > mf->begin ? begin : mf->begin;
+        uint64 hi = end < mf_end ? end : mf_end;
+        if (lo < hi && (mf->flags & MAP_SHARED))
+            mmap_file_sync(p, mf, lo, hi, false);
+    }
+}
+
+/*
+    文件映射的缺页处理 (va不必页对齐)
+    未载入: 从页缓存取出对应的页
+            MAP_SHARED 直接映射页缓存的物理页 (持有引用直到解除映射)
+            MAP_PRIVATE 拷贝一份私有副本, filelen之后的部分清零 (filelen之后的整页不读文件)
+                        只读且整页来自文件时(程序代码)不会被修改, 和MAP_SHARED一样直接映射页缓存的页,
+                        运行同一个程序的进程共用一份代码; 页缓存被引用的页过多时退回拷贝
+    MAP_SHARED的页先不给写权限, 第一次写入时再加上PTE_W | PTE_D, 以此记录脏页
+    成功返回0 (va不属于文件映射 / 权限不符 / 超出文件末尾 / 页缓存无法提供页面 返回-1)
+*/
+int uvm_fault(uint64 va, bool write)
+{
+    proc_t* p = myproc();
+    va = PG_ROUND_DOWN(va);
+
+    mmap_file_t* mf = mmap_file_find(p->mmap_file, va);
+    if (mf == NULL)
+        return -1;
+    if (write && !(mf->perm & PTE_W))
+        return -1;
+
+    bool shared = (mf->flags & MAP_SHARED) != 0;
+    pte_t* pte = vm_getpte(p->pgtbl, va, false);
+
+    // 已经载入: 只可能是共享页的第一次写
+    if (pte != NULL && (*pte & PTE_V)) {
+        if (!write || !shared || (*pte & PTE_W))
+            return -1;
+        *pte |= PTE_W | PTE_D;
+        return 0;
+    }
+
+    // 文件内容之后的页 (ELF的bss): 直接给清零的私有页
+    uint64 off = va - mf->begin;
+    if (off >= mf->filelen) {
+        uint64 page = (uint64)pmem_alloc(false);
+        if (page == 0)
+            panic("uvm_fault: out of memory");
+        memset((void*)page, 0, PGSIZE);
+        vm_mappages(p->pgtbl, va, page, PGSIZE, mf->perm | PTE_U);
+        return 0;
+    }
+
+    inode_t* ip = mf->file->ip;
+    uint32 index = (mf->offset + off) / PGSIZE;
+
+    // copyin/copyout可能在持有这个inode锁时访问映射区
+    bool locked = sleeplock_holding(&ip->slk);
+    if (!locked)
+        inode_lock(ip);
+
+    if ((uint64)index * PGSIZE >= ip->size) {
+        if (!locked)
+            inode_unlock(ip);
+        return -1;
+    }
+
+    // MAP_SHARED的页一直被引用到解除映射, 数量不加限制会占满页缓存
+    // 达到PCACHE_MAP_MAX后共享映射缺页失败, 只读的私有映射退回拷贝
+    bool pinned = pcache_referenced() >= PCACHE_MAP_MAX;
+    page_t* pg = (shared && pinned) ? NULL : pcache_get(ip, index, true);
+    if (pg == NULL) {
+        if (!locked)
+            inode_unlock(ip);
+        return -1;
+    }
+
+    if (!shared && !(mf->perm & PTE_W) && off + PGSIZE <= mf->filelen && !pinned) {
+        vm_mappages(p->pgtbl, va, pg->pa, PGSIZE, mf->perm | PTE_U | PTE_SHARED);
+    } else if (shared) {
+        int perm = write ? (mf->perm | PTE_D) : (mf->perm & ~PTE_W);
+        vm_mappages(p->pgtbl, va, pg->pa, PGSIZE, perm | PTE_U | PTE_SHARED);
+    } else {
+        uint64 page = (uint64)pmem_alloc(false);
+        if (page == 0)
+            panic("uvm_fault: out of memory");
+        memmove((void*)page, (void*)pg->pa, PGSIZE);
+        if (off + PGSIZE > mf->filelen)
+            memset((void*)(page + mf->filelen - off), 0, off + PGSIZE - mf->filelen);
+        vm_mappages(p->pgtbl, va, page, PGSIZE, mf->perm | PTE_U);
+        pcache_put(pg, false);
+    }
+
+    if (!locked)
+        inode_unlock(ip);
+    return 0;
 }
 
 // 用户堆空间增加, 返回新的堆顶地址 (注意栈顶最大值限制)
@@ -307,11 +628,55 @@ uint64 uvm_heap_ungrow(pgtbl_t pgtbl, uint64 heap_top, uint32 len)
     if (new_aligned < old_aligned) {
         uint64 npages = (old_aligned - new_aligned) / PGSIZE;
         vm_unmappages(pgtbl, new_aligned, npages * PGSIZE, true);
+        if (myproc() != NULL && myproc()->pgtbl == pgtbl)
+            uvm_walk_reset(myproc());
     }
     
     return new_heap_top;
 }
 
+// 清空进程p的用户地址翻译缓存
+// 系统调用开始时, 以及撤销映射或收回写权限后调用
+void uvm_walk_reset(proc_t* p)
+{
+    for (int i = 0; i < N_WALK_CACHE; i++)
+        p->walk[i].va = 0;
+}
+
+/*
+    查找用户页va0对应的物理页, 失败返回0
+    当前进程文件映射里尚未载入的页先做缺页处理
+    write = true 时共享映射的页需要先取得写权限 (记录脏页)
+    当前进程的翻译结果放进p->walk, 同一次系统调用里反复访问同一页 (路径 参数 结构体)
+    不用每次都从根页表走三级
+*/
+static uint64 uvm_walk(pgtbl_t pgtbl, uint64 va0, bool write)
+{
+    proc_t* p = myproc();
+    bool mine = (p != NULL && p->pgtbl == pgtbl);
+    walk_cache_t* wc = NULL;
+
+    if (mine) {
+        wc = &p->walk[(va0 / PGSIZE) % N_WALK_CACHE];
+        if (wc->va == va0 && (!write || wc->writable))
+            return wc->pa;
+    }
+
+    pte_t* pte = vm_getpte(pgtbl, va0, false);
+    if (pte == NULL || !(*pte & PTE_V) || (write && (*pte & PTE_SHARED) && !(*pte & PTE_W))) {
+        if (!mine || uvm_fault(va0, write) < 0)
+            return 0;
+        pte = vm_getpte(pgtbl, va0, false);
+    }
+
+    if (mine && va0 != 0) {
+        wc->va = va0;
+        wc->pa = PTE_TO_PA(*pte);
+        wc->writable = !(*pte & PTE_SHARED) || (*pte & PTE_W);
+    }
+    return PTE_TO_PA(*pte);
+}
+
 // 用户态地址空间[src, src+len) 拷贝至 内核态地址空间[dst, dst+len)
 // 注意: src dst 不一定是 page-aligned
 void uvm_copyin(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len)
@@ -323,11 +688,10 @@ void uvm_copyin(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len)
         va0 = PG_ROUND_DOWN(src);
         
         // 通过页表查找物理地址
-        pte_t* pte = vm_getpte(pgtbl, va0, false);
-        if (pte == NULL || !(*pte & PTE_V)) {
+        pa0 = uvm_walk(pgtbl, va0, false);
+        if (pa0 == 0) {
             panic("uvm_copyin: invalid page");
         }
-        pa0 = PTE_TO_PA(*pte);
         
         // 计算当前页内可拷贝的字节数
         n = PGSIZE - (src - va0);
@@ -352,11 +716,10 @@ void uvm_copyout(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len)
         va0 = PG_ROUND_DOWN(dst);
         
         // 通过页表查找物理地址
-        pte_t* pte = vm_getpte(pgtbl, va0, false);
-        if (pte == NULL || !(*pte & PTE_V)) {
+        pa0 = uvm_walk(pgtbl, va0, true);
+        if (pa0 == 0) {
             panic("uvm_copyout: invalid page");
         }
-        pa0 = PTE_TO_PA(*pte);
         
         // 计算当前页内可拷贝的字节数
         n = PGSIZE - (dst - va0);
@@ -371,8 +734,31 @@ void uvm_copyout(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len)
     }
 }
 
+// s[0, n)里第一个'\0'的位置, 没有返回n
+// 对齐后每次检查8字节 (x - 0x01..01) & ~x & 0x80..80 非0说明x里有0字节
+static uint32 str_scan(const char* s, uint32 n)
+{
+    uint32 i = 0;
+
+    while (i < n && ((uint64)(s + i) & 7) != 0) {
+        if (s[i] == '\0')
+            return i;
+        i++;
+    }
+    while (i + 8 <= n) {
+        uint64 x = *(const uint64*)(s + i);
+        if ((x - 0x0101010101010101ul) & ~x & 0x8080808080808080ul)
+            break;
+        i += 8;
+    }
+    while (i < n && s[i] != '\0')
+        i++;
+    return i;
+}
+
 // 用户态字符串拷贝到内核态
 // 最多拷贝maxlen字节, 中途遇到'\0'则终止
+// 每页先找出'\0'的位置再整段拷贝
 // 注意: src dst 不一定是 page-aligned
 void uvm_copyin_str(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 maxlen)
 {
@@ -384,30 +770,25 @@ void uvm_copyin_str(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 maxlen)
         va0 = PG_ROUND_DOWN(src);
         
         // 通过页表查找物理地址
-        pte_t* pte = vm_getpte(pgtbl, va0, false);
-        if (pte == NULL || !(*pte & PTE_V)) {
+        pa0 = uvm_walk(pgtbl, va0, false);
+        if (pa0 == 0) {
             panic("uvm_copyin_str: invalid page");
         }
-        pa0 = PTE_TO_PA(*pte);
         
         // 计算当前页内可拷贝的字节数
         n = PGSIZE - (src - va0);
         if (n > maxlen) n = maxlen;
         
-        // 逐字节拷贝，遇到'\0'终止
+        // 找到'\0'则连同它一起拷贝后终止
         char* p = (char*)(pa0 + (src - va0));
-        while (n > 0) {
-            if (*p == '\0') {
-                *(char*)dst = '\0';
-                got_null = true;
-                break;
-            }
-            *(char*)dst = *p;
-            n--;
-            maxlen--;
-            p++;
-            dst++;
+        uint32 len = str_scan(p, n);
+        if (len < n) {
+            len++;
+            got_null = true;
         }
+        memmove((void*)dst, p, len);
+        maxlen -= len;
+        dst += len;
         
         src = va0 + PGSIZE;
     }
@@ -0,0 +1,244 @@
+#include "proc/cpu.h"
+#include "proc/elf.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "fs/file.h"
+#include "fs/dir.h"
+#include "fs/log.h"
+#include "lib/print.h"
+#include "lib/str.h"
+#include "memlayout.h"
+#include "riscv.h"
+
+/*
+    exec不再把程序一次性读进内存:
+    每个PT_LOAD段变成一个MAP_PRIVATE的文件映射 (uvm_mmap_file)
+    代码和数据页在第一次访问时由uvm_fault从页缓存拷贝, bss部分给清零的页
+    exec本身只读ELF头和程序头, 建好用户栈, 与程序大小无关
+
+    exec后的用户地址空间布局:
+    trapoline   (1 page)
+    trapframe   (1 page)
+    ustack      (1 page) 参数字符串 + argv数组
+    .......
+                        <--heap_top (最后一个段的末尾, 页对齐)
+    PT_LOAD段   (按需载入)
+    empty space (1 page) 最低的4096字节不可访问
+*/
+
+#define EXEC_MAX_LOAD 8  // 最多支持的PT_LOAD段数
+
+// 读出并检查所有PT_LOAD段, 段数通过nload返回
+// 成功返回0 失败返回-1
+// ps: 调用者需持有ip的锁
+static int exec_read_phdrs(inode_t* ip, elf_header_t* eh, prog_header_t* ph, uint32* nload)
+{
+    prog_header_t tmp;
+    uint32 n = 0;
+
+    for(uint32 i = 0; i < eh->phnum; i++) {
+        uint32 off = eh->phoff + i * sizeof(prog_header_t);
+        if(inode_read_data(ip, off, sizeof(tmp), &tmp, false) != sizeof(tmp))
+            return -1;
+        if(tmp.type != ELF_PROG_LOAD || tmp.memsz == 0)
+            continue;
+
+        // 段的文件偏移和虚拟地址必须页内偏移相同, 才能按页映射文件
+        if(tmp.memsz < tmp.filesz || tmp.vaddr + tmp.memsz < tmp.vaddr)
+            return -1;
+        if(tmp.vaddr < PGSIZE || tmp.vaddr + tmp.memsz > TRAPFRAME - 2 * PGSIZE)
+            return -1;
+        if((tmp.vaddr - tmp.off) % PGSIZE != 0 || tmp.off + tmp.filesz > ip->size)
+            return -1;
+
+        // 不同的段不能共享同一页 (一个页只属于一个文件映射)
+        uint64 lo = PG_ROUND_DOWN(tmp.vaddr), hi = PG_ROUND_UP(tmp.vaddr + tmp.memsz);
+        for(uint32 j = 0; j < n; j++)
+            if(lo < PG_ROUND_UP(ph[j].vaddr + ph[j].memsz) && PG_ROUND_DOWN(ph[j].vaddr) < hi)
+                return -1;
+
+        if(n == EXEC_MAX_LOAD)
+            return -1;
+        ph[n++] = tmp;
+    }
+
+    *nload = n;
+    return n > 0 ? 0 : -1;
+}
+
+// 把参数放到新的用户栈上 (stack是栈页的物理地址, 对应TRAPFRAME - PGSIZE)
+// 栈顶向下依次是: 参数字符串, 16字节对齐, argv数组(以0结尾)
+// 成功返回用户态sp, argc和argv地址通过参数返回; 参数放不下返回0
+static uint64 exec_push_args(uint64 stack, char** argv, uint64* argc, uint64* uargv)
+{
+    uint64 base = TRAPFRAME - PGSIZE;
+    uint64 sp = TRAPFRAME;
+    uint64 ustack[EXEC_MAXARG + 1];
+    uint64 n;
+
+    for(n = 0; argv[n] != NULL; n++) {
+        uint32 len = strlen(argv[n]) + 1;
+        if(n == EXEC_MAXARG || sp - base < len + (n + 2) * sizeof(uint64) + 16)
+            return 0;
+        sp -= len;
+        memmove((void*)(stack + sp - base), argv[n], len);
+        ustack[n] = sp;
+    }
+    ustack[n] = 0;
+
+    sp = (sp - (n + 1) * sizeof(uint64)) & ~0xFul;
+    memmove((void*)(stack + sp - base), ustack, (n + 1) * sizeof(uint64));
+
+    *argc = n;
+    *uargv = sp;
+    return sp;
+}
+
+// 用path处的ELF文件替换进程p的用户地址空间
+// p是当前进程(exec) 或者还没有运行过的新进程(spawn)
+// argv是内核里的参数数组 (以NULL结尾)
+// 成功返回argc (argv放进a1) 失败返回-1且原地址空间不变
+static int exec_load(proc_t* p, char* path, char** argv)
+{
+    elf_header_t eh;
+    prog_header_t ph[EXEC_MAX_LOAD];
+    uint32 nload;
+    uint64 argc, uargv, sp;
+
+    log_begin_op();
+    inode_t* ip = path_to_inode(path);
+    if(ip == NULL) {
+        log_end_op();
+        return -1;
+    }
+    inode_lock(ip);
+
+    // ELF头就有64字节, 合法的ELF文件不会是内联文件, 一定可以通过页缓存映射
+    if(ip->type != FT_FILE ||
+       inode_read_data(ip, 0, sizeof(eh), &eh, false) != sizeof(eh) ||
+       eh.magic != ELF_MAGIC || eh.ident[0] != ELF_CLASS_64 ||
+       eh.machine != ELF_MACHINE_RISCV || eh.phentsize != sizeof(prog_header_t) ||
+       exec_read_phdrs(ip, &eh, ph, &nload) < 0)
+        goto bad;
+
+    // 新的页表和用户栈
+    pgtbl_t pgtbl = proc_pgtbl_init((uint64)p->tf);
+    uint64 stack = (uint64)pmem_alloc(false);
+    if(stack == 0) {
+        uvm_destroy_pgtbl(pgtbl);
+        goto bad;
+    }
+    memset((void*)stack, 0, PGSIZE);
+    vm_mappages(pgtbl, TRAPFRAME - PGSIZE, stack, PGSIZE, PTE_R | PTE_W | PTE_U);
+    sp = exec_push_args(stack, argv, &argc, &uargv);
+    // 所有段共用一个只读的file_t, 每个映射持有一个引用 (ip的引用转交给它)
+    file_t* file = sp == 0 ? NULL : file_alloc();
+    if(file == NULL) {
+        uvm_destroy_pgtbl(pgtbl);
+        goto bad;
+    }
+
+    /* 以下不会失败: 丢弃旧的地址空间 */
+
+    file->type = FD_FILE;
+    file->readable = true;
+    file->ip = ip;
+    inode_unlock(ip);
+    log_end_op();
+
+    // 旧的文件映射各自在一个日志操作里写回和关闭
+    uvm_munmap_files(p);
+    while(p->mmap != NULL) {
+        mmap_region_t* next = p->mmap->next;
+        mmap_region_free(p->mmap);
+        p->mmap = next;
+    }
+    pgtbl_t old = p->pgtbl;
+    p->pgtbl = pgtbl;
+    uvm_destroy_pgtbl(old);
+    uvm_walk_reset(p);
+
+    uint64 top = 0;
+    for(uint32 i = 0; i < nload; i++) {
+        uint64 begin = PG_ROUND_DOWN(ph[i].vaddr);
+        uint64 end = PG_ROUND_UP(ph[i].vaddr + ph[i].memsz);
+        int perm = 0;
+        if(ph[i].flags & ELF_PROG_FLAG_READ)  perm |= PTE_R;
+        if(ph[i].flags & ELF_PROG_FLAG_WRITE) perm |= PTE_R | PTE_W;
+        if(ph[i].flags & ELF_PROG_FLAG_EXEC)  perm |= PTE_X;
+        uvm_mmap_file(p, begin, (end - begin) / PGSIZE, perm, MAP_PRIVATE, file_dup(file),
+                      PG_ROUND_DOWN(ph[i].off), ph[i].vaddr - begin + ph[i].filesz);
+        if(end > top)
+            top = end;
+    }
+    log_begin_op();
+    file_close(file);
+    log_end_op();
+
+    p->heap_base = top;
+    p->heap_top = top;
+    p->ustack_pages = 1;
+    p->tf->epc = eh.entry;
+    p->tf->sp = sp;
+    p->tf->a1 = uargv;
+    return argc;
+
+bad:
+    inode_unlock_free(ip);
+    log_end_op();
+    return -1;
+}
+
+// 用path处的ELF文件替换当前进程的用户地址空间
+// 成功返回argc (作为系统调用返回值放进a0) 失败返回-1
+int proc_exec(char* path, char** argv)
+{
+    return exec_load(myproc(), path, argv);
+}
+
+/*
+    直接从ELF文件创建子进程, 相当于fork + exec但不复制父进程的地址空间
+    子进程的页表从proc_alloc得到的空页表开始, 由exec_load建好代码段映射和用户栈
+    files[i]是要放进子进程fds[i]处的文件 (共n项), 子进程持有新的引用
+    成功返回子进程pid, 失败返回-1
+*/
+int proc_spawn(char* path, char** argv, int* fds, file_t** files, int n)
+{
+    proc_t* p = myproc();
+    proc_t* np = proc_alloc();
+    if (np == NULL)
+        return -1;
+
+    // 载入ELF需要睡眠(inode锁和磁盘I/O), 不能一直持有np->lk
+    // USED状态的进程不会被调度, 也不会被wait回收
+    np->state = USED;
+    spinlock_release(&np->lk);
+
+    // 先放好文件 (fd超出内嵌表时要分配扩展页, 可能失败), 失败时还没有建立任何映射
+    int argc = 0;
+    for (int i = 0; argc >= 0 && i < n; i++) {
+        if (fdtable_install(&np->fdt, fds[i], files[i]) < 0)
+            argc = -1;
+        else
+            file_dup(files[i]);
+    }
+    if (argc >= 0)
+        argc = exec_load(np, path, argv);
+
+    spinlock_acquire(&np->lk);
+    if (argc < 0) {
+        // 父进程还持有这些文件的引用, 这里的file_close不会是最后一次关闭
+        fdtable_close_all(&np->fdt);
+        proc_free(np);
+        spinlock_release(&np->lk);
+        return -1;
+    }
+
+    np->tf->a0 = argc;
+    np->parent = p;
+    np->state = RUNNABLE;
+    int pid = np->pid;
+    spinlock_release(&np->lk);
+
+    return pid;
+}
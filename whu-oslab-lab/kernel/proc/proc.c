@@ -2,6 +2,8 @@
 #include "lib/str.h"
 #include "mem/pmem.h"
 #include "mem/vmem.h"
+#include "fs/file.h"
+#include "fs/log.h"
 #include "proc/cpu.h"
 #include "proc/initcode.h"
 #include "trap/trap.h"
@@ -106,9 +108,14 @@ found:
     p->parent = NULL;
     p->exit_state = 0;
     p->sleep_space = NULL;
+    p->heap_base = 0;
     p->heap_top = 0;
     p->ustack_pages = 0;
     p->mmap = NULL;
+    p->mmap_file = NULL;
+    uvm_walk_reset(p);
+    fdtable_init(&p->fdt);
+    p->cwd = NULL;
     
     return p;
 }
@@ -140,6 +147,9 @@ void proc_free(proc_t* p)
         mmap = next;
     }
     p->mmap = NULL;
+
+    // 文件映射在proc_exit时已经解除
+    assert(p->mmap_file == NULL, "proc_free: mmap_file not released");
     
     // 重置其他字段
     p->pid = 0;
@@ -147,6 +157,7 @@ void proc_free(proc_t* p)
     p->parent = NULL;
     p->exit_state = 0;
     p->sleep_space = NULL;
+    p->heap_base = 0;
     p->heap_top = 0;
     p->ustack_pages = 0;
 }
@@ -240,10 +251,12 @@ void proc_make_first()
     vm_mappages(proczero->pgtbl, PGSIZE, page, PGSIZE, PTE_R | PTE_W | PTE_X | PTE_U);
 
     // 设置 heap_top
-    proczero->heap_top = 2 * PGSIZE;  // 代码段之后
+    proczero->heap_base = 2 * PGSIZE;  // 代码段之后
+    proczero->heap_top = 2 * PGSIZE;
     
     // 初始化 mmap 链表为空
     proczero->mmap = NULL;
+    proczero->mmap_file = NULL;
 
     // tf字段设置
     proczero->tf->epc = PGSIZE;                     // 用户入口点（代码起始地址）
@@ -292,9 +305,10 @@ int proc_fork()
     vm_mappages(np->pgtbl, ustack_va, page, PGSIZE, PTE_R | PTE_W | PTE_U);
     
     // 复制父进程的页表内容（代码、堆、mmap等区域）
-    uvm_copy_pgtbl(p->pgtbl, np->pgtbl, p->heap_top, p->ustack_pages, p->mmap);
+    uvm_copy_pgtbl(p->pgtbl, np->pgtbl, p->heap_top, p->ustack_pages, p->mmap, p->mmap_file);
     
     // 复制堆顶和mmap区域信息
+    np->heap_base = p->heap_base;
     np->heap_top = p->heap_top;
     
     // 复制mmap链表
@@ -314,6 +328,19 @@ int proc_fork()
         dst_mmap = &new_mmap->next;
         src_mmap = src_mmap->next;
     }
+
+    // 复制文件映射链表 (子进程持有文件的新引用)
+    mmap_file_t* src_mf = p->mmap_file;
+    mmap_file_t** dst_mf = &np->mmap_file;
+    while (src_mf != NULL) {
+        mmap_file_t* new_mf = mmap_file_alloc();
+        *new_mf = *src_mf;
+        new_mf->file = file_dup(src_mf->file);
+        new_mf->next = NULL;
+        *dst_mf = new_mf;
+        dst_mf = &new_mf->next;
+        src_mf = src_mf->next;
+    }
     
     // 复制trapframe,复制所有寄存器状态
     memmove(np->tf, p->tf, sizeof(trapframe_t));
@@ -446,6 +473,17 @@ void proc_exit(int exit_state)
         panic("proc_exit: proczero exiting");
     }
     
+    // 解除文件映射 (MAP_SHARED的修改写回文件), 关闭打开的文件
+    // 每个映射和文件各自使用一个日志操作, 一起放进一个操作会超出LOG_OP_BLOCKS
+    uvm_munmap_files(p);
+    fdtable_close_all(&p->fdt);
+    if (p->cwd != NULL) {
+        log_begin_op();
+        inode_free(p->cwd);
+        log_end_op();
+        p->cwd = NULL;
+    }
+
     // 将子进程托付给proczero
     proc_reparent(p);
     
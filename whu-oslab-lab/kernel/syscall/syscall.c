@@ -28,6 +28,19 @@ static uint64 (*syscalls[])(void) = {
     [SYS_chdir]         sys_chdir,
     [SYS_link]          sys_link,
     [SYS_unlink]        sys_unlink,
+    [SYS_msync]         sys_msync,
+    [SYS_fallocate]     sys_fallocate,
+    [SYS_fsync]         sys_fsync,
+    [SYS_spawn]         sys_spawn,
+    [SYS_pipe]          sys_pipe,
+    [SYS_splice]        sys_splice,
+    [SYS_tee]           sys_tee,
+    [SYS_sendfile]      sys_sendfile,
+    [SYS_readv]         sys_readv,
+    [SYS_writev]        sys_writev,
+    [SYS_pread]         sys_pread,
+    [SYS_pwrite]        sys_pwrite,
+    [SYS_ring_enter]    sys_ring_enter,
 };
 
 // 系统调用
@@ -35,6 +48,9 @@ void syscall()
 {
     proc_t* p = myproc();
     
+    // 上一次系统调用之后用户态可能改变了映射
+    uvm_walk_reset(p);
+
     // 从 a7 寄存器获取系统调用号
     int num = p->tf->a7;
     
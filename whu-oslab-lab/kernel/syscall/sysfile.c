@@ -3,10 +3,12 @@
 #include "fs/inode.h"
 #include "fs/dir.h"
 #include "fs/file.h"
+#include "fs/log.h"
 #include "lib/str.h"
 #include "lib/print.h"
 #include "syscall/syscall.h"
 #include "syscall/sysfunc.h"
+#include "syscall/ring.h"
 
 // 获取第n个参数对应的fd和这个fd对应的file
 // 成功返回0 失败返回-1
@@ -16,12 +18,8 @@ static int arg_fd(int n, int* pfd, file_t** pfile)
     int fd = 0;
     arg_uint32(n, (uint32*)(&fd));
     
-    // fd 溢出
-    if(fd < 0 || fd >= FILE_PER_PROC)
-        return -1;
-    
-    // 确定fd对应的file
-    file_t* file = myproc()->filelist[fd];
+    // 确定fd对应的file (fd越界时同样返回NULL)
+    file_t* file = fdtable_get(&myproc()->fdt, fd);
     if(file == NULL)
         return -1;
     
@@ -31,20 +29,11 @@ static int arg_fd(int n, int* pfd, file_t** pfile)
     return 0;
 }
 
-// 成功返回申请到的fd
+// 成功返回申请到的fd (最小的空闲fd)
 // 失败返回-1
 static int fd_alloc(file_t* file)
 {
-    proc_t* p = myproc();
-
-    for(int fd = 0; fd < FILE_PER_PROC; fd++) {
-        if(p->filelist[fd] == NULL) {
-            p->filelist[fd] = file;
-            return fd;
-        }
-    }
-
-    return -1;
+    return fdtable_alloc(&myproc()->fdt, file);
 }
 
 // 打开或创建文件
@@ -59,13 +48,17 @@ uint64 sys_open()
     arg_str(0, path, DIR_PATH_LEN);
     arg_uint32(1, &open_mode);
 
+    log_begin_op();
     file_t* file = file_open(path, open_mode);
-    if(file == NULL)
+    if(file == NULL) {
+        log_end_op();
         return -1;
+    }
     
     int fd = fd_alloc(file);
     if(fd == -1)
         file_close(file);
+    log_end_op();
 
     return fd;
 }
@@ -81,8 +74,10 @@ uint64 sys_close()
     if(arg_fd(0, &fd, &file) < 0)
         return -1;
 
-    myproc()->filelist[fd] = NULL;
+    fdtable_remove(&myproc()->fdt, fd);
+    log_begin_op();
     file_close(file);
+    log_end_op();
 
     return 0;
 }
@@ -176,6 +171,37 @@ uint64 sys_fstat()
     return file_stat(file, addr);
 }
 
+// 预先分配文件空间 (不改变文件大小)
+// int fd
+// uint32 offset
+// uint32 len
+// 成功返回0 失败返回-1
+uint64 sys_fallocate()
+{
+    file_t* file;
+    uint32 offset, len;
+
+    if(arg_fd(0, NULL, &file) < 0)
+        return -1;
+    arg_uint32(1, &offset);
+    arg_uint32(2, &len);
+
+    return file_fallocate(file, offset, len);
+}
+
+// 把文件的修改写回磁盘
+// int fd
+// 成功返回0 失败返回-1
+uint64 sys_fsync()
+{
+    file_t* file;
+
+    if(arg_fd(0, NULL, &file) < 0)
+        return -1;
+
+    return file_fsync(file, true);
+}
+
 // 获取目录里的目录项
 // int fd
 // uint64 addr
@@ -210,7 +236,9 @@ uint64 sys_mkdir()
     char path[DIR_PATH_LEN];
     arg_str(0, path, DIR_PATH_LEN);
 
+    log_begin_op();
     inode_t* inode = path_create_inode(path, FT_DIR, 0, 0);
+    log_end_op();
 
     return (inode == NULL) ? -1 : 0;
 }
@@ -223,7 +251,11 @@ uint64 sys_chdir()
     char path[DIR_PATH_LEN];
     arg_str(0, path, DIR_PATH_LEN);
 
-    return dir_change(path);
+    log_begin_op();
+    int ret = dir_change(path);
+    log_end_op();
+
+    return ret;
 }
 
 // 文件链接
@@ -236,7 +268,11 @@ uint64 sys_link()
     arg_str(0, old_path, DIR_PATH_LEN);
     arg_str(1, new_path, DIR_PATH_LEN);
 
-    return path_link(old_path, new_path);
+    log_begin_op();
+    int ret = path_link(old_path, new_path);
+    log_end_op();
+
+    return ret;
 }
 
 // 文件删除链接 (link=0 则删除文件)
@@ -247,5 +283,282 @@ uint64 sys_unlink()
     char path[DIR_PATH_LEN];
     arg_str(0, path, DIR_PATH_LEN);
 
-    return path_unlink(path);
-}
\ No newline at end of file
+    log_begin_op();
+    int ret = path_unlink(path);
+    log_end_op();
+
+    return ret;
+}
+
+// 创建管道
+// int* fds 存放读端和写端的fd
+// 成功返回0 失败返回-1
+uint64 sys_pipe()
+{
+    proc_t* p = myproc();
+    uint64 addr;
+    file_t *rf, *wf;
+    int fd[2];
+
+    arg_uint64(0, &addr);
+
+    if(pipe_alloc(&rf, &wf) < 0)
+        return -1;
+
+    fd[0] = fd_alloc(rf);
+    fd[1] = fd[0] < 0 ? -1 : fd_alloc(wf);
+    if(fd[1] < 0) {
+        if(fd[0] >= 0)
+            fdtable_remove(&p->fdt, fd[0]);
+        file_close(rf);
+        file_close(wf);
+        return -1;
+    }
+
+    uvm_copyout(p->pgtbl, addr, (uint64)fd, sizeof(fd));
+    return 0;
+}
+
+// 在管道和文件之间移动数据 (in和out至少一个是管道)
+// int in_fd
+// int out_fd
+// uint32 len
+// 成功返回移动的字节数 失败返回-1
+uint64 sys_splice()
+{
+    file_t *in, *out;
+    uint32 len;
+
+    if(arg_fd(0, NULL, &in) < 0 || arg_fd(1, NULL, &out) < 0)
+        return -1;
+    arg_uint32(2, &len);
+
+    return file_splice(in, out, len);
+}
+
+// 复制管道里的数据到另一个管道, 不消费原管道的数据
+// int in_fd
+// int out_fd
+// uint32 len
+// 成功返回复制的字节数 失败返回-1
+uint64 sys_tee()
+{
+    file_t *in, *out;
+    uint32 len;
+
+    if(arg_fd(0, NULL, &in) < 0 || arg_fd(1, NULL, &out) < 0)
+        return -1;
+    arg_uint32(2, &len);
+
+    return file_tee(in, out, len);
+}
+
+// 把普通文件的内容直接写入另一个文件
+// int out_fd
+// int in_fd (普通文件, 从它的当前偏移开始读)
+// uint32 len
+// 成功返回写入的字节数 失败返回-1
+uint64 sys_sendfile()
+{
+    file_t *out, *in;
+    uint32 len;
+
+    if(arg_fd(0, NULL, &out) < 0 || arg_fd(1, NULL, &in) < 0)
+        return -1;
+    arg_uint32(2, &len);
+
+    return file_sendfile(out, in, len);
+}
+
+// 把用户态的iovec数组拷进内核
+// 成功返回0 失败返回-1
+static int arg_iov(int n, iovec_t* iov, uint32* cnt)
+{
+    uint64 addr;
+
+    arg_uint64(n, &addr);
+    arg_uint32(n + 1, cnt);
+    if(*cnt > IOV_MAX)
+        return -1;
+    uvm_copyin(myproc()->pgtbl, (uint64)iov, addr, *cnt * sizeof(iovec_t));
+    return 0;
+}
+
+// 读到多段缓冲区
+// int fd
+// iovec_t* iov
+// uint32 iovcnt
+// 成功返回读取的总字节数 失败返回-1
+uint64 sys_readv()
+{
+    file_t* file;
+    iovec_t iov[IOV_MAX];
+    uint32 cnt;
+
+    if(arg_fd(0, NULL, &file) < 0 || arg_iov(1, iov, &cnt) < 0)
+        return -1;
+
+    return file_readv(file, iov, cnt, &file->offset);
+}
+
+// 从多段缓冲区写入
+// int fd
+// iovec_t* iov
+// uint32 iovcnt
+// 成功返回写入的总字节数 失败返回-1
+uint64 sys_writev()
+{
+    file_t* file;
+    iovec_t iov[IOV_MAX];
+    uint32 cnt;
+
+    if(arg_fd(0, NULL, &file) < 0 || arg_iov(1, iov, &cnt) < 0)
+        return -1;
+
+    return file_writev(file, iov, cnt, &file->offset);
+}
+
+// 在指定偏移处读取, 不使用也不修改文件偏移 (只支持普通文件)
+// int fd
+// uint32 len
+// uint64 addr
+// uint32 offset
+// 成功返回读取的字节数 失败返回-1
+uint64 sys_pread()
+{
+    file_t* file;
+    iovec_t iov;
+    uint32 offset;
+
+    if(arg_fd(0, NULL, &file) < 0 || file->type != FD_FILE)
+        return -1;
+    arg_uint32(1, &iov.len);
+    arg_uint64(2, &iov.base);
+    arg_uint32(3, &offset);
+
+    return file_readv(file, &iov, 1, &offset);
+}
+
+// 在指定偏移处写入, 不使用也不修改文件偏移 (只支持普通文件)
+// int fd
+// uint32 len
+// uint64 addr
+// uint32 offset
+// 成功返回写入的字节数 失败返回-1
+uint64 sys_pwrite()
+{
+    file_t* file;
+    iovec_t iov;
+    uint32 offset;
+
+    if(arg_fd(0, NULL, &file) < 0 || file->type != FD_FILE)
+        return -1;
+    arg_uint32(1, &iov.len);
+    arg_uint64(2, &iov.base);
+    arg_uint32(3, &offset);
+
+    return file_writev(file, &iov, 1, &offset);
+}
+
+// 执行批量系统调用环里的一个提交项, 返回结果
+// fsync只写回数据, 日志提交由调用者在批次结束时统一等待
+static int ring_do(ring_sqe_t* sqe, bool* synced)
+{
+    proc_t* p = myproc();
+    file_t* file = NULL;
+
+    if(sqe->op == RING_OP_NOP)
+        return 0;
+
+    if(sqe->op == RING_OP_OPEN) {
+        char path[DIR_PATH_LEN];
+        uvm_copyin_str(p->pgtbl, (uint64)path, sqe->addr, DIR_PATH_LEN);
+        log_begin_op();
+        file = file_open(path, sqe->len);
+        int fd = -1;
+        if(file != NULL && (fd = fd_alloc(file)) == -1)
+            file_close(file);
+        log_end_op();
+        return fd;
+    }
+
+    if((file = fdtable_get(&p->fdt, sqe->fd)) == NULL)
+        return -1;
+
+    switch(sqe->op) {
+        case RING_OP_READ:
+        case RING_OP_WRITE: {
+            iovec_t iov = { .base = sqe->addr, .len = sqe->len };
+            uint32 off = sqe->offset;
+            uint32* poff = &file->offset;
+            if(off != RING_NO_OFFSET) {
+                if(file->type != FD_FILE)
+                    return -1;
+                poff = &off;
+            }
+            if(sqe->op == RING_OP_READ)
+                return file_readv(file, &iov, 1, poff);
+            return file_writev(file, &iov, 1, poff);
+        }
+        case RING_OP_CLOSE:
+            fdtable_remove(&p->fdt, sqe->fd);
+            log_begin_op();
+            file_close(file);
+            log_end_op();
+            return 0;
+        case RING_OP_FSYNC:
+            if(file_fsync(file, false) < 0)
+                return -1;
+            *synced = true;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/*
+    执行批量系统调用环里最多to_submit个提交项
+    一次陷入执行整批操作; 完成队列满时提前停止
+    批次里的多个fsync只等待一次日志提交
+    uint64 addr (ring_t在用户内存里的地址)
+    uint32 to_submit
+    成功返回执行的提交项数 失败返回-1
+*/
+uint64 sys_ring_enter()
+{
+    proc_t* p = myproc();
+    uint64 addr;
+    uint32 to_submit;
+    uint32 hdr[4];   // sq_head sq_tail cq_head cq_tail
+    ring_sqe_t sqe;
+    ring_cqe_t cqe;
+    bool synced = false;
+    uint32 done = 0;
+
+    arg_uint64(0, &addr);
+    arg_uint32(1, &to_submit);
+
+    uvm_copyin(p->pgtbl, (uint64)hdr, addr, sizeof(hdr));
+    uint32 sq_head = hdr[0], sq_tail = hdr[1], cq_head = hdr[2], cq_tail = hdr[3];
+    if(sq_tail - sq_head > RING_ENTRIES || cq_tail - cq_head > RING_ENTRIES)
+        return -1;
+
+    ring_t* ring = (ring_t*)addr;
+    while(done < to_submit && sq_head != sq_tail && cq_tail - cq_head < RING_ENTRIES) {
+        uvm_copyin(p->pgtbl, (uint64)&sqe, (uint64)&ring->sqes[sq_head % RING_ENTRIES], sizeof(sqe));
+        cqe.user_data = sqe.user_data;
+        cqe.res = ring_do(&sqe, &synced);
+        cqe.pad = 0;
+        uvm_copyout(p->pgtbl, (uint64)&ring->cqes[cq_tail % RING_ENTRIES], (uint64)&cqe, sizeof(cqe));
+        sq_head++;
+        cq_tail++;
+        done++;
+    }
+
+    if(synced)
+        log_sync();
+
+    uvm_copyout(p->pgtbl, (uint64)&ring->sq_head, (uint64)&sq_head, sizeof(uint32));
+    uvm_copyout(p->pgtbl, (uint64)&ring->cq_tail, (uint64)&cq_tail, sizeof(uint32));
+    return done;
+}
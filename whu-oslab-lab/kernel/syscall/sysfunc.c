@@ -2,6 +2,9 @@
 #include "mem/vmem.h"
 #include "mem/pmem.h"
 #include "mem/mmap.h"
+#include "fs/file.h"
+#include "fs/dir.h"
+#include "fs/log.h"
 #include "lib/str.h"
 #include "lib/print.h"
 #include "memlayout.h"
@@ -26,7 +29,7 @@ uint64 sys_brk()
     }
     
     // 边界检查：新堆顶不能低于初始堆位置（代码段之后）
-    if (new_heap_top < 2 * PGSIZE) {
+    if (new_heap_top < p->heap_base) {
         return -1;
     }
     
@@ -54,18 +57,26 @@ uint64 sys_brk()
 }
 
 // 内存映射
-// uint64 start 起始地址 (如果为0则由内核自主选择一个合适的起点, 通常是顺序扫描找到一个够大的空闲空间)
-// uint32 len   范围(字节, 检查是否是page-aligned)
+// uint64 start  起始地址 (如果为0则由内核自主选择一个合适的起点, 通常是顺序扫描找到一个够大的空闲空间)
+// uint32 len    范围(字节, 检查是否是page-aligned)
+// int    prot   PROT_READ | PROT_WRITE | PROT_EXEC
+// int    flags  MAP_SHARED 或 MAP_PRIVATE (匿名映射时忽略)
+// int    fd     映射的文件 (-1表示匿名映射, 分配清零的物理页)
+// uint32 offset 文件偏移 (检查是否是page-aligned)
 // 成功返回映射空间的起始地址, 失败返回-1
 uint64 sys_mmap()
 {
     proc_t* p = myproc();
     uint64 start;
-    uint32 len;
+    uint32 len, prot, flags, fd, offset;
     
     // 获取参数
     arg_uint64(0, &start);
     arg_uint32(1, &len);
+    arg_uint32(2, &prot);
+    arg_uint32(3, &flags);
+    arg_uint32(4, &fd);
+    arg_uint32(5, &offset);
     
     // 检查长度是否页对齐
     if (len == 0 || len % PGSIZE != 0) {
@@ -95,9 +106,42 @@ uint64 sys_mmap()
             return -1;
         }
     }
+
+    int perm = 0;
+    if (prot & PROT_READ)  perm |= PTE_R;
+    if (prot & PROT_WRITE) perm |= PTE_R | PTE_W;
+    if (prot & PROT_EXEC)  perm |= PTE_X;
     
-    // 调用 uvm_mmap 建立映射
-    uvm_mmap(start, npages, PTE_R | PTE_W);
+    // 匿名映射: 调用 uvm_mmap 建立映射
+    if ((int)fd == -1) {
+        uvm_mmap(start, npages, perm ? perm : PTE_R | PTE_W);
+        return start;
+    }
+
+    // 文件映射: 检查文件和权限
+    file_t* file = fdtable_get(&p->fdt, fd);
+    if (file == NULL)
+        return -1;
+    if (file->type != FD_FILE || !file->readable || perm == 0)
+        return -1;
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE)
+        return -1;
+    if (flags == MAP_SHARED && (perm & PTE_W) && !file->writable)
+        return -1;
+    if (offset % PGSIZE != 0)
+        return -1;
+
+    // 内联文件没有页缓存, 映射前转换成用block存放
+    log_begin_op();
+    inode_lock(file->ip);
+    int ret = inode_inline_expand(file->ip);
+    inode_unlock(file->ip);
+    log_end_op();
+    if (ret < 0)
+        return -1;
+
+    // 只建立映射关系, 页面在第一次访问时载入
+    uvm_mmap_file(p, start, npages, perm, flags, file_dup(file), offset, len);
     
     return start;
 }
@@ -122,12 +166,39 @@ uint64 sys_munmap()
     
     uint32 npages = len / PGSIZE;
     
-    // 调用 uvm_munmap 解除映射
+    // 调用 uvm_munmap 解除映射 (MAP_SHARED的修改会写回文件)
+    // 可能释放文件的最后一个引用, 需要在日志操作内进行
+    log_begin_op();
     uvm_munmap(start, npages);
+    log_end_op();
     
     return 0;
 }
 
+// 把MAP_SHARED映射里被修改的页写回文件
+// uint64 start 起始地址
+// uint32 len   范围(字节, 检查是否是page-aligned)
+// 成功返回0 失败返回-1
+uint64 sys_msync()
+{
+    uint64 start;
+    uint32 len;
+
+    arg_uint64(0, &start);
+    arg_uint32(1, &len);
+
+    if (start % PGSIZE != 0 || len == 0 || len % PGSIZE != 0) {
+        return -1;
+    }
+
+    // 写回时可能为延迟分配的block分配位置, 需要在日志操作内进行
+    log_begin_op();
+    uvm_msync(start, len / PGSIZE);
+    log_end_op();
+
+    return 0;
+}
+
 // 打印字符串
 // uint64 addr  字符串地址
 uint64 sys_print()
@@ -184,12 +255,98 @@ uint64 sys_sleep()
     return 0;
 }
 
+// 把用户态的参数数组uargv拷贝进内核
+// 参数字符串放在buf这个内核页里 (内核栈只有一页), argv指向它们并以NULL结尾
+// 成功返回0 参数太多或太长返回-1
+static int exec_fetch_args(uint64 uargv, char* buf, char** argv)
+{
+    proc_t* p = myproc();
+    uint64 uarg;
+    uint32 used = 0;
+
+    // 最后一个字节固定为0, 拷贝到这里说明参数太长
+    buf[PGSIZE - 1] = 0;
+
+    for (int argc = 0; ; argc++) {
+        if (argc > EXEC_MAXARG)
+            return -1;
+        uvm_copyin(p->pgtbl, (uint64)&uarg, uargv + argc * sizeof(uint64), sizeof(uint64));
+        if (uarg == 0) {
+            argv[argc] = NULL;
+            return 0;
+        }
+        if (used >= PGSIZE - 1)
+            return -1;
+        uvm_copyin_str(p->pgtbl, (uint64)(buf + used), uarg, PGSIZE - 1 - used);
+        argv[argc] = buf + used;
+        used += strlen(argv[argc]) + 1;
+        if (used >= PGSIZE)
+            return -1;
+    }
+}
+
 // 执行一个ELF文件
 // char* path
 // char** argv
 // 成功返回argc 失败返回-1
 uint64 sys_exec()
 {
-    // TODO: 实现ELF加载器
-    return -1;
+    char path[DIR_PATH_LEN];
+    char* argv[EXEC_MAXARG + 1];
+    uint64 uargv;
+    int ret = -1;
+
+    arg_str(0, path, DIR_PATH_LEN);
+    arg_uint64(1, &uargv);
+
+    char* buf = (char*)pmem_alloc(true);
+    if (buf == NULL)
+        return -1;
+    if (exec_fetch_args(uargv, buf, argv) == 0)
+        ret = proc_exec(path, argv);
+    pmem_free((uint64)buf, true);
+    return ret;
+}
+
+#define SPAWN_MAX_ACTION 16  // sys_spawn的fd_actions最多的对数
+
+// 从ELF文件直接创建子进程 (不复制当前进程的地址空间)
+// char* path
+// char** argv
+// int* fd_actions 成对的{子进程fd, 父进程fd}, 以子进程fd为-1结束, 最多SPAWN_MAX_ACTION对; NULL表示子进程不打开任何文件
+// 成功返回子进程pid 失败返回-1
+uint64 sys_spawn()
+{
+    proc_t* p = myproc();
+    char path[DIR_PATH_LEN];
+    char* argv[EXEC_MAXARG + 1];
+    int fds[SPAWN_MAX_ACTION];
+    file_t* files[SPAWN_MAX_ACTION];
+    uint64 uargv, uact;
+    int act[2];
+    int n = 0;
+    int ret = -1;
+
+    arg_str(0, path, DIR_PATH_LEN);
+    arg_uint64(1, &uargv);
+    arg_uint64(2, &uact);
+
+    while (uact != 0) {
+        uvm_copyin(p->pgtbl, (uint64)act, uact + n * sizeof(act), sizeof(act));
+        if (act[0] == -1)
+            break;
+        if (n == SPAWN_MAX_ACTION || act[0] < 0 || act[0] >= FD_MAX)
+            return -1;
+        if ((files[n] = fdtable_get(&p->fdt, act[1])) == NULL)
+            return -1;
+        fds[n++] = act[0];
+    }
+
+    char* buf = (char*)pmem_alloc(true);
+    if (buf == NULL)
+        return -1;
+    if (exec_fetch_args(uargv, buf, argv) == 0)
+        ret = proc_spawn(path, argv, fds, files, n);
+    pmem_free((uint64)buf, true);
+    return ret;
 }
\ No newline at end of file
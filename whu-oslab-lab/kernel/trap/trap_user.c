@@ -77,6 +77,19 @@ void trap_user_handler()
                 // 调用系统调用处理函数
                 syscall();
                 break;
+            case 12: // Instruction page fault
+            case 13: // Load page fault
+            case 15: // Store/AMO page fault
+                // 文件映射的页第一次被访问
+                if (uvm_fault(stval, trap_id == 15) == 0)
+                    break;
+                printf("user page fault: %s (trap_id=%d)\n", 
+                       exception_info[trap_id], trap_id);
+                printf("scause=%p sepc=%p stval=%p\n", scause, sepc, stval);
+                // 非法访问或页缓存无法提供页面: 只结束这个进程
+                intr_on();
+                proc_exit(-1);
+                break;
             default:
                 printf("user exception: %s (trap_id=%d)\n", 
                        exception_info[trap_id], trap_id);
@@ -4,8 +4,11 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// disk layout: [ super block | inode bitmap | inode blocks | data bitmap | data blocks ]
+// disk layout: [ super block | log | inode bitmap | inode blocks | data bitmap | data blocks ]
 
 #define FS_MAGIC 0x12345678
 
@@ -22,11 +25,20 @@ typedef struct super_block {
     unsigned int inode_blocks;
     unsigned int data_blocks;
     unsigned int total_blocks;
+
+    unsigned int log_start;
+    unsigned int log_blocks;
+
+    unsigned int features;
 } super_block_t;
 
+#define FS_FEAT_EXTENT 0x1 // 文件和目录使用extent格式
+#define FS_FEAT_INLINE 0x2 // 小文件内联存放在inode里
+
 // inode 64 byte
 typedef struct inode_disk {
-    short type;
+    unsigned char type;
+    unsigned char flags;
     short major;
     short minor;
     short nlink;
@@ -34,8 +46,26 @@ typedef struct inode_disk {
     unsigned int addrs[13];
 } inode_disk_t;
 
-// directory entry 32 byte
-typedef struct dirent {
+#define INODE_F_EXTENT 0x1
+#define INODE_F_INLINE 0x2
+#define INODE_INLINE_MAX (sizeof(unsigned int) * 13) // 内联文件的最大字节数
+
+// extent格式: addrs里是 extent_header_t + 4个extent_t (mkfs只使用depth = 0)
+typedef struct extent_header {
+    unsigned short count;
+    unsigned short depth;
+} extent_header_t;
+
+typedef struct extent {
+    unsigned int lblock;
+    unsigned int pblock;
+    unsigned int len;
+} extent_t;
+
+#define EXT_IN_INODE ((sizeof(unsigned int) * 13 - sizeof(extent_header_t)) / sizeof(extent_t))
+
+// directory entry 32 byte (与宿主机的struct dirent区分)
+typedef struct fs_dirent {
     unsigned short inode_num;
     char name[30];
 } dirent_t;
@@ -46,13 +76,40 @@ typedef struct dirent {
 #define FT_FILE   2
 #define FT_DEVICE 3 
 
+// 索引目录(htree)的索引节点, 与内核dir.h一致
+#define DX_MAGIC 0x44584854
+
+typedef struct dx_entry {
+    unsigned int hash;
+    unsigned int block;
+} dx_entry_t;
+
+typedef struct dx_node {
+    unsigned int magic;
+    unsigned short depth;
+    unsigned short count;
+    dx_entry_t entries[];
+} dx_node_t;
+
+#define DIR_NAME_LEN 30
+
 // 常量定义 
-#define BLOCK_SIZE       1024 // 每个block占1024字节
-#define N_DATA_BLOCK     8192 // 1个block的bitmap管理的极限
-#define N_INODE_BLOCK    128  // 支持2048个文件
-#define N_BLOCK          (N_DATA_BLOCK + N_INODE_BLOCK + 3)  // 五个部分组合起来
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE       4096 // 每个block的字节数 (必须与内核一致, 由Makefile传入)
+#endif
+#define N_LOG_BLOCK      97   // 日志头 + 96个日志block (与内核LOG_BLOCKS一致)
 #define INODE_PER_BLOCK  (BLOCK_SIZE / sizeof(inode_disk_t)) // 每个block里的inode数量
-#define N_INODE          (N_INODE_BLOCK * INODE_PER_BLOCK)   // inode总数
+#define BITS_PER_BLOCK   (BLOCK_SIZE * 8)
+#define BITMAP_MAX_BLOCKS 16     // 与内核bitmap.c一致
+#define INODE_MAX        0xFFFF  // inode_num是16位, 0xFFFF表示未使用
+
+// 默认: 32MB数据区 + 元数据, 2048个inode
+#define DEFAULT_SIZE_MB  34
+#define DEFAULT_N_INODE  2048
+
+#define DIRENT_PER_BLOCK   (BLOCK_SIZE / sizeof(dirent_t))
+#define DX_ENTRY_PER_BLOCK ((BLOCK_SIZE - 8) / sizeof(dx_entry_t))
+#define DX_LEAF_FILL       (DIRENT_PER_BLOCK * 3 / 4) // 导入时叶子只填3/4, 给之后的插入留空间
 
 // 与inode管理的data block相关
 #define ENTRY_PER_BLOCK (BLOCK_SIZE / sizeof(unsigned int))  
@@ -64,8 +121,21 @@ typedef struct dirent {
 // 确定inode所在的inode block序号
 #define INODE_LOCATE_BLOCK(inum, sb)  ((inum) / INODE_PER_BLOCK + sb.inode_start)
 
-int fsfd;
-super_block_t sb;
+/*
+    整个映像用mmap映射到内存里直接修改, 退出前一次msync
+    ftruncate出来的映像全是0, 不需要逐块清零
+    mkfs只会申请不会释放, 所以inode和data block都按顺序分配 (next_inode / next_block),
+    不需要扫描bitmap, 文件的block天然连续
+*/
+
+super_block_t sb;      // 主机字节序, 写入映像时再转换
+unsigned char* img;    // 映像在内存里的映射
+unsigned int next_inode;
+unsigned int next_block;
+unsigned int n_inode;
+int use_extent; // -e: 使用extent格式
+int use_inline; // -i: 小文件内联存放
+unsigned int n_file, n_dir;
 
 // 大小端转换
 unsigned short xshort(unsigned short x)
@@ -89,136 +159,58 @@ unsigned int xint(unsigned int x)
     return y;
 }
 
-// 向磁盘写一个block
-void block_write(unsigned int block_num, void* buf)
+// 出错退出
+void fatal(char* msg, char* arg)
 {
-    if(lseek(fsfd, BLOCK_SIZE * block_num, 0) != BLOCK_SIZE * block_num) {
-        perror("lsek");
-        exit(1);
-    }
-    if(write(fsfd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
-        perror("write");
-        exit(1);
-    }
+    fprintf(stderr, "mkfs: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
 }
 
-// 从磁盘读一个block
-void block_read(unsigned int block_num, void* buf)
+// block在映像里的位置
+unsigned char* block_ptr(unsigned int block_num)
 {
-    if(lseek(fsfd, BLOCK_SIZE * block_num, 0) != BLOCK_SIZE * block_num) {
-        perror("lsek");
-        exit(1);
-    }
-    if(read(fsfd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
-        perror("read");
-        exit(1);
-    }
+    assert(block_num < sb.total_blocks);
+    return img + (size_t)block_num * BLOCK_SIZE;
+}
+
+// 置位bitmap的第bit位 (bitmap可能占用多个block, 在映像里是连续的)
+void bitmap_set(unsigned int start, unsigned int bit)
+{
+    block_ptr(start)[bit / 8] |= 1 << (bit % 8);
 }
 
 // 申请一个block(修改bitmap)
 unsigned int block_alloc()
 {
-    char buf[BLOCK_SIZE];
-    unsigned int byte, shift;
-    unsigned char bit_cmp;
-
-    block_read(sb.data_bitmap_start, buf);
-    for(byte = 0; byte < BLOCK_SIZE; byte++) {
-        bit_cmp = 1;
-        for(shift = 0; shift <= 7; shift++) {
-            if((bit_cmp & buf[byte]) == 0) {
-                buf[byte] |= bit_cmp;
-                goto find;
-            }
-            bit_cmp = bit_cmp << 1;
-        }
-    }
-    printf("block_alloc: no bit left\n");
-    while(1);
-find:
-    block_write(sb.data_bitmap_start, buf);
-    return byte * 8 + shift + sb.data_start;
+    if(next_block >= sb.data_blocks)
+        fatal("no data block left, use a larger -s", NULL);
+    bitmap_set(sb.data_bitmap_start, next_block);
+    return sb.data_start + next_block++;
 }
 
 // 申请一个inode (修改bitmap)
 unsigned short inode_alloc()
 {
-    char buf[BLOCK_SIZE];
-    unsigned int byte, shift;
-    unsigned char bit_cmp;
-
-    block_read(sb.inode_bitmap_start, buf);
-    for(byte = 0; byte < BLOCK_SIZE; byte++) {
-        bit_cmp = 1;
-        for(shift = 0; shift <= 7; shift++) {
-            if((bit_cmp & buf[byte]) == 0) {
-                buf[byte] |= bit_cmp;
-                goto find;
-            }
-            bit_cmp = bit_cmp << 1;
-        }
-    }
-    printf("inode_alloc: no bit left\n");
-    while(1);
-find:
-    block_write(sb.inode_bitmap_start, buf);
-    return (unsigned short)(byte * 8 + shift);
+    if(next_inode >= n_inode)
+        fatal("no inode left, use a larger -n", NULL);
+    bitmap_set(sb.inode_bitmap_start, next_inode);
+    return (unsigned short)next_inode++;
 }
 
-// 从磁盘读一个inode
-void inode_read(unsigned int inode_num, inode_disk_t* ip)
-{
-    char buf[BLOCK_SIZE];
-    inode_disk_t* dip;
-
-    unsigned int block_num = INODE_LOCATE_BLOCK(inode_num, sb);
-    block_read(block_num, buf);
-    dip = ((inode_disk_t*)buf) + (inode_num % INODE_PER_BLOCK);
-    *ip = *dip;
-}
-
-// 向磁盘写一个inode
+// 向映像写一个inode
 void inode_write(unsigned short inode_num, inode_disk_t* ip)
 {
-    char buf[BLOCK_SIZE];
-    inode_disk_t* dip;
-
-    unsigned int block_num = INODE_LOCATE_BLOCK(inode_num, sb);
-    block_read(block_num, buf);
-    dip = ((inode_disk_t*)buf) + (inode_num % INODE_PER_BLOCK);
-    *dip = *ip;
-    block_write(block_num, buf);
+    inode_disk_t* dip = (inode_disk_t*)block_ptr(INODE_LOCATE_BLOCK(inode_num, sb));
+    dip[inode_num % INODE_PER_BLOCK] = *ip;
 }
 
-// 赋值并写一个inode
-void inode_create(inode_disk_t* inode, unsigned short inode_num, unsigned short type)
+// 赋值一个inode (由inode_flush写入映像)
+void inode_create(inode_disk_t* inode, unsigned short type)
 {
-    inode->type = xshort(type);
-    inode->major = xshort(0);
-    inode->minor = xshort(0);
+    memset(inode, 0, sizeof(*inode));
+    inode->type = type;
+    inode->flags = use_extent ? INODE_F_EXTENT : 0;
     inode->nlink = xshort(1);
-    inode->size = xint(0);
-    for(int i = 0; i < N_ADDRS; i++)
-        inode->addrs[i] = xint(0);
-    inode_write(inode_num, inode);
-}
-
-// dirent_create 专用
-char dir_buf[BLOCK_SIZE];
-
-// 添加一个目录项
-unsigned int dirent_create(unsigned int dir_block, unsigned int offset, char* name, unsigned short inode_num)
-{
-    dirent_t de;
-    de.inode_num = xint(inode_num);
-    assert(strlen(name) < 30);
-    strcpy(de.name, name);
-
-    block_read(dir_block, dir_buf);
-    memmove(dir_buf + offset, &de, sizeof(de));
-    block_write(dir_block, dir_buf);
-
-    return offset + sizeof(dirent_t);
 }
 
 // 辅助 inode_locate_block
@@ -234,21 +226,49 @@ static unsigned int locate_block(unsigned int* entry, unsigned int bn, unsigned
     unsigned int* next_entry;
     unsigned int next_size = size / ENTRY_PER_BLOCK;
     unsigned int next_bn = bn % next_size;
-    unsigned int ret = 0;
-
-    char buf[BLOCK_SIZE];
-    block_read(*entry, buf);
-    next_entry = (unsigned int*)(buf) + bn / next_size;
-    ret = locate_block(next_entry, next_bn, next_size);
 
+    // 间接块直接在映像里修改 (映像里是小端)
+    next_entry = (unsigned int*)block_ptr(*entry) + bn / next_size;
+    unsigned int next = xint(*next_entry);
+    unsigned int ret = locate_block(&next, next_bn, next_size);
+    *next_entry = xint(next);
     return ret;
 }
 
+// extent格式的inode_locate_block
+// mkfs只会顺序追加, block也是顺序申请的, 所以一个文件通常只有一个extent
+static unsigned int extent_locate_block(inode_disk_t* ip, unsigned int bn)
+{
+    extent_header_t* eh = (extent_header_t*)ip->addrs;
+    extent_t* ext = (extent_t*)(eh + 1);
+    unsigned int block = block_alloc();
+
+    if(eh->count > 0) {
+        extent_t* last = &ext[eh->count - 1];
+        assert(bn == last->lblock + last->len);
+        if(block == last->pblock + last->len) {
+            last->len++;
+            return block;
+        }
+    }
+
+    if(eh->count >= EXT_IN_INODE)
+        fatal("file too fragmented for in-inode extents", NULL);
+    ext[eh->count].lblock = bn;
+    ext[eh->count].pblock = block;
+    ext[eh->count].len = 1;
+    eh->count++;
+    return block;
+}
+
 // 确定inode里第bn块data block的block_num
 // 如果不存在第bn块data block则申请一个并返回它的block_num
 // 由于inode->addrs的结构, 这个过程比较复杂, 需要单独处理
 static unsigned int inode_locate_block(inode_disk_t* ip, unsigned int bn)
 {
+    if(ip->flags & INODE_F_EXTENT)
+        return extent_locate_block(ip, bn);
+
     // 在第一个区域
     if(bn < N_ADDRS_1)
         return locate_block(&ip->addrs[bn], bn, 1);
@@ -273,113 +293,415 @@ static unsigned int inode_locate_block(inode_disk_t* ip, unsigned int bn)
         return locate_block(&ip->addrs[N_ADDRS_1 + N_ADDRS_2 + idx], b, size);
     }
 
-    printf("inode_locate_block: overflow\n");
-    while(1);
-
+    fatal("inode_locate_block: overflow", NULL);
     return 0;
 }
 
-// main函数
-int main(int argc, char* argv[])
+// 写回inode (addrs转换成小端)
+static void inode_flush(unsigned short inode_num, inode_disk_t* ip)
 {
-    assert(BLOCK_SIZE % sizeof(inode_disk_t) == 0);
-    
-    // 创建磁盘文件
-    fsfd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0666);
-    if(fsfd < 0) {
-        perror(argv[1]);
-        exit(1);
+    if(ip->flags & INODE_F_EXTENT) {
+        extent_header_t* eh = (extent_header_t*)ip->addrs;
+        extent_t* ext = (extent_t*)(eh + 1);
+        for(int j = 0; j < eh->count; j++) {
+            ext[j].lblock = xint(ext[j].lblock);
+            ext[j].pblock = xint(ext[j].pblock);
+            ext[j].len = xint(ext[j].len);
+        }
+        eh->count = xshort(eh->count);
+        eh->depth = xshort(eh->depth);
+    } else if(!(ip->flags & INODE_F_INLINE)) {
+        for(int j = 0; j < N_ADDRS; j++)
+            ip->addrs[j] = xint(ip->addrs[j]);
     }
+    ip->size = xint(ip->size);
+    inode_write(inode_num, ip);
+}
 
-    // super block 填充
-    sb.magic = FS_MAGIC;
-    sb.block_size = xint(BLOCK_SIZE);
-    sb.inode_blocks = xint(N_INODE_BLOCK);
-    sb.data_blocks = xint(N_DATA_BLOCK);
-    sb.total_blocks = xint(N_BLOCK);
-    sb.inode_bitmap_start = xint(1);
-    sb.inode_start = xint(1 + 1);
-    sb.data_bitmap_start = xint(1 + 1 + N_INODE_BLOCK);
-    sb.data_start = xint(1 + 1 + N_INODE_BLOCK + 1);
-
-    // 缓冲区准备
-    char buf[BLOCK_SIZE];
-    memset(buf, 0, sizeof(buf));
-
-    // 一个全0的磁盘映像
-    for(int i = 0; i < N_BLOCK; i++)
-        block_write(i, buf);
+/*--------------------------- 目录 ------------------------------*/
 
-    // 填写 super block
-    memmove(buf, &sb, sizeof(sb));
-    block_write(0, buf);
+// 导入过程中一个目录的全部目录项, 写入映像前先在内存里收集
+typedef struct dir_list {
+    dirent_t* des;
+    unsigned int* hash;
+    unsigned int n;
+    unsigned int cap;
+} dir_list_t;
 
-    // 创建根目录
-    inode_disk_t rooti;
-    unsigned short root_inum = inode_alloc();
-    unsigned int rooti_block = block_alloc();
-    if(root_inum != 0) {
-        printf("rooti = %d\n", root_inum);
-        while(1);
+// 目录名的hash (FNV-1a, 与内核dir_hash一致)
+unsigned int dir_hash(char* name)
+{
+    unsigned int hash = 2166136261u;
+    for(int i = 0; i < DIR_NAME_LEN && name[i] != 0; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 添加一个目录项
+void dir_list_add(dir_list_t* dl, char* name, unsigned short inode_num)
+{
+    if(strlen(name) >= DIR_NAME_LEN)
+        fatal("name too long", name);
+    if(dl->n == dl->cap) {
+        dl->cap = dl->cap ? dl->cap * 2 : 16;
+        dl->des = realloc(dl->des, dl->cap * sizeof(dirent_t));
+        dl->hash = realloc(dl->hash, dl->cap * sizeof(unsigned int));
+        assert(dl->des && dl->hash);
+    }
+    memset(&dl->des[dl->n], 0, sizeof(dirent_t));
+    dl->des[dl->n].inode_num = xshort(inode_num);
+    strcpy(dl->des[dl->n].name, name);
+    dl->hash[dl->n] = dir_hash(name);
+    dl->n++;
+}
+
+// 按hash排序用
+static dir_list_t* sort_list;
+
+static int dirent_cmp(const void* a, const void* b)
+{
+    unsigned int ha = sort_list->hash[*(unsigned int*)a];
+    unsigned int hb = sort_list->hash[*(unsigned int*)b];
+    return ha < hb ? -1 : ha > hb;
+}
+
+// 把收集好的目录项写进目录inode
+// 一个block放得下时是线性目录, 否则直接建好索引目录:
+// block 0 是根, 后面是中间节点(需要时)和按hash排好序的叶子
+// 同hash的目录项必须在同一个叶子里 (内核的分裂规则)
+static void dir_write(unsigned short inode_num, inode_disk_t* ip, dir_list_t* dl)
+{
+    unsigned int nblocks, nleaf = 0, ninter = 0;
+    unsigned char* data;
+
+    if(dl->n <= DIRENT_PER_BLOCK) {
+        nblocks = 1;
+        data = calloc(1, BLOCK_SIZE);
+        assert(data);
+        memmove(data, dl->des, dl->n * sizeof(dirent_t));
+    } else {
+        unsigned int* order = malloc(dl->n * sizeof(unsigned int));
+        unsigned int* leaf_first = malloc(dl->n * sizeof(unsigned int)); // 每个叶子的第一个目录项
+        assert(order && leaf_first);
+        for(unsigned int i = 0; i < dl->n; i++)
+            order[i] = i;
+        sort_list = dl;
+        qsort(order, dl->n, sizeof(unsigned int), dirent_cmp);
+
+        // 划分叶子, 同时检查重名 (重名的目录项hash相同, 排序后相邻)
+        unsigned int cnt = 0;
+        for(unsigned int i = 0; i < dl->n; i++) {
+            unsigned int h = dl->hash[order[i]];
+            int same = i > 0 && h == dl->hash[order[i - 1]];
+            for(unsigned int j = i; same && j > 0 && dl->hash[order[j - 1]] == h; j--)
+                if(strcmp(dl->des[order[j - 1]].name, dl->des[order[i]].name) == 0)
+                    fatal("duplicate name", dl->des[order[i]].name);
+            if(i == 0 || (cnt >= DX_LEAF_FILL && !same)) {
+                leaf_first[nleaf++] = i;
+                cnt = 0;
+            } else if(cnt == DIRENT_PER_BLOCK) {
+                fatal("too many names with the same hash", dl->des[order[i]].name);
+            }
+            cnt++;
+        }
+        if(nleaf > DX_ENTRY_PER_BLOCK)
+            ninter = (nleaf + DX_ENTRY_PER_BLOCK - 1) / DX_ENTRY_PER_BLOCK;
+        if(ninter > DX_ENTRY_PER_BLOCK)
+            fatal("directory too large", NULL);
+
+        nblocks = 1 + ninter + nleaf;
+        data = calloc(nblocks, BLOCK_SIZE);
+        assert(data);
+
+        // 叶子
+        unsigned int leaf_start = 1 + ninter;
+        for(unsigned int l = 0; l < nleaf; l++) {
+            unsigned int end = l + 1 < nleaf ? leaf_first[l + 1] : dl->n;
+            dirent_t* de = (dirent_t*)(data + (size_t)(leaf_start + l) * BLOCK_SIZE);
+            for(unsigned int i = leaf_first[l]; i < end; i++)
+                *de++ = dl->des[order[i]];
+        }
+
+        // 索引节点: depth 0 时根直接指向叶子, 否则根 -> 中间节点 -> 叶子
+        dx_node_t* root = (dx_node_t*)data;
+        root->magic = xint(DX_MAGIC);
+        root->depth = xshort(ninter ? 1 : 0);
+        for(unsigned int l = 0; l < nleaf; l++) {
+            dx_node_t* node = root;
+            unsigned int pos = l;
+            if(ninter) {
+                unsigned int k = l / DX_ENTRY_PER_BLOCK;
+                node = (dx_node_t*)(data + (size_t)(1 + k) * BLOCK_SIZE);
+                pos = l % DX_ENTRY_PER_BLOCK;
+                if(pos == 0) {
+                    node->magic = xint(DX_MAGIC);
+                    root->entries[k].hash = xint(k ? dl->hash[order[leaf_first[l]]] : 0);
+                    root->entries[k].block = xint(1 + k);
+                    root->count = xshort(k + 1);
+                }
+            }
+            node->entries[pos].hash = xint(l ? dl->hash[order[leaf_first[l]]] : 0);
+            node->entries[pos].block = xint(leaf_start + l);
+            node->count = xshort(pos + 1);
+        }
+        free(order);
+        free(leaf_first);
     }
-    inode_create(&rooti, root_inum, FT_DIR);
 
-    // 添加 . 和 ..
-    unsigned int offset = 0;
-    offset = dirent_create(rooti_block, offset, ".\0", root_inum);
-    offset = dirent_create(rooti_block, offset, "..\0", root_inum);
+    for(unsigned int bn = 0; bn < nblocks; bn++)
+        memmove(block_ptr(inode_locate_block(ip, bn)), data + (size_t)bn * BLOCK_SIZE, BLOCK_SIZE);
+    ip->size = nblocks * BLOCK_SIZE;
+    inode_flush(inode_num, ip);
 
-    // 写入user目录里的可执行文件
-    // ./user/_xxx
-    char* shortname;
-    int fd, read_len;
+    free(data);
+    free(dl->des);
+    free(dl->hash);
+}
+
+/*--------------------------- 导入 ------------------------------*/
+
+// 导入一个普通文件, 返回它的inode_num
+// 文件内容直接读进映像里对应的block
+static unsigned short import_file(char* path)
+{
     inode_disk_t inode;
-    unsigned short inum;
-    unsigned int bn = 0, block_num = 0;
+    unsigned short inum = inode_alloc();
+    inode_create(&inode, FT_FILE);
 
-    for(int i = 2; i < argc; i++)
-    {
-        // 确定shortname
-        shortname = argv[i] + 7;
-        assert(*shortname == '_');
-        assert(index(shortname, '/') == 0);
-        shortname++;
-
-        // 申请新的inode + 创建目录项
-        inum = inode_alloc();
-        inode_create(&inode, inum, FT_FILE);
-        offset = dirent_create(rooti_block, offset, shortname, inum);
-        
-        // 打开文件
-        fd = open(argv[i], 0);
-        if(fd < 0) {
-            perror(argv[i]);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if(st.st_size > 0xFFFFFFFFL)
+        fatal("file too large", path);
+    unsigned int size = st.st_size;
+
+    if(use_inline && size <= INODE_INLINE_MAX) {
+        // 小文件直接放进inode
+        inode.flags = INODE_F_INLINE;
+        if(read(fd, inode.addrs, size) != size)
+            fatal("short read", path);
+    } else {
+        for(unsigned int bn = 0, off = 0; off < size; bn++, off += BLOCK_SIZE) {
+            unsigned int len = size - off < BLOCK_SIZE ? size - off : BLOCK_SIZE;
+            if(read(fd, block_ptr(inode_locate_block(&inode, bn)), len) != len)
+                fatal("short read", path);
+        }
+    }
+    close(fd);
+
+    inode.size = size;
+    inode_flush(inum, &inode);
+    n_file++;
+    return inum;
+}
+
+static unsigned short import_dir(char* path, unsigned short parent);
+
+// 把宿主机目录path下的内容加入dl
+// 普通文件和目录之外的类型 (符号链接, 设备等) 跳过
+static void import_entries(dir_list_t* dl, char* path, unsigned short self)
+{
+    DIR* d = opendir(path);
+    if(d == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    struct dirent* hde;
+    char sub[4096];
+    struct stat st;
+    while((hde = readdir(d)) != NULL) {
+        if(strcmp(hde->d_name, ".") == 0 || strcmp(hde->d_name, "..") == 0)
+            continue;
+        snprintf(sub, sizeof(sub), "%s/%s", path, hde->d_name);
+        if(lstat(sub, &st) < 0) {
+            perror(sub);
             exit(1);
         }
-        
-        // 获取文件内容并写入磁盘
-        while(1) {
-            read_len = read(fd, buf, BLOCK_SIZE);
-            block_num = inode_locate_block(&inode, bn++);
-            block_write(block_num, buf);
-            inode.size += read_len;
-            if(read_len < BLOCK_SIZE) break;
+        if(S_ISREG(st.st_mode))
+            dir_list_add(dl, hde->d_name, import_file(sub));
+        else if(S_ISDIR(st.st_mode))
+            dir_list_add(dl, hde->d_name, import_dir(sub, self));
+        else
+            fprintf(stderr, "mkfs: skip %s\n", sub);
+    }
+    closedir(d);
+}
+
+// 递归导入一个宿主机目录, 返回新目录的inode_num
+static unsigned short import_dir(char* path, unsigned short parent)
+{
+    inode_disk_t inode;
+    dir_list_t dl = {0};
+    unsigned short inum = inode_alloc();
+    inode_create(&inode, FT_DIR);
+
+    dir_list_add(&dl, ".", inum);
+    dir_list_add(&dl, "..", parent);
+    import_entries(&dl, path, inum);
+    dir_write(inum, &inode, &dl);
+    n_dir++;
+    return inum;
+}
+
+// 计算磁盘布局并填写super block
+// size是映像的总block数
+static void layout(unsigned int size)
+{
+    // 内核按整个inode block计算inode数量, 不能超过16位inode_num的范围
+    unsigned int inode_blocks = (n_inode + INODE_PER_BLOCK - 1) / INODE_PER_BLOCK;
+    if(inode_blocks * INODE_PER_BLOCK > INODE_MAX)
+        inode_blocks = INODE_MAX / INODE_PER_BLOCK;
+    n_inode = inode_blocks * INODE_PER_BLOCK;
+    unsigned int ibitmap_blocks = (n_inode + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    unsigned int meta = 1 + N_LOG_BLOCK + ibitmap_blocks + inode_blocks;
+    if(size <= meta + 2)
+        fatal("image too small", NULL);
+
+    // 剩下的空间分给data bitmap和data, 每个bitmap block管理BITS_PER_BLOCK个data block
+    unsigned int dbitmap_blocks = (size - meta + BITS_PER_BLOCK) / (BITS_PER_BLOCK + 1);
+    if(dbitmap_blocks > BITMAP_MAX_BLOCKS)
+        fatal("image too large for the data bitmap", NULL);
+
+    sb.magic = FS_MAGIC;
+    sb.block_size = BLOCK_SIZE;
+    sb.log_start = 1;
+    sb.log_blocks = N_LOG_BLOCK;
+    sb.inode_bitmap_start = 1 + N_LOG_BLOCK;
+    sb.inode_start = sb.inode_bitmap_start + ibitmap_blocks;
+    sb.inode_blocks = inode_blocks;
+    sb.data_bitmap_start = sb.inode_start + inode_blocks;
+    sb.data_start = sb.data_bitmap_start + dbitmap_blocks;
+    sb.data_blocks = size - sb.data_start;
+    sb.total_blocks = size;
+    sb.features = (use_extent ? FS_FEAT_EXTENT : 0) | (use_inline ? FS_FEAT_INLINE : 0);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: mkfs [-e] [-i] [-s size_mb] [-n inodes] [-d dir] fs.img files...\n");
+    exit(1);
+}
+
+// main函数
+// -e: 文件和目录使用extent格式
+// -i: 小文件内联存放
+// -s: 映像大小(MB), 默认34 (32MB数据区)
+// -n: inode数量, 默认2048
+// -d: 把宿主机目录树递归导入根目录 (可以重复)
+// files: 放进根目录的文件, 文件名以'_'开头时去掉'_' (user/_xxx -> /xxx)
+int main(int argc, char* argv[])
+{
+    assert(BLOCK_SIZE >= 512 && BLOCK_SIZE <= 4096 && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0);
+    assert(BLOCK_SIZE % sizeof(inode_disk_t) == 0);
+    assert(sizeof(extent_header_t) + EXT_IN_INODE * sizeof(extent_t) <= sizeof(unsigned int) * N_ADDRS);
+
+    unsigned long size_mb = DEFAULT_SIZE_MB;
+    unsigned long ninode = DEFAULT_N_INODE;
+    char* dirs[16];
+    int ndirs = 0;
+
+    while(argc > 1 && argv[1][0] == '-') {
+        if(strcmp(argv[1], "-e") == 0) {
+            use_extent = 1;
+        } else if(strcmp(argv[1], "-i") == 0) {
+            use_inline = 1;
+        } else if(strcmp(argv[1], "-s") == 0 && argc > 2) {
+            size_mb = strtoul(argv[2], NULL, 0);
+            argv++;
+            argc--;
+        } else if(strcmp(argv[1], "-n") == 0 && argc > 2) {
+            ninode = strtoul(argv[2], NULL, 0);
+            argv++;
+            argc--;
+        } else if(strcmp(argv[1], "-d") == 0 && argc > 2 && ndirs < 16) {
+            dirs[ndirs++] = argv[2];
+            argv++;
+            argc--;
+        } else {
+            usage();
         }
-        
-        // 关闭文件
-        close(fd);
+        argv++;
+        argc--;
+    }
+    if(argc < 2 || size_mb == 0 || size_mb > 4095 || ninode < 2 || ninode > INODE_MAX)
+        usage();
 
-        // 写回inode
-        for(int j = 0; j < N_ADDRS; j++)
-            inode.addrs[j] = xint(inode.addrs[j]);
-        inode.size = xint(inode.size);
-        inode_write(inum, &inode);
+    n_inode = ninode;
+    layout((size_mb << 20) / BLOCK_SIZE);
+
+    // 创建磁盘文件并映射
+    int fsfd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fsfd < 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    size_t img_size = (size_t)sb.total_blocks * BLOCK_SIZE;
+    if(ftruncate(fsfd, img_size) < 0) {
+        perror("ftruncate");
+        exit(1);
+    }
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fsfd, 0);
+    if(img == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
     }
 
-    // 更新rooti
-    rooti.addrs[0] = xint(rooti_block);
-    rooti.size = xint(sizeof(dirent_t) * argc);
-    inode_write(root_inum, &rooti);
+    // 创建根目录
+    inode_disk_t rooti;
+    dir_list_t dl = {0};
+    unsigned short root_inum = inode_alloc();
+    assert(root_inum == 0);
+    inode_create(&rooti, FT_DIR);
+    dir_list_add(&dl, ".", root_inum);
+    dir_list_add(&dl, "..", root_inum);
+
+    // 导入的目录树
+    for(int i = 0; i < ndirs; i++)
+        import_entries(&dl, dirs[i], root_inum);
+
+    // 根目录下的文件 (通常是user目录里的可执行文件 ./user/_xxx)
+    for(int i = 2; i < argc; i++) {
+        char* name = strrchr(argv[i], '/');
+        name = name ? name + 1 : argv[i];
+        if(*name == '_')
+            name++;
+        dir_list_add(&dl, name, import_file(argv[i]));
+    }
+    dir_write(root_inum, &rooti, &dl);
+
+    // 填写 super block
+    super_block_t* dsb = (super_block_t*)block_ptr(0);
+    dsb->magic = xint(sb.magic);
+    dsb->block_size = xint(sb.block_size);
+    dsb->inode_blocks = xint(sb.inode_blocks);
+    dsb->data_blocks = xint(sb.data_blocks);
+    dsb->total_blocks = xint(sb.total_blocks);
+    dsb->log_start = xint(sb.log_start);
+    dsb->log_blocks = xint(sb.log_blocks);
+    dsb->features = xint(sb.features);
+    dsb->inode_bitmap_start = xint(sb.inode_bitmap_start);
+    dsb->inode_start = xint(sb.inode_start);
+    dsb->data_bitmap_start = xint(sb.data_bitmap_start);
+    dsb->data_start = xint(sb.data_start);
+
+    if(msync(img, img_size, MS_SYNC) < 0) {
+        perror("msync");
+        exit(1);
+    }
+    munmap(img, img_size);
+    close(fsfd);
 
+    printf("mkfs: %u blocks (%u data), %u/%u inodes, %u files, %u dirs, %u data blocks used\n",
+           sb.total_blocks, sb.data_blocks, next_inode, n_inode, n_file, n_dir + 1, next_block);
     return 0;
-}
\ No newline at end of file
+}
@@ -22,5 +22,18 @@
 #define SYS_chdir        17
 #define SYS_link         18
 #define SYS_unlink       19
+#define SYS_msync        20
+#define SYS_fallocate    21
+#define SYS_fsync        22
+#define SYS_spawn        23
+#define SYS_pipe         24
+#define SYS_splice       25
+#define SYS_tee          26
+#define SYS_sendfile     27
+#define SYS_readv        28
+#define SYS_writev       29
+#define SYS_pread        30
+#define SYS_pwrite       31
+#define SYS_ring_enter   32
 
 #endif
\ No newline at end of file
@@ -1,10 +1,11 @@
 #include "userlib.h"
 
 // 所有磁盘里.c文件的main函数的外壳
-void _main()
+// exec返回时 a0 = argc, a1 = argv
+void _main(int argc, char** argv)
 {
-    extern int main();
-    int exit_state = main();
+    extern int main(int argc, char** argv);
+    int exit_state = main(argc, argv);
     sys_exit(exit_state);
 }
 
@@ -12,10 +12,11 @@ uint64 sys_brk(uint64 new_heap_top)
     return syscall(SYS_brk, new_heap_top);
 }
 
+// fd = -1 表示匿名映射
 // 成功返回映射空间的起始地址, 失败返回-1
-uint64 sys_mmap(uint64 start, uint32 len)
+uint64 sys_mmap(uint64 start, uint32 len, int prot, int flags, int fd, uint32 offset)
 {
-    return syscall(SYS_mmap, start, len);
+    return syscall(SYS_mmap, start, len, prot, flags, fd, offset);
 }
 
 // 成功返回0 失败返回-1
@@ -24,6 +25,12 @@ uint64 sys_munmap(uint64 start, uint32 len)
     return syscall(SYS_munmap, start, len);
 }
 
+// 成功返回0 失败返回-1
+uint64 sys_msync(uint64 start, uint32 len)
+{
+    return syscall(SYS_msync, start, len);
+}
+
 // 父进程返回子进程pid 子进程返回0
 int sys_fork()
 {
@@ -119,3 +126,85 @@ int sys_unlink(char* path)
 {
     return syscall(SYS_unlink, path);
 }
+
+// 成功返回0 失败返回-1
+int sys_fallocate(int fd, uint32 offset, uint32 len)
+{
+    return syscall(SYS_fallocate, fd, offset, len);
+}
+
+// 成功返回0 失败返回-1
+int sys_fsync(int fd)
+{
+    return syscall(SYS_fsync, fd);
+}
+
+// fd_actions: 成对的{子进程fd, 父进程fd}, 以-1结束, 可以为NULL
+// 成功返回子进程pid 失败返回-1
+int sys_spawn(char* path, char** argv, int* fd_actions)
+{
+    return syscall(SYS_spawn, path, argv, fd_actions);
+}
+
+// fds[0]是读端, fds[1]是写端
+// 成功返回0 失败返回-1
+int sys_pipe(int* fds)
+{
+    return syscall(SYS_pipe, fds);
+}
+
+// in_fd和out_fd至少一个是管道
+// 成功返回移动的字节数 失败返回-1
+int sys_splice(int in_fd, int out_fd, uint32 len)
+{
+    return syscall(SYS_splice, in_fd, out_fd, len);
+}
+
+// in_fd和out_fd都是管道, 不消费in_fd的数据
+// 成功返回复制的字节数 失败返回-1
+int sys_tee(int in_fd, int out_fd, uint32 len)
+{
+    return syscall(SYS_tee, in_fd, out_fd, len);
+}
+
+// in_fd是普通文件
+// 成功返回写入的字节数 失败返回-1
+int sys_sendfile(int out_fd, int in_fd, uint32 len)
+{
+    return syscall(SYS_sendfile, out_fd, in_fd, len);
+}
+
+// iovcnt不超过IOV_MAX
+// 成功返回读取的总字节数 失败返回-1
+uint32 sys_readv(int fd, iovec_t* iov, uint32 iovcnt)
+{
+    return syscall(SYS_readv, fd, iov, iovcnt);
+}
+
+// iovcnt不超过IOV_MAX
+// 成功返回写入的总字节数 失败返回-1
+uint32 sys_writev(int fd, iovec_t* iov, uint32 iovcnt)
+{
+    return syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+// 不使用也不修改文件偏移
+// 成功返回读取的字节数 失败返回-1
+uint32 sys_pread(int fd, uint32 len, void* addr, uint32 offset)
+{
+    return syscall(SYS_pread, fd, len, addr, offset);
+}
+
+// 不使用也不修改文件偏移
+// 成功返回写入的字节数 失败返回-1
+uint32 sys_pwrite(int fd, uint32 len, void* addr, uint32 offset)
+{
+    return syscall(SYS_pwrite, fd, len, addr, offset);
+}
+
+// 执行ring里最多to_submit个提交项, 结果放进完成队列
+// 成功返回执行的提交项数 失败返回-1
+int sys_ring_enter(ring_t* ring, uint32 to_submit)
+{
+    return syscall(SYS_ring_enter, ring, to_submit);
+}
@@ -37,12 +37,67 @@ typedef __builtin_va_list va_list;
 #define LSEEK_ADD 1  // file->offset += offset
 #define LSEEK_SUB 2  // file->offset -= offset
 
+// 支持readv / writev
+
+typedef struct iovec {
+    uint64 base;
+    uint32 len;
+} iovec_t;
+
+#define IOV_MAX 16
+
+// 支持批量系统调用环 (与内核的syscall/ring.h保持一致)
+
+#define RING_ENTRIES   64
+#define RING_NO_OFFSET 0xFFFFFFFF
+
+#define RING_OP_NOP    0
+#define RING_OP_READ   1  // fd addr len offset
+#define RING_OP_WRITE  2  // fd addr len offset
+#define RING_OP_OPEN   3  // addr = path, len = open_mode, 结果是fd
+#define RING_OP_CLOSE  4  // fd
+#define RING_OP_FSYNC  5  // fd
+
+typedef struct ring_sqe {
+    uint32 op;
+    int    fd;
+    uint64 addr;
+    uint32 len;
+    uint32 offset;
+    uint64 user_data;
+} ring_sqe_t;
+
+typedef struct ring_cqe {
+    uint64 user_data;
+    int    res;
+    uint32 pad;
+} ring_cqe_t;
+
+typedef struct ring {
+    uint32 sq_head;
+    uint32 sq_tail;
+    uint32 cq_head;
+    uint32 cq_tail;
+    ring_sqe_t sqes[RING_ENTRIES];
+    ring_cqe_t cqes[RING_ENTRIES];
+} ring_t;
+
+// 支持mmap
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x1  // 修改写回文件
+#define MAP_PRIVATE 0x2  // 修改只对自己可见
+
 // 来自user_syscall.c
 
 int sys_exec(char* path, char** argv);
 uint64 sys_brk(uint64 new_heap_top);
-uint64 sys_mmap(uint64 start, uint32 len);
+uint64 sys_mmap(uint64 start, uint32 len, int prot, int flags, int fd, uint32 offset);
 uint64 sys_munmap(uint64 start, uint32 len);
+uint64 sys_msync(uint64 start, uint32 len);
 int sys_fork();
 int sys_wait(void* addr);
 int sys_exit(int exit_state);
@@ -59,10 +114,22 @@ int sys_mkdir(char* path);
 int sys_chdir(char* path);
 int sys_link(char* old_path, char* new_path);
 int sys_unlink(char* path);
+int sys_fallocate(int fd, uint32 offset, uint32 len);
+int sys_fsync(int fd);
+int sys_spawn(char* path, char** argv, int* fd_actions);
+int sys_pipe(int* fds);
+int sys_splice(int in_fd, int out_fd, uint32 len);
+int sys_tee(int in_fd, int out_fd, uint32 len);
+int sys_sendfile(int out_fd, int in_fd, uint32 len);
+uint32 sys_readv(int fd, iovec_t* iov, uint32 iovcnt);
+uint32 sys_writev(int fd, iovec_t* iov, uint32 iovcnt);
+uint32 sys_pread(int fd, uint32 len, void* addr, uint32 offset);
+uint32 sys_pwrite(int fd, uint32 len, void* addr, uint32 offset);
+int sys_ring_enter(ring_t* ring, uint32 to_submit);
 
 // 来自user_lib.c
 
-void   _main();
+void   _main(int argc, char** argv);
 uint32 stdout(char* str, uint32 len);
 uint32 stdin(char* str, uint32 len);
 void   memset(void* begin, uint8 data, uint32 n);